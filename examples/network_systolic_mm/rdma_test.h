@@ -20,7 +20,9 @@
 
 // Hardcoded some of the configurations
 #define P_KEY 0x1234
-#define R_KEY 0x0008
+
+// PD table entries managed by the PD/MR manager, r_keys are allocated by it
+#define NUM_PD 8
 
 // Total number of hugepages allocated: preallocated_hugepages * per_hugepage_size
 //    -- 256 * 2MB = 512MB
@@ -0,0 +1,154 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+// Microbenchmark of virtual-to-physical address translation. It compares
+// opening /proc/self/pagemap for every lookup, the cached pagemap file
+// descriptor used by get_buffer_paddr() and the batched get_buffer_paddrs().
+// Physical addresses are only reported when run as root; the timing is valid
+// either way.
+
+#include "reconic.h"
+#include <getopt.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static struct option const long_opts[] = {
+  {"pages", required_argument, NULL, 'n'},
+  {"iterations", required_argument, NULL, 'i'},
+  {"help", no_argument, NULL, 'h'},
+  {0, 0, 0, 0}
+};
+
+static void usage(const char *name)
+{
+  fprintf(stdout, "usage: %s [OPTIONS]\n\n", name);
+  fprintf(stdout, "  -n (--pages) number of 4KB pages to translate, default 4096\n");
+  fprintf(stdout, "  -i (--iterations) number of iterations, default 10\n");
+  fprintf(stdout, "  -h (--help) print usage help and exit\n");
+}
+
+/* Translation as done before the pagemap file descriptor was cached */
+static uint64_t legacy_buffer_paddr(void *buffer) {
+  uint64_t page_frame_number = 0;
+  FILE *pagemap = fopen("/proc/self/pagemap", "rb");
+  unsigned long offset = (unsigned long)buffer / getpagesize() * PAGEMAP_LENGTH;
+
+  if(pagemap == NULL) {
+    fprintf(stderr, "Error: failed to open /proc/self/pagemap\n");
+    exit(EXIT_FAILURE);
+  }
+  if(fseek(pagemap, offset, SEEK_SET) != 0) {
+    fprintf(stderr, "Error: Failed to seek pagemap to proper location\n");
+    exit(EXIT_FAILURE);
+  }
+  if(fread(&page_frame_number, 1, PAGEMAP_LENGTH-1, pagemap) != (PAGEMAP_LENGTH-1)) {
+    fprintf(stderr, "Error: failed to get page frame number\n");
+    exit(EXIT_FAILURE);
+  }
+  fclose(pagemap);
+  page_frame_number &= 0x7FFFFFFFFFFFFF;
+
+  return (page_frame_number << PAGE_SHIFT) + ((uint64_t) buffer % getpagesize());
+}
+
+static double elapsed_ns(struct timespec *end, struct timespec *start) {
+  timespec_sub(end, start);
+  return (double) end->tv_sec * 1e9 + (double) end->tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+  int cmd_opt;
+  uint32_t num_pages = 4096;
+  uint32_t iterations = 10;
+  uint64_t page_size = (uint64_t) getpagesize();
+  struct timespec start;
+  struct timespec end;
+  double legacy_ns = 0;
+  double cached_ns = 0;
+  double batch_ns = 0;
+  uint32_t mismatch = 0;
+
+  while ((cmd_opt = getopt_long(argc, argv, "n:i:h", long_opts, NULL)) != -1) {
+    switch (cmd_opt) {
+    case 'n':
+      num_pages = (uint32_t) strtoul(optarg, NULL, 0);
+      break;
+    case 'i':
+      iterations = (uint32_t) strtoul(optarg, NULL, 0);
+      break;
+    default:
+      usage(argv[0]);
+      exit(0);
+      break;
+    }
+  }
+
+  if((num_pages == 0) || (iterations == 0)) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  char* region = (char* ) mmap(NULL, num_pages * page_size, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  void** vaddrs = (void** ) malloc(num_pages * sizeof(void* ));
+  uint64_t* paddrs = (uint64_t* ) malloc(num_pages * sizeof(uint64_t));
+  uint64_t* batch_paddrs = (uint64_t* ) malloc(num_pages * sizeof(uint64_t));
+  if((region == MAP_FAILED) || (vaddrs == NULL) || (paddrs == NULL) || (batch_paddrs == NULL)) {
+    fprintf(stderr, "Error: failed to allocate %d pages\n", num_pages);
+    exit(EXIT_FAILURE);
+  }
+
+  for(uint32_t i=0; i<num_pages; i++) {
+    region[i * page_size] = 1;
+    vaddrs[i] = (void* ) (region + i * page_size + (i % 64) * 8);
+  }
+
+  for(uint32_t it=0; it<iterations; it++) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(uint32_t i=0; i<num_pages; i++) {
+      paddrs[i] = legacy_buffer_paddr(vaddrs[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    legacy_ns += elapsed_ns(&end, &start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(uint32_t i=0; i<num_pages; i++) {
+      paddrs[i] = get_buffer_paddr(vaddrs[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    cached_ns += elapsed_ns(&end, &start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(get_buffer_paddrs(vaddrs, batch_paddrs, num_pages) != 0) {
+      exit(EXIT_FAILURE);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    batch_ns += elapsed_ns(&end, &start);
+  }
+
+  for(uint32_t i=0; i<num_pages; i++) {
+    if(paddrs[i] != batch_paddrs[i]) {
+      mismatch++;
+    }
+  }
+
+  fprintf(stdout, "Translated %d pages x %d iterations\n", num_pages, iterations);
+  fprintf(stdout, "  fopen per lookup : %10.1f ns/address\n", legacy_ns / ((double) num_pages * iterations));
+  fprintf(stdout, "  cached fd pread  : %10.1f ns/address\n", cached_ns / ((double) num_pages * iterations));
+  fprintf(stdout, "  batched pread    : %10.1f ns/address\n", batch_ns / ((double) num_pages * iterations));
+  fprintf(stdout, "  first page paddr : 0x%lx\n", batch_paddrs[0]);
+  if(mismatch) {
+    fprintf(stderr, "Error: %d addresses differ between single and batched lookup\n", mismatch);
+    exit(EXIT_FAILURE);
+  }
+
+  munmap(region, num_pages * page_size);
+  free(vaddrs);
+  free(paddrs);
+  free(batch_paddrs);
+  return 0;
+}
@@ -0,0 +1,181 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+// Test of the POLL_INTERRUPT polling mode without the RecoNIC device. A mock
+// device thread completes requests after a delay and signals an eventfd, the
+// stand-in for an MSI-X vector, only while the waiter has armed it. The test
+// checks that waits on a slow device sleep and shrink the spin window, that
+// waits on a fast device grow it again, that a lost interrupt only delays a
+// wait, and that a wait on a stuck device stops at the deadline.
+
+#include "auxiliary.h"
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+static struct option const long_opts[] = {
+  {"iterations", required_argument, NULL, 'i'},
+  {"help", no_argument, NULL, 'h'},
+  {0, 0, 0, 0}
+};
+
+static void usage(const char *name)
+{
+  fprintf(stdout, "usage: %s [OPTIONS]\n\n", name);
+  fprintf(stdout, "  -i (--iterations) number of waits per scenario, default 100\n");
+  fprintf(stdout, "  -h (--help) print usage help and exit\n");
+}
+
+/* Mock device: a completion counter, like a CQ head, and an interrupt line */
+struct mock_dev_t {
+  pthread_t thread;
+  int event_fd;
+  uint32_t requested;  /* Number of requests posted by the waiter */
+  uint32_t completed;  /* Number of requests completed by the device */
+  uint32_t armed;      /* 1 if the next completion raises the interrupt */
+  uint32_t delay_ns;   /* Completion latency of the device */
+  uint32_t lose_intr;  /* 1 to never raise the interrupt */
+  uint32_t stuck;      /* 1 to never complete */
+  uint32_t stop;
+};
+
+static void *mock_dev_thread(void *arg) {
+  struct mock_dev_t *dev = (struct mock_dev_t *) arg;
+  struct timespec delay;
+  uint64_t event = 1;
+  uint32_t done = 0;
+
+  while(!__atomic_load_n(&dev->stop, __ATOMIC_ACQUIRE)) {
+    if((__atomic_load_n(&dev->requested, __ATOMIC_ACQUIRE) == done) || __atomic_load_n(&dev->stuck, __ATOMIC_ACQUIRE)) {
+      sched_yield();
+      continue;
+    }
+    delay.tv_sec = dev->delay_ns / NSEC_DIV;
+    delay.tv_nsec = dev->delay_ns % NSEC_DIV;
+    if(dev->delay_ns != 0) {
+      nanosleep(&delay, NULL);
+    }
+    done++;
+    __atomic_store_n(&dev->completed, done, __ATOMIC_RELEASE);
+    // One interrupt per arm, like the per-QP interrupt status bits
+    if(__atomic_exchange_n(&dev->armed, 0, __ATOMIC_ACQ_REL) && !dev->lose_intr) {
+      if(write(dev->event_fd, &event, sizeof(event)) != sizeof(event)) {
+        fprintf(stderr, "Error: failed to signal the eventfd\n");
+      }
+    }
+  }
+  return NULL;
+}
+
+static int mock_dev_arm(void *arg) {
+  struct mock_dev_t *dev = (struct mock_dev_t *) arg;
+
+  __atomic_store_n(&dev->armed, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/* Post one request and wait for its completion, return 0 on completion or -1 on timeout */
+static int mock_dev_request(struct mock_dev_t *dev, struct poll_policy_t *policy) {
+  struct poll_state_t poll_state;
+  uint32_t target = __atomic_add_fetch(&dev->requested, 1, __ATOMIC_ACQ_REL);
+
+  poll_wait_begin(&poll_state);
+  poll_wait_set_arm(&poll_state, mock_dev_arm, dev);
+  while(__atomic_load_n(&dev->completed, __ATOMIC_ACQUIRE) != target) {
+    if(poll_wait_step(policy, &poll_state) != 0) {
+      poll_wait_end(policy, &poll_state, 1);
+      return -1;
+    }
+  }
+  poll_wait_end(policy, &poll_state, 0);
+  return 0;
+}
+
+/* Run iterations requests, return the number of timeouts */
+static uint32_t run_scenario(struct mock_dev_t *dev, struct poll_policy_t *policy, const char *name,
+                             uint32_t delay_ns, uint32_t iterations) {
+  uint32_t num_timeouts = 0;
+
+  dev->delay_ns = delay_ns;
+  memset(&policy->stats, 0, sizeof(struct poll_stats_t));
+  for(uint32_t i=0; i<iterations; i++) {
+    if(mock_dev_request(dev, policy) != 0) {
+      num_timeouts++;
+    }
+  }
+  poll_policy_dump_stats(policy, name);
+  return num_timeouts;
+}
+
+static int check(int cond, const char *what) {
+  fprintf(stdout, "%s: %s\n", cond ? "PASS" : "FAIL", what);
+  return cond ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+  int cmd_opt;
+  int failures = 0;
+  uint32_t iterations = 100;
+  struct poll_policy_t policy;
+  struct mock_dev_t dev;
+
+  while ((cmd_opt = getopt_long(argc, argv, "i:h", long_opts, NULL)) != -1) {
+    switch (cmd_opt) {
+    case 'i':
+      iterations = (uint32_t) strtoul(optarg, NULL, 0);
+      break;
+    default:
+      usage(argv[0]);
+      exit(0);
+      break;
+    }
+  }
+
+  memset(&dev, 0, sizeof(dev));
+  dev.event_fd = eventfd(0, EFD_NONBLOCK);
+  if(dev.event_fd < 0) {
+    fprintf(stderr, "Error: failed to create the eventfd\n");
+    exit(EXIT_FAILURE);
+  }
+  if(pthread_create(&dev.thread, NULL, mock_dev_thread, &dev) != 0) {
+    fprintf(stderr, "Error: failed to create the mock device thread\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Up to 4096 spins before sleeping, each sleep capped at 100ms, no wait longer than 1s
+  poll_policy_init(&policy, POLL_INTERRUPT, 4096, 100000000, NSEC_DIV);
+  poll_policy_set_event_fd(&policy, dev.event_fd);
+
+  failures += check(run_scenario(&dev, &policy, "slow device", 2000000, iterations) == 0,
+                    "all completions of a 2ms device are seen");
+  failures += check(policy.stats.wakeups > 0, "waits on a 2ms device are woken up by the eventfd");
+  failures += check(policy.spin_window == POLL_ADAPTIVE_SPIN_MIN, "the spin window shrinks to its minimum");
+
+  failures += check(run_scenario(&dev, &policy, "fast device", 0, iterations) == 0,
+                    "all completions of a fast device are seen");
+  failures += check(policy.spin_window > POLL_ADAPTIVE_SPIN_MIN, "the spin window grows again");
+
+  // The eventfd never fires, each wait ends when its 1ms sleep cap expires
+  policy.backoff_max_ns = 1000000;
+  dev.lose_intr = 1;
+  failures += check(run_scenario(&dev, &policy, "lost interrupt", 2000000, 10) == 0,
+                    "waits complete when the interrupt is lost");
+  failures += check(policy.stats.wakeups == 0, "no wakeup is counted without an interrupt");
+  dev.lose_intr = 0;
+
+  policy.deadline_ns = 10000000;
+  __atomic_store_n(&dev.stuck, 1, __ATOMIC_RELEASE);
+  failures += check(run_scenario(&dev, &policy, "stuck device", 0, 1) == 1,
+                    "a wait on a stuck device stops at the 10ms deadline");
+
+  __atomic_store_n(&dev.stop, 1, __ATOMIC_RELEASE);
+  pthread_join(dev.thread, NULL);
+  close(dev.event_fd);
+
+  fprintf(stdout, "%s: %d check(s) failed\n", (failures == 0) ? "PASSED" : "FAILED", failures);
+  return (failures == 0) ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,170 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+// Benchmark of QP setup time and memory per QP. It opens one RDMA device with
+// the maximum number of QPs, allocates QPs 2, 3, ... one after the other, and
+// reports the setup time and memory per QP each time the number of QPs
+// doubles, from 8 QPs to the maximum. QPs are only configured, no traffic is
+// sent, so the remote MAC and IP addresses are placeholders.
+
+#include "reconic.h"
+#include "rdma_api.h"
+#include <getopt.h>
+#include <unistd.h>
+
+static struct option const long_opts[] = {
+  {"pcie_resource", required_argument, NULL, 'p'},
+  {"num_qp", required_argument, NULL, 'n'},
+  {"qdepth", required_argument, NULL, 'q'},
+  {"rqe_size", required_argument, NULL, 'e'},
+  {"qp_location", required_argument, NULL, 'l'},
+  {"debug", no_argument, NULL, 'g'},
+  {"help", no_argument, NULL, 'h'},
+  {0, 0, 0, 0}
+};
+
+static void usage(const char *name)
+{
+  fprintf(stdout, "usage: %s [OPTIONS]\n\n", name);
+  fprintf(stdout, "  -p (--pcie_resource) PCIe resource\n");
+  fprintf(stdout, "  -n (--num_qp) maximum number of QPs, default %d\n", RDMA_MAX_NUM_QP);
+  fprintf(stdout, "  -q (--qdepth) queue depth, default 64\n");
+  fprintf(stdout, "  -e (--rqe_size) RQ entry size in bytes, default %d\n", RQE_SIZE);
+  fprintf(stdout, "  -l (--qp_location) QP location: host_mem or dev_mem, default host_mem\n");
+  fprintf(stdout, "  -g (--debug) debug mode\n");
+  fprintf(stdout, "  -h (--help) print usage help and exit\n");
+}
+
+static double elapsed_us(struct timespec *end, struct timespec *start) {
+  timespec_sub(end, start);
+  return (double) end->tv_sec * 1e6 + (double) end->tv_nsec / 1e3;
+}
+
+/* Bytes used by the QP table and the allocated QPs, including the buffer blocks of their rings */
+static uint64_t qp_footprint(struct rdma_dev_t *rdma_dev, uint32_t *ring_bytes) {
+  uint64_t bytes = rdma_dev->num_qp_chunks * sizeof(struct rdma_qp_t **);
+  struct rdma_qp_t *qp;
+
+  *ring_bytes = 0;
+  for(uint32_t i=0; i<rdma_dev->num_qp_chunks; i++) {
+    if(rdma_dev->qp_table[i] != NULL) {
+      bytes += (1 << RDMA_QP_TABLE_CHUNK_SHIFT) * sizeof(struct rdma_qp_t *);
+    }
+  }
+  for(uint32_t qpid=1; qpid<=rdma_dev->num_qp; qpid++) {
+    qp = rdma_get_qp(rdma_dev, qpid);
+    if(qp != NULL) {
+      bytes += sizeof(struct rdma_qp_t) + qp->qdepth;
+      *ring_bytes += (uint32_t) (get_rdma_buffer_block_size(rdma_dev->rn_dev, qp->sq) + 
+                                 get_rdma_buffer_block_size(rdma_dev->rn_dev, qp->cq) + 
+                                 get_rdma_buffer_block_size(rdma_dev->rn_dev, qp->rq));
+    }
+  }
+
+  return bytes + *ring_bytes;
+}
+
+int main(int argc, char *argv[])
+{
+  int cmd_opt;
+  char *pcie_resource = NULL;
+  char *qp_location = HOST_MEM;
+  uint32_t num_qp = RDMA_MAX_NUM_QP;
+  uint32_t qdepth = 64;
+  uint32_t rqe_size = RQE_SIZE;
+  int pcie_resource_fd;
+  struct timespec start;
+  struct timespec end;
+  double setup_us = 0;
+  double prev_us = 0;
+  uint32_t prev_qp = 0;
+  uint32_t next_report = 8;
+  uint32_t ring_bytes;
+  uint64_t bytes;
+  struct mac_addr_t local_mac = {0, 0};
+  struct mac_addr_t remote_mac = {0, 0};
+
+  while ((cmd_opt = getopt_long(argc, argv, "p:n:q:e:l:gh", long_opts, NULL)) != -1) {
+    switch (cmd_opt) {
+    case 'p':
+      pcie_resource = optarg;
+      break;
+    case 'n':
+      num_qp = (uint32_t) strtoul(optarg, NULL, 0);
+      break;
+    case 'q':
+      qdepth = (uint32_t) strtoul(optarg, NULL, 0);
+      break;
+    case 'e':
+      rqe_size = (uint32_t) strtoul(optarg, NULL, 0);
+      break;
+    case 'l':
+      qp_location = optarg;
+      break;
+    case 'g':
+      debug = 1;
+      break;
+    default:
+      usage(argv[0]);
+      exit(0);
+      break;
+    }
+  }
+
+  if((pcie_resource == NULL) || (num_qp < 2) || (num_qp > RDMA_MAX_NUM_QP) || (qdepth == 0)) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  struct rn_dev_t *rn_dev = create_rn_dev(pcie_resource, &pcie_resource_fd, 1024, num_qp);
+  struct rdma_dev_t *rdma_dev = create_rdma_dev(rn_dev);
+
+  // One CQ and one RQ doorbell per QP
+  struct rdma_buff_t *cidb_buffer = allocate_rdma_buffer(rn_dev, (uint64_t) (num_qp + 1) << 3, HOST_MEM);
+  uint64_t cq_cidb_addr = cidb_buffer->dma_addr;
+  uint64_t rq_cidb_addr = cidb_buffer->dma_addr + ((num_qp + 1) << 2);
+
+  struct rdma_glb_buf_t *glb_buf = allocate_rdma_glb_buf(rdma_dev, 0, 4096, qp_location);
+  if(glb_buf == NULL) {
+    exit(EXIT_FAILURE);
+  }
+  open_rdma_dev_glb_buf(rdma_dev, local_mac, 0, 0x12b7, glb_buf);
+  if(rdma_mr_cache_create(rdma_dev, 0, 1) != 0) {
+    exit(EXIT_FAILURE);
+  }
+  struct rdma_pd_t *rdma_pd = rdma_alloc_pd(rdma_dev);
+
+  fprintf(stdout, "QPs allocated | setup time (us) | us/QP in step | QP memory (bytes) | bytes/QP | ring bytes/QP\n");
+  for(uint32_t qpid=2; qpid<=num_qp; qpid++) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(allocate_rdma_qp_rqe(rdma_dev, qpid, qpid, rdma_pd, cq_cidb_addr + (qpid << 2), rq_cidb_addr + (qpid << 2),
+                            qdepth, qp_location, &remote_mac, 0, 0x1234, 0, rqe_size) == NULL) {
+      exit(EXIT_FAILURE);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    setup_us += elapsed_us(&end, &start);
+
+    if((rdma_dev->num_qp_allocated == next_report) || (qpid == num_qp)) {
+      bytes = qp_footprint(rdma_dev, &ring_bytes);
+      fprintf(stdout, "%13d | %15.1f | %13.1f | %17ld | %8ld | %13d\n", rdma_dev->num_qp_allocated, setup_us,
+              (setup_us - prev_us) / (rdma_dev->num_qp_allocated - prev_qp), bytes,
+              bytes / rdma_dev->num_qp_allocated, ring_bytes / rdma_dev->num_qp_allocated);
+      prev_us = setup_us;
+      prev_qp = rdma_dev->num_qp_allocated;
+      next_report <<= 1;
+    }
+  }
+
+  dump_rdma_glb_buf_footprint(glb_buf);
+  dump_host_mem_stats(rn_dev);
+
+  free_rdma_glb_buf(rdma_dev, glb_buf);
+  free_rdma_buffer(rn_dev, cidb_buffer);
+  rdma_free_pd(rdma_dev, rdma_pd);
+  close(pcie_resource_fd);
+  destroy_rn_dev(rn_dev);
+  return 0;
+}
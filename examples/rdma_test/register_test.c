@@ -0,0 +1,143 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+// Test of register_rdma_buffer() and deregister_rdma_buffer() on the RecoNIC
+// device. It registers one 4KB page of application memory and a second buffer
+// within the same page, checks the bridge address of the first one, and follows
+// the locked memory of the process (VmLck) through both deregistrations. With
+// -m the application locks the page itself first, and the page must stay
+// locked after both deregistrations.
+
+#include "reconic.h"
+#include "rdma_api.h"
+#include <getopt.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static struct option const long_opts[] = {
+  {"pcie_resource", required_argument, NULL, 'p'},
+  {"app_lock", no_argument, NULL, 'm'},
+  {"debug", no_argument, NULL, 'g'},
+  {"help", no_argument, NULL, 'h'},
+  {0, 0, 0, 0}
+};
+
+static void usage(const char *name)
+{
+  fprintf(stdout, "usage: %s [OPTIONS]\n\n", name);
+  fprintf(stdout, "  -p (--pcie_resource) PCIe resource\n");
+  fprintf(stdout, "  -m (--app_lock) lock the buffer with mlock() before registering it\n");
+  fprintf(stdout, "  -g (--debug) debug mode\n");
+  fprintf(stdout, "  -h (--help) print usage help and exit\n");
+}
+
+/* Locked memory of the process in KB, from /proc/self/status */
+static long locked_kb(void) {
+  FILE *status = fopen("/proc/self/status", "r");
+  char line[256];
+  long kb = -1;
+
+  if(status == NULL) {
+    fprintf(stderr, "Error: failed to open /proc/self/status\n");
+    exit(EXIT_FAILURE);
+  }
+  while(fgets(line, sizeof(line), status) != NULL) {
+    if(strncmp(line, "VmLck:", 6) == 0) {
+      kb = strtol(line + 6, NULL, 10);
+    }
+  }
+  fclose(status);
+  return kb;
+}
+
+static int check(int cond, const char *what) {
+  fprintf(stdout, "%s: %s\n", cond ? "PASS" : "FAIL", what);
+  return cond ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+  int cmd_opt;
+  int failures = 0;
+  char *pcie_resource = NULL;
+  uint8_t app_lock = 0;
+  int pcie_resource_fd;
+  uint64_t win_mask = (1UL << AXIB_BDF_WIN_SHIFT) - 1;
+  uint32_t page_kb = (uint32_t) (getpagesize() >> 10);
+  long base_kb;
+
+  while ((cmd_opt = getopt_long(argc, argv, "p:mgh", long_opts, NULL)) != -1) {
+    switch (cmd_opt) {
+    case 'p':
+      pcie_resource = optarg;
+      break;
+    case 'm':
+      app_lock = 1;
+      break;
+    case 'g':
+      debug = 1;
+      break;
+    default:
+      usage(argv[0]);
+      exit(0);
+      break;
+    }
+  }
+
+  if(pcie_resource == NULL) {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  struct rn_dev_t *rn_dev = create_rn_dev(pcie_resource, &pcie_resource_fd, 1, 2);
+
+  // One page of application memory is always physically contiguous
+  char *buffer = mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(buffer == MAP_FAILED) {
+    fprintf(stderr, "Error: failed to map the application buffer\n");
+    exit(EXIT_FAILURE);
+  }
+  memset(buffer, 0, getpagesize());
+  if(app_lock && (mlock(buffer, getpagesize()) == -1)) {
+    fprintf(stderr, "Error: failed to lock the application buffer\n");
+    exit(EXIT_FAILURE);
+  }
+  base_kb = locked_kb();
+
+  struct rdma_buff_t *whole = register_rdma_buffer(rn_dev, buffer, getpagesize());
+  if(whole == NULL) {
+    exit(EXIT_FAILURE);
+  }
+  failures += check((whole->dma_addr & win_mask) == (get_buffer_paddr(buffer) & win_mask),
+                    "the bridge address translates to the physical address of the buffer");
+  failures += check(locked_kb() == base_kb + (app_lock ? 0 : page_kb),
+                    app_lock ? "a buffer locked by the application is not locked again" : "the buffer is locked");
+
+  struct rdma_buff_t *part = register_rdma_buffer(rn_dev, buffer + 1024, 1024);
+  if(part == NULL) {
+    exit(EXIT_FAILURE);
+  }
+  failures += check(part->dma_addr == whole->dma_addr + 1024, "a buffer within the same page shares its window");
+  dump_axib_bdf_windows(rn_dev);
+
+  deregister_rdma_buffer(rn_dev, whole);
+  failures += check(locked_kb() == base_kb + (app_lock ? 0 : page_kb),
+                    "the page stays locked while another registered buffer uses it");
+
+  deregister_rdma_buffer(rn_dev, part);
+  failures += check(locked_kb() == base_kb,
+                    app_lock ? "the lock of the application is kept" : "the page is unlocked");
+  if(app_lock) {
+    munlock(buffer, getpagesize());
+  }
+
+  munmap(buffer, getpagesize());
+  close(pcie_resource_fd);
+  destroy_rn_dev(rn_dev);
+
+  fprintf(stdout, "%s: %d check(s) failed\n", (failures == 0) ? "PASSED" : "FAILED", failures);
+  return (failures == 0) ? 0 : EXIT_FAILURE;
+}
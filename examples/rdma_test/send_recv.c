@@ -25,24 +25,11 @@ uint16_t dst_qpid       = 2;
 uint8_t  num_qp = 8;
 
 // configure RDMA global control status register
-// data buffer, IPKTERR queue buffer, error buffer, response error buffer and retry packet buffer are allocated at host memory in the current software RDMA APIs.
-// We set default values to these buffers as below.
-// Data buffer size          : 16MB, 256 Data buffers with each having 4KB. Buffers of 4K size each for 
-//                             256 QPs and each QP with up to 16 outstanding transactions.
-// IPKTERR buffer size       : 8KB for IPKTERR buffer. Each error status buffer entry is 64-bit wide. 
-//                             The format is [63: 32] reserved;
-//                                           [31 : 16] QP ID;
-//                                           [15 :  0] Fatal code. 
-// Error buffer size         : 64KB for error buffer. 256 packets of 256 bytes each. Packets that fail 
-//                             packet validation are sent to the error buffer along with 4 bytes of 
-//                             error syndrome.
-// Response error buffer size: 64KB for response error buffer.
-uint16_t num_data_buf          = 4096;
-uint16_t per_data_buf_size     = 4096;
-uint16_t ipkt_err_stat_q_size  = 8192;
-uint16_t num_err_buf           = 256;
-uint16_t per_err_buf_size      = 256;
-uint64_t resp_err_pkt_buf_size = 65536;
+// data buffer, IPKTERR queue buffer, error buffer and response error buffer are sized by 
+// allocate_rdma_glb_buf() from the number of QPs, the number of outstanding packets per QP 
+// and the path MTU. Each QP gets outstanding_ops data buffers of path_mtu bytes.
+uint32_t outstanding_ops = RDMA_GLB_OUTSTANDING_OPS;
+uint32_t path_mtu        = 4096;
 
 struct rn_dev_t* rn_dev;
 
@@ -72,10 +59,7 @@ int main(int argc, char **argv) {
   uint64_t cq_cidb_addr;
   uint64_t rq_cidb_addr;
 
-  struct rdma_buff_t* data_buf;
-  struct rdma_buff_t* ipkterr_buf;
-  struct rdma_buff_t* err_buf;
-  struct rdma_buff_t* resp_err_pkt_buf;
+  struct rdma_glb_buf_t* glb_buf;
 
   struct rdma_dev_t* rdma_dev;
 
@@ -206,24 +190,27 @@ int main(int argc, char **argv) {
   rq_cidb_addr = cidb_buffer->dma_addr + (num_qp<<2);
 
   // data buffer, incoming_pkt_error_stat_q buffer, err_buffer and response error pkt buffer
-  data_buf = allocate_rdma_buffer(rn_dev, (uint64_t) (num_data_buf*per_data_buf_size), "host_mem");
-  ipkterr_buf = allocate_rdma_buffer(rn_dev, (uint64_t) ipkt_err_stat_q_size, "host_mem");
-  err_buf = allocate_rdma_buffer(rn_dev, (uint64_t) (num_err_buf*per_err_buf_size), "host_mem");
-  resp_err_pkt_buf = allocate_rdma_buffer(rn_dev, (uint64_t) resp_err_pkt_buf_size, "host_mem");
+  glb_buf = allocate_rdma_glb_buf(rdma_dev, outstanding_ops, path_mtu, "host_mem");
+  if(glb_buf == NULL) {
+    fprintf(stderr, "Error: failed to allocate ERNIC global buffers\n");
+    exit(EXIT_FAILURE);
+  }
+  dump_rdma_glb_buf_footprint(glb_buf);
 
   /* 
    * 4. Open RDMA engine 
    */
   fprintf(stderr, "Info: OPEN RDMA DEVICE\n");
-  open_rdma_dev(rdma_dev, src_mac, src_ip, udp_sport, num_data_buf, per_data_buf_size,
-                data_buf->dma_addr, ipkt_err_stat_q_size, ipkterr_buf->dma_addr, num_err_buf,
-                per_err_buf_size, err_buf->dma_addr, resp_err_pkt_buf_size, resp_err_pkt_buf->dma_addr);
+  open_rdma_dev_glb_buf(rdma_dev, src_mac, src_ip, udp_sport, glb_buf);
   
   /* 
    * 5. Allocate protection domain for queues and memory regions
    */
   fprintf(stderr, "Info: ALLOCATE PD\n");
-  struct rdma_pd_t* rdma_pd = allocate_rdma_pd(rdma_dev, 0 /* pd_num */);
+  if(rdma_mr_cache_create(rdma_dev, 0 /* first pd_num */, NUM_PD) != 0) {
+    exit(EXIT_FAILURE);
+  }
+  struct rdma_pd_t* rdma_pd = rdma_alloc_pd(rdma_dev);
 
   fprintf(stderr, "Info: OPEN DEVICE FILE\n");
   //int fpga_fd;
@@ -243,23 +230,30 @@ int main(int argc, char **argv) {
   fprintf(stderr, "Info: ALLOCATE RDMA QP\n");
   uint32_t qpid    = 2;
   uint32_t qdepth  = 64;
-  // Allocate SQ, CQ and RQ: (num_qp * qdepth * entry_size)
-  //  --  32KB SQ (8 SQs, each has 4KB and can accommodate 64 WQEs)
-  //  --   2KB CQ (8 CQs, each has 256B and can accommodate 64 CQEs)
-  //  -- 128KB RQ (8 RQs, each has 16KB and can accommodate 64 RQE)
-  // All SQ, CQ and RQ resources can be used for a single QP.
-  allocate_rdma_qp(rdma_dev, 
-                   qpid,
-                   dst_qpid,
-                   rdma_pd,
-                   cq_cidb_addr,
-                   rq_cidb_addr,
-                   qdepth,
-                   qp_location,
-                   &dst_mac,
-                   dst_ip,
-                   P_KEY,
-                   R_KEY);
+  // Allocate SQ, CQ and RQ of this QP: (qdepth * entry_size) each
+  //  --   4KB SQ (64 WQEs of 64B)
+  //  --  256B CQ (64 CQEs of 4B)
+  //  --    RQ (64 RQEs sized to the smallest size class that holds payload_size)
+  uint32_t rqe_size = get_rdma_rqe_size_class(payload_size);
+  if(rqe_size == 0) {
+    fprintf(stderr, "Error: payload size %d exceeds the largest RQ entry\n", payload_size);
+    exit(EXIT_FAILURE);
+  }
+  if(allocate_rdma_qp_rqe(rdma_dev, 
+                          qpid,
+                          dst_qpid,
+                          rdma_pd,
+                          cq_cidb_addr,
+                          rq_cidb_addr,
+                          qdepth,
+                          qp_location,
+                          &dst_mac,
+                          dst_ip,
+                          P_KEY,
+                          0 /* r_key, unused by the QP */,
+                          rqe_size) == NULL) {
+    exit(EXIT_FAILURE);
+  }
 
   /* 
    * 7. Configure last_rq_psn, so that the RDMA packets can be accepted at the remote side
@@ -287,23 +281,23 @@ int main(int argc, char **argv) {
     uint32_t buf_size;
     uint64_t buf_phy_addr;
 
-    buf_size = rdma_dev->qps_ptr[qpid]->rq->buf_size;
-    buf_phy_addr = rdma_dev->qps_ptr[qpid]->rq->dma_addr;
+    buf_size = rdma_get_qp(rdma_dev, qpid)->rq->buf_size;
+    buf_phy_addr = rdma_get_qp(rdma_dev, qpid)->rq->dma_addr;
     uint32_t* recv_tmp = malloc(buf_size);
 
     /* 
     * 8. The client posts receive request.
     */
     fprintf(stderr, "Info: RDMA POST RECEIVE\n");
-    rdma_post_receive(rdma_dev, rdma_dev->qps_ptr[qpid]);
+    rdma_post_receive(rdma_dev, rdma_get_qp(rdma_dev, qpid));
 
     /* 
     * 9. The client releases receive requests served.
     */
     fprintf(stderr, "Info: RELEASE RQ CONSUMED\n");
-    while(rdma_release_rq_consumed(rdma_dev, rdma_dev->qps_ptr[qpid])) {
+    while(rdma_release_rq_consumed(rdma_dev, rdma_get_qp(rdma_dev, qpid))) {
       fprintf(stderr, "Info: The RDMA engine still has RQ requests pending!\n");
-      rdma_post_receive(rdma_dev, rdma_dev->qps_ptr[qpid]);
+      rdma_post_receive(rdma_dev, rdma_get_qp(rdma_dev, qpid));
     }
 
     fprintf(stderr, "Info: All data has been received!\n");
@@ -317,7 +311,7 @@ int main(int argc, char **argv) {
       }
     } else {
       // Link RQ to recv_tmp buffer, as RQ is also in host memory
-      recv_tmp = (uint32_t* ) rdma_dev->qps_ptr[qpid]->rq->buffer;
+      recv_tmp = (uint32_t* ) rdma_get_qp(rdma_dev, qpid)->rq->buffer;
     }
 
     /* 
@@ -352,7 +346,7 @@ int main(int argc, char **argv) {
 
     // As this example is for RDMA send/receive operation. There is no need to 
     // register any memory region for the target QP
-    //rdma_register_memory_region(rdma_dev, rdma_pd, R_KEY, payload_tmp);
+    //rdma_register_memory_region(rdma_dev, rdma_pd, RDMA_R_KEY_AUTO, payload_tmp);
     if(is_device_address(payload_tmp->dma_addr)) {
       // Device memory address
       // Copy sw_golden to the device memory
@@ -370,19 +364,17 @@ int main(int argc, char **argv) {
     }
 
     /* 
-    * 8. The server create a WQE request.
+    * 8. The server create a WQE request. Payloads of up to RDMA_INLINE_MAX_SIZE bytes 
+    *    in the host memory are copied into the WQE and not fetched over PCIe.
     */
     clock_gettime(CLOCK_MONOTONIC, &ts_start);
-    create_a_wqe(rdma_dev, 
-                  qpid, 
-                  wrid, 
-                  wqe_idx, 
-                  payload_tmp->dma_addr, 
-                  payload_size, 
-                  RNIC_OP_SEND, 
-                  0, 
-                  R_KEY, 
-                  0, 0, 0, 0, 0);
+    if(create_a_send_wqe(rdma_dev, qpid, wrid, wqe_idx, payload_tmp, 0, payload_size, RNIC_OP_SEND, 0) != 0) {
+      fprintf(stderr, "Error: Failed to create the RDMA send WQE!\n");
+      goto out;
+    }
+    if((payload_size <= RDMA_INLINE_MAX_SIZE) && !is_device_address(payload_tmp->dma_addr)) {
+      fprintf(stderr, "Info: %d-byte payload is sent inline\n", payload_size);
+    }
 
     if (debug) {
       dump_registers(rdma_dev, 1, qpid);
@@ -420,14 +412,12 @@ int main(int argc, char **argv) {
   close(sockfd);
 
 out:
-  free(cidb_buffer);
-  free(data_buf);
-  free(ipkterr_buf);
-  free(err_buf);
-  free(resp_err_pkt_buf);
+  free_rdma_buffer(rn_dev, cidb_buffer);
+  free_rdma_glb_buf(rdma_dev, glb_buf);
   free(sw_golden);
   close(fpga_fd);
   close(pcie_resource_fd);
+  rdma_free_pd(rdma_dev, rdma_pd);
   destroy_rn_dev(rn_dev);
 
   return 0;
@@ -31,24 +31,11 @@ uint32_t win_size_high = 0;
 uint32_t win_size_low  = 0;
 
 // configure RDMA global control status register
-// data buffer, IPKTERR queue buffer, error buffer, response error buffer and retry packet buffer are allocated at host memory in the current software RDMA APIs.
-// We set default values to these buffers as below.
-// Data buffer size          : 16MB, 256 Data buffers with each having 4KB. Buffers of 4K size each for 
-//                             256 QPs and each QP with up to 16 outstanding transactions.
-// IPKTERR buffer size       : 8KB for IPKTERR buffer. Each error status buffer entry is 64-bit wide. 
-//                             The format is [63: 32] reserved;
-//                                           [31 : 16] QP ID;
-//                                           [15 :  0] Fatal code. 
-// Error buffer size         : 64KB for error buffer. 256 packets of 256 bytes each. Packets that fail 
-//                             packet validation are sent to the error buffer along with 4 bytes of 
-//                             error syndrome.
-// Response error buffer size: 64KB for response error buffer.
-uint16_t num_data_buf          = 4096;
-uint16_t per_data_buf_size     = 4096;
-uint16_t ipkt_err_stat_q_size  = 8192;
-uint16_t num_err_buf           = 256;
-uint16_t per_err_buf_size      = 256;
-uint64_t resp_err_pkt_buf_size = 65536;
+// data buffer, IPKTERR queue buffer, error buffer and response error buffer are sized by 
+// allocate_rdma_glb_buf() from the number of QPs, the number of outstanding packets per QP 
+// and the path MTU. Each QP gets outstanding_ops data buffers of path_mtu bytes.
+uint32_t outstanding_ops = RDMA_GLB_OUTSTANDING_OPS;
+uint32_t path_mtu        = 4096;
 
 struct rn_dev_t* rn_dev;
 
@@ -91,10 +78,7 @@ int main(int argc, char *argv[])
 
   struct rdma_dev_t* rdma_dev;
 
-  struct rdma_buff_t* data_buf;
-  struct rdma_buff_t* ipkterr_buf;
-  struct rdma_buff_t* err_buf;
-  struct rdma_buff_t* resp_err_pkt_buf;
+  struct rdma_glb_buf_t* glb_buf;
 
   uint32_t rq_psn = 0xabc;
   uint32_t sq_psn = 0xabc + 1;
@@ -106,10 +90,12 @@ int main(int argc, char *argv[])
 
   uint64_t write_offset_client;
   int      ret_val;
+  int      num_wqe;
 
   uint64_t write_offset_server;
   uint32_t* sw_golden;
   ssize_t rc;
+  uint32_t r_key;
 
   server = 0;
   client = 0;
@@ -239,24 +225,27 @@ int main(int argc, char *argv[])
   rq_cidb_addr = cidb_buffer->dma_addr + (num_qp<<2);
 
   // data buffer, incoming_pkt_error_stat_q buffer, err_buffer and response error pkt buffer
-  data_buf = allocate_rdma_buffer(rn_dev, (uint64_t) (num_data_buf*per_data_buf_size), "host_mem");
-  ipkterr_buf = allocate_rdma_buffer(rn_dev, (uint64_t) ipkt_err_stat_q_size, "host_mem");
-  err_buf = allocate_rdma_buffer(rn_dev, (uint64_t) (num_err_buf*per_err_buf_size), "host_mem");
-  resp_err_pkt_buf = allocate_rdma_buffer(rn_dev, (uint64_t) resp_err_pkt_buf_size, "host_mem");
+  glb_buf = allocate_rdma_glb_buf(rdma_dev, outstanding_ops, path_mtu, "host_mem");
+  if(glb_buf == NULL) {
+    fprintf(stderr, "Error: failed to allocate ERNIC global buffers\n");
+    exit(EXIT_FAILURE);
+  }
+  dump_rdma_glb_buf_footprint(glb_buf);
 
   /* 
    * 4. Open RDMA engine 
    */
   fprintf(stderr, "Info: OPEN RDMA DEVICE\n");
-  open_rdma_dev(rdma_dev, src_mac, src_ip, udp_sport, num_data_buf, per_data_buf_size,
-                data_buf->dma_addr, ipkt_err_stat_q_size, ipkterr_buf->dma_addr, num_err_buf,
-                per_err_buf_size, err_buf->dma_addr, resp_err_pkt_buf_size, resp_err_pkt_buf->dma_addr);
+  open_rdma_dev_glb_buf(rdma_dev, src_mac, src_ip, udp_sport, glb_buf);
 
   /* 
    * 5. Allocate protection domain for queues and memory regions
    */
   fprintf(stderr, "Info: ALLOCATE PD\n");
-  struct rdma_pd_t* rdma_pd = allocate_rdma_pd(rdma_dev, 0 /* pd_num */);
+  if(rdma_mr_cache_create(rdma_dev, 0 /* first pd_num */, NUM_PD) != 0) {
+    exit(EXIT_FAILURE);
+  }
+  struct rdma_pd_t* rdma_pd = rdma_alloc_pd(rdma_dev);
 
   qdepth = 64;
   qpid   = 2;
@@ -277,13 +266,12 @@ int main(int argc, char *argv[])
    * 6. Allocate a queue pair
    */
   fprintf(stderr, "Info: ALLOCATE RDMA QP\n");
-  // Allocate SQ, CQ and RQ: (num_qp * qdepth * entry_size)
-  //  --  32KB SQ (8 SQs, each has 4KB and can accommodate 64 WQEs)
-  //  --   2KB CQ (8 CQs, each has 256B and can accommodate 64 CQEs)
-  //  -- 128KB RQ (8 RQs, each has 16KB and can accommodate 64 RQE)
-  // All SQ, CQ and RQ resources can be used for a single QP.
+  // Allocate SQ, CQ and RQ of this QP: (qdepth * entry_size) each
+  //  --   4KB SQ (64 WQEs of 64B)
+  //  --  256B CQ (64 CQEs of 4B)
+  //  --  32KB RQ (64 RQEs of RQE_SIZE, 512B)
     //struct rdma_qp_t* qp = 
-    allocate_rdma_qp(rdma_dev,qpid,dst_qpid,rdma_pd,cq_cidb_addr,rq_cidb_addr,qdepth,qp_location,&dst_mac,dst_ip,P_KEY,R_KEY);
+    allocate_rdma_qp(rdma_dev,qpid,dst_qpid,rdma_pd,cq_cidb_addr,rq_cidb_addr,qdepth,qp_location,&dst_mac,dst_ip,P_KEY,0 /* r_key, unused by the QP */);
 
   /* 
    * 7. Configure last_rq_psn, so that the RDMA packets can be accepted at the remote side
@@ -321,6 +309,18 @@ if(client) {
     }
 
     write_offset_client = ntohll(write_offset_client);
+
+    rc = read(sockfd, &r_key, sizeof(r_key));
+
+    if(rc > 0) {
+      fprintf(stderr, "Info: client received remote r_key = 0x%x\n", ntohl(r_key));
+    } else {
+      fprintf(stderr, "Error: Can't receive remote r_key from the remote peer\n");
+      close(sockfd);
+      return -1;
+    }
+
+    r_key = ntohl(r_key);
     
     wqe_idx   = 0;
     wrid      = 0;
@@ -347,8 +347,12 @@ if(client) {
     {
       fprintf(stderr, "Info: creating an RDMA write WQE for writing data\n");
       
-      create_a_wqe(rn_dev->rdma_dev, qpid, wrid, wqe_idx, device_buffer->dma_addr, payload_size, RNIC_OP_WRITE, write_offset_client, R_KEY, 0, 0, 0, 0, 0);
-      wqe_idx = wqe_idx + 1;
+      num_wqe = create_buffer_wqes(rn_dev->rdma_dev, qpid, wrid, wqe_idx, device_buffer, 0, payload_size, RNIC_OP_WRITE, write_offset_client, r_key);
+      if(num_wqe < 0) {
+        fprintf(stderr, "Error: failed to create the WQEs of request %d\n", i);
+        exit(EXIT_FAILURE);
+      }
+      wqe_idx = wqe_idx + (uint32_t) num_wqe;
       fprintf(stderr, "Info: Adding delay of 1s\n");
       sleep(1);
     }
@@ -356,7 +360,7 @@ if(client) {
     //Total payload size is 16777088
     /* subtract the start time from the end time */
       clock_gettime(CLOCK_MONOTONIC, &ts_start);
-      ret_val = rdma_post_batch_send(rn_dev->rdma_dev, qpid, WQE_count);
+      ret_val = rdma_post_batch_send(rn_dev->rdma_dev, qpid, wqe_idx);
       clock_gettime(CLOCK_MONOTONIC, &ts_end);
       if(ret_val>=0) {
         fprintf(stderr, "Successfully sent an RDMA write operation\n");
@@ -397,8 +401,8 @@ if(client) {
     dump_registers(rn_dev->rdma_dev, 0, qpid);
 
     tmp_buffer = allocate_rdma_buffer(rn_dev, total_payload_size, /*qp_location*/"dev_mem");
-    fprintf(stderr,"tmp_buffer size is %d\n", tmp_buffer->buf_size);
-    rdma_register_memory_region(rdma_dev, rdma_pd, R_KEY, tmp_buffer);
+    fprintf(stderr,"tmp_buffer size is %ld\n", tmp_buffer->buf_size);
+    rdma_register_memory_region(rdma_dev, rdma_pd, RDMA_R_KEY_AUTO, tmp_buffer);
     fprintf(stderr, "Info: allocating buffer for payload data\n");
     fprintf(stderr, "Info: tmp_buffer->buffer = %p, tmp_buffer->dma_addr = 0x%lx\n", (uint64_t *) tmp_buffer->buffer, tmp_buffer->dma_addr);
     
@@ -406,6 +410,9 @@ if(client) {
     write(accepted_sockfd, &write_offset_server, sizeof(uint64_t));
     dump_registers(rn_dev->rdma_dev, 0, qpid);
     fprintf(stderr, "Sending write_offset (%lx) to the remote client\n", ntohll(write_offset_server));
+    r_key = htonl(rdma_pd->r_key);
+    write(accepted_sockfd, &r_key, sizeof(uint32_t));
+    fprintf(stderr, "Sending r_key (0x%x) to the remote client\n", rdma_pd->r_key);
 
     fprintf(stderr, "Does the client finish its RDMA write operation? If yes, please press any key\n");
     
@@ -430,14 +437,12 @@ if(client) {
   close(sockfd);	
 
 out:
-  free(cidb_buffer);
-  free(data_buf);
-  free(ipkterr_buf);
-  free(err_buf);
-  free(resp_err_pkt_buf);
+  free_rdma_buffer(rn_dev, cidb_buffer);
+  free_rdma_glb_buf(rdma_dev, glb_buf);
   free(sw_golden);
   close(fpga_fd);
   close(pcie_resource_fd);
+  rdma_free_pd(rdma_dev, rdma_pd);
   destroy_rn_dev(rn_dev);
   return 0;
 }
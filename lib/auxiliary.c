@@ -8,6 +8,7 @@
  *  @brief Implementation of helper functions.
  */
 
+#define _GNU_SOURCE /* ppoll() */
 #include "auxiliary.h"
 
 /* Subtract timespec t2 from t1
@@ -45,3 +46,197 @@ void timespec_sub(struct timespec *t1, struct timespec *t2)
 		t1->tv_nsec += 1000000000;
 	}
 }
+
+void poll_policy_init(struct poll_policy_t* policy, enum poll_mode_t mode, uint32_t spin_limit, 
+                      uint64_t backoff_max_ns, uint64_t deadline_ns) {
+  policy->mode = mode;
+  policy->spin_limit = spin_limit;
+  policy->spin_window = spin_limit;
+  policy->backoff_max_ns = (backoff_max_ns < POLL_BACKOFF_MIN_NS) ? POLL_BACKOFF_MIN_NS : backoff_max_ns;
+  policy->deadline_ns = deadline_ns;
+  policy->event_fd = -1;
+  memset(&policy->stats, 0, sizeof(struct poll_stats_t));
+}
+
+void poll_policy_set_event_fd(struct poll_policy_t* policy, int event_fd) {
+  policy->event_fd = event_fd;
+}
+
+void poll_policy_dump_stats(struct poll_policy_t* policy, const char* name) {
+  struct poll_stats_t* stats = &policy->stats;
+
+  fprintf(stderr, "Polling policy %s: waits=%lu, spins=%lu, yields=%lu, sleeps=%lu, timeouts=%lu, ", 
+          name, stats->waits, stats->spins, stats->yields, stats->sleeps, stats->timeouts);
+  if(policy->mode == POLL_INTERRUPT) {
+    fprintf(stderr, "arms=%lu, wakeups=%lu, spin window=%u (grows=%lu, shrinks=%lu), ", stats->arms,
+            stats->wakeups, policy->spin_window, stats->spin_grows, stats->spin_shrinks);
+  }
+  fprintf(stderr, "total wait=%lu ns, average wait=%lu ns, max wait=%lu ns\n", stats->wait_ns,
+          (stats->waits == 0) ? 0 : stats->wait_ns / stats->waits, stats->max_wait_ns);
+}
+
+static uint64_t poll_elapsed_ns(struct poll_state_t* state) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  timespec_sub(&now, &state->start);
+  return (uint64_t) now.tv_sec * NSEC_DIV + (uint64_t) now.tv_nsec;
+}
+
+void poll_wait_begin(struct poll_state_t* state) {
+  // The clock is only read once a poll fails, so waits that succeed at once stay cheap
+  state->spins = 0;
+  state->backoff_ns = 0;
+  state->spin_ns = 0;
+  state->arm = NULL;
+  state->arm_arg = NULL;
+  state->armed = 0;
+}
+
+void poll_wait_set_arm(struct poll_state_t* state, int (*arm)(void* arg), void* arm_arg) {
+  state->arm = arm;
+  state->arm_arg = arm_arg;
+}
+
+/* Sleep on the eventfd of a POLL_INTERRUPT policy for at most sleep_ns */
+static void poll_wait_interrupt(struct poll_policy_t* policy, struct poll_state_t* state, uint64_t sleep_ns) {
+  struct pollfd pfd;
+  struct timespec sleep_ts;
+  uint64_t event_cnt;
+  int ret;
+
+  if(!state->armed) {
+    // Arm first and let the caller poll once more before sleeping
+    if(state->arm != NULL) {
+      state->arm(state->arm_arg);
+    }
+    state->armed = 1;
+    policy->stats.arms++;
+    return;
+  }
+
+  sleep_ts.tv_sec = sleep_ns / NSEC_DIV;
+  sleep_ts.tv_nsec = sleep_ns % NSEC_DIV;
+  pfd.fd = policy->event_fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  policy->stats.sleeps++;
+  ret = ppoll(&pfd, 1, &sleep_ts, NULL);
+  if((ret > 0) && (pfd.revents & POLLIN)) {
+    if(read(policy->event_fd, &event_cnt, sizeof(event_cnt)) == sizeof(event_cnt)) {
+      policy->stats.wakeups++;
+    }
+  }
+  // The event may belong to another object sharing the interrupt, re-arm before sleeping again
+  state->armed = 0;
+}
+
+int poll_wait_step(struct poll_policy_t* policy, struct poll_state_t* state) {
+  struct timespec sleep_ts;
+  uint64_t elapsed_ns;
+  // Every wait is bounded in time, a stuck device must not hang the caller
+  uint64_t deadline_ns = (policy->deadline_ns != 0) ? policy->deadline_ns : POLL_DEFAULT_DEADLINE_NS;
+  uint32_t spin_limit = (policy->mode == POLL_INTERRUPT) ? policy->spin_window : policy->spin_limit;
+
+  if(state->spins == 0) {
+    clock_gettime(CLOCK_MONOTONIC, &state->start);
+  }
+  state->spins++;
+
+  if((policy->mode == POLL_BUSY_SPIN) || (state->spins <= spin_limit)) {
+    cpu_relax();
+    if((state->spins & (POLL_CLOCK_CHECK_INTERVAL - 1)) != 0) {
+      return 0;
+    }
+    return (poll_elapsed_ns(state) >= deadline_ns) ? -1 : 0;
+  }
+
+  elapsed_ns = poll_elapsed_ns(state);
+  if(elapsed_ns >= deadline_ns) {
+    return -1;
+  }
+  if(state->spin_ns == 0) {
+    state->spin_ns = elapsed_ns;
+  }
+
+  if((policy->mode == POLL_SPIN_YIELD) || ((policy->mode == POLL_INTERRUPT) && (policy->event_fd < 0))) {
+    sched_yield();
+    policy->stats.yields++;
+    return 0;
+  }
+
+  if(policy->mode == POLL_INTERRUPT) {
+    if(deadline_ns - elapsed_ns < policy->backoff_max_ns) {
+      poll_wait_interrupt(policy, state, deadline_ns - elapsed_ns);
+    } else {
+      poll_wait_interrupt(policy, state, policy->backoff_max_ns);
+    }
+    return 0;
+  }
+
+  // POLL_BACKOFF: double the sleep time, never sleeping past the deadline
+  if(state->backoff_ns == 0) {
+    state->backoff_ns = POLL_BACKOFF_MIN_NS;
+  } else if(state->backoff_ns < policy->backoff_max_ns) {
+    state->backoff_ns = ((state->backoff_ns << 1) > policy->backoff_max_ns) ? policy->backoff_max_ns : (state->backoff_ns << 1);
+  }
+  sleep_ts.tv_sec = 0;
+  sleep_ts.tv_nsec = state->backoff_ns;
+  if(deadline_ns - elapsed_ns < state->backoff_ns) {
+    sleep_ts.tv_nsec = deadline_ns - elapsed_ns;
+  }
+  if(sleep_ts.tv_nsec >= NSEC_DIV) {
+    sleep_ts.tv_sec = sleep_ts.tv_nsec / NSEC_DIV;
+    sleep_ts.tv_nsec = sleep_ts.tv_nsec % NSEC_DIV;
+  }
+  nanosleep(&sleep_ts, NULL);
+  policy->stats.sleeps++;
+  return 0;
+}
+
+/* Adapt the spin window of a POLL_INTERRUPT policy to the wait that just finished */
+static void poll_adapt_spin_window(struct poll_policy_t* policy, struct poll_state_t* state, uint64_t wait_ns) {
+  uint32_t min_window = (policy->spin_limit < POLL_ADAPTIVE_SPIN_MIN) ? policy->spin_limit : POLL_ADAPTIVE_SPIN_MIN;
+  uint64_t full_window_ns;
+  uint8_t grow;
+
+  if(policy->spin_window == 0) {
+    return;
+  }
+  if(state->spin_ns == 0) {
+    // Done while spinning, grow only if the event came late in the window
+    grow = (state->spins > (policy->spin_window >> 1));
+  } else {
+    // Slept: grow if spinning for spin_limit polls would have caught the event
+    full_window_ns = state->spin_ns * policy->spin_limit / policy->spin_window;
+    grow = (wait_ns < full_window_ns);
+  }
+
+  if(grow && (policy->spin_window < policy->spin_limit)) {
+    policy->spin_window = ((policy->spin_window << 1) > policy->spin_limit) ? policy->spin_limit : (policy->spin_window << 1);
+    policy->stats.spin_grows++;
+  } else if(!grow && (state->spin_ns != 0) && (policy->spin_window > min_window)) {
+    policy->spin_window = ((policy->spin_window >> 1) < min_window) ? min_window : (policy->spin_window >> 1);
+    policy->stats.spin_shrinks++;
+  }
+}
+
+void poll_wait_end(struct poll_policy_t* policy, struct poll_state_t* state, int timed_out) {
+  uint64_t wait_ns = 0;
+
+  policy->stats.waits++;
+  if(state->spins != 0) {
+    wait_ns = poll_elapsed_ns(state);
+    policy->stats.spins += state->spins;
+    policy->stats.wait_ns += wait_ns;
+    if(wait_ns > policy->stats.max_wait_ns) {
+      policy->stats.max_wait_ns = wait_ns;
+    }
+    if(policy->mode == POLL_INTERRUPT) {
+      poll_adapt_spin_window(policy, state, wait_ns);
+    }
+  }
+  if(timed_out) {
+    policy->stats.timeouts++;
+  }
+}
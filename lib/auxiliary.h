@@ -30,6 +30,8 @@
 #include <string.h>
 #include <assert.h>
 #include <time.h>
+#include <sched.h>
+#include <poll.h>
 
 #ifndef CLOCK_MONOTONIC
 #define CLOCK_MONOTONIC 1
@@ -63,6 +65,15 @@ extern int debug;
    }
 */
 
+/*! \def cpu_relax()
+    \brief Hint the CPU that it is in a spin-wait loop.
+*/
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
+
 /*! \def htonll(x)
     \brief Conversion from host byte order to network byte order.
 */
@@ -73,6 +84,155 @@ extern int debug;
 */
 #define ntohll(x) (((uint64_t)ntohl((x) & 0xFFFFFFFF) << 32) | ntohl((x) >> 32))
 
+/*! \def POLL_CLOCK_CHECK_INTERVAL
+    \brief Number of busy spins between two deadline checks. Must be a power of 2.
+*/
+#define POLL_CLOCK_CHECK_INTERVAL 64
+
+/*! \def POLL_BACKOFF_MIN_NS
+    \brief First sleep time in ns of the exponential backoff polling mode.
+*/
+#define POLL_BACKOFF_MIN_NS 1000
+
+/*! \def POLL_DEFAULT_DEADLINE_NS
+    \brief Maximum wait time in ns of a polling policy whose deadline_ns is 0.
+*/
+#define POLL_DEFAULT_DEADLINE_NS 1000000000ULL
+
+/*! \def POLL_ADAPTIVE_SPIN_MIN
+    \brief Smallest spin window of the adaptive POLL_INTERRUPT mode.
+*/
+#define POLL_ADAPTIVE_SPIN_MIN 64
+
+/*! \enum poll_mode_t
+    \brief What a wait loop does once a polling policy's spin limit is reached.
+*/
+enum poll_mode_t {
+  POLL_BUSY_SPIN = 0, /*!< POLL_BUSY_SPIN keep spinning. Lowest latency, burns a core. */
+  POLL_SPIN_YIELD,    /*!< POLL_SPIN_YIELD call sched_yield() between polls. */
+  POLL_BACKOFF,       /*!< POLL_BACKOFF sleep between polls, doubling the sleep time up
+                           to backoff_max_ns. */
+  POLL_INTERRUPT      /*!< POLL_INTERRUPT spin for spin_window polls, then arm the interrupt
+                           and sleep on event_fd. Each sleep lasts at most backoff_max_ns in
+                           case an interrupt is lost. spin_window adapts between
+                           POLL_ADAPTIVE_SPIN_MIN and spin_limit. */
+};
+
+/*! \struct poll_stats_t
+    \brief Statistics collected by a polling policy.
+*/
+struct poll_stats_t {
+  uint64_t waits;        /*!< waits Number of waits. */
+  uint64_t spins;        /*!< spins Number of unsuccessful polls. */
+  uint64_t yields;       /*!< yields Number of sched_yield() calls. */
+  uint64_t sleeps;       /*!< sleeps Number of backoff sleeps or sleeps on event_fd. */
+  uint64_t arms;         /*!< arms Number of times the interrupt was armed. */
+  uint64_t wakeups;      /*!< wakeups Number of sleeps woken up by event_fd. */
+  uint64_t timeouts;     /*!< timeouts Number of waits that hit the deadline. */
+  uint64_t wait_ns;      /*!< wait_ns Total time in ns spent waiting. */
+  uint64_t max_wait_ns;  /*!< max_wait_ns Longest wait in ns. */
+  uint64_t spin_grows;   /*!< spin_grows Number of times spin_window was doubled. */
+  uint64_t spin_shrinks; /*!< spin_shrinks Number of times spin_window was halved. */
+};
+
+/*! \struct poll_policy_t
+    \brief Polling policy shared by the RDMA and compute wait loops.
+
+    A policy is not thread-safe, use one policy per polling thread.
+*/
+struct poll_policy_t {
+  enum poll_mode_t mode;     /*!< mode polling mode once spin_limit is reached. */
+  uint32_t spin_limit;       /*!< spin_limit Number of busy spins before yielding or sleeping. */
+  uint32_t spin_window;      /*!< spin_window Current number of busy spins of POLL_INTERRUPT,
+                                  at most spin_limit. */
+  uint64_t backoff_max_ns;   /*!< backoff_max_ns Maximum sleep time in ns of POLL_BACKOFF. */
+  uint64_t deadline_ns;      /*!< deadline_ns Maximum wait time in ns. 0 means
+                                  POLL_DEFAULT_DEADLINE_NS. */
+  int event_fd;              /*!< event_fd eventfd signalled by the interrupt source, used by
+                                  POLL_INTERRUPT. -1 if not set. */
+  struct poll_stats_t stats; /*!< stats statistics of the waits using this policy. */
+};
+
+/*! \struct poll_state_t
+    \brief State of one wait driven by a polling policy.
+*/
+struct poll_state_t {
+  struct timespec start; /*!< start time of the first unsuccessful poll. */
+  uint64_t spins;        /*!< spins Number of unsuccessful polls so far. */
+  uint64_t backoff_ns;   /*!< backoff_ns Current sleep time of POLL_BACKOFF. */
+  uint64_t spin_ns;      /*!< spin_ns Time in ns spent in the spin window, 0 while spinning. */
+  int (*arm)(void* arg); /*!< arm callback that re-arms the interrupt of the polled object. */
+  void* arm_arg;         /*!< arm_arg argument passed to arm. */
+  uint8_t armed;         /*!< armed 1 if the interrupt is armed and the caller has polled since. */
+};
+
+/** @brief Initialize a polling policy and clear its statistics.
+ *  @param policy a pointer to the polling policy.
+ *  @param mode polling mode once spin_limit is reached.
+ *  @param spin_limit Number of busy spins before yielding or sleeping.
+ *  @param backoff_max_ns Maximum sleep time in ns of POLL_BACKOFF.
+ *  @param deadline_ns Maximum wait time in ns. 0 means POLL_DEFAULT_DEADLINE_NS.
+ *  @return void.
+ */
+void poll_policy_init(struct poll_policy_t* policy, enum poll_mode_t mode, uint32_t spin_limit, 
+                      uint64_t backoff_max_ns, uint64_t deadline_ns);
+
+/** @brief Set the eventfd a POLL_INTERRUPT policy sleeps on.
+ *
+ *  The eventfd is signalled by the interrupt source, e.g. an MSI-X vector bound to the
+ *  eventfd, or by any userspace thread standing in for the device. The library accesses
+ *  the device through its sysfs BAR resources and cannot bind a vector itself; the
+ *  binding is done by the driver owning the device, e.g. with VFIO_DEVICE_SET_IRQS.
+ *  Use one eventfd per sleeping thread, since a wakeup drains the eventfd counter.
+ *  @param policy a pointer to the polling policy.
+ *  @param event_fd the eventfd, or -1 to detach it.
+ *  @return void.
+ */
+void poll_policy_set_event_fd(struct poll_policy_t* policy, int event_fd);
+
+/** @brief Print the statistics of a polling policy.
+ *  @param policy a pointer to the polling policy.
+ *  @param name name printed with the statistics.
+ *  @return void.
+ */
+void poll_policy_dump_stats(struct poll_policy_t* policy, const char* name);
+
+/** @brief Start a wait driven by a polling policy.
+ *  @param state a pointer to the wait state.
+ *  @return void.
+ */
+void poll_wait_begin(struct poll_state_t* state);
+
+/** @brief Set the callback re-arming the interrupt of the object polled by a wait.
+ *
+ *  With POLL_INTERRUPT, the callback is invoked once the spin limit is reached and after
+ *  every wakeup. The caller polls once more before sleeping, so an event that arrives
+ *  before the interrupt is armed is not missed.
+ *  @param state a pointer to the wait state.
+ *  @param arm callback re-arming the interrupt. NULL if no arming is needed.
+ *  @param arm_arg argument passed to the callback.
+ *  @return void.
+ */
+void poll_wait_set_arm(struct poll_state_t* state, int (*arm)(void* arg), void* arm_arg);
+
+/** @brief Called after each unsuccessful poll. Spins, yields or sleeps according to the policy.
+ *  @param policy a pointer to the polling policy.
+ *  @param state a pointer to the wait state.
+ *  @return 0 to poll again or -1 if the deadline has passed.
+ */
+int poll_wait_step(struct poll_policy_t* policy, struct poll_state_t* state);
+
+/** @brief Finish a wait and update the statistics of the policy.
+ *  @param policy a pointer to the polling policy.
+ *  @param state a pointer to the wait state.
+ *  @param timed_out 1 if the wait hit the deadline, otherwise 0.
+ *
+ *  With POLL_INTERRUPT, spin_window is doubled when a full spin_limit window would have
+ *  caught the event and halved when the wait had to sleep anyway.
+ *  @return void.
+ */
+void poll_wait_end(struct poll_policy_t* policy, struct poll_state_t* state, int timed_out);
+
 /** @brief Subtract timespec t2 from t1
  *  @param t1 A timespec pointer as an end timer. Result is stored in the end timer.
  *  @param t2 A timespec pointer as a start timer.
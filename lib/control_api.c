@@ -31,9 +31,12 @@ uint32_t read32_data(uint32_t* pcie_axil_base, off_t offset) {
   return value;
 }
 
-void gen_ctl_cmd(ctl_cmd_t* ctl_cmd, uint32_t a_baseaddr, uint32_t b_baseaddr, \
-									uint32_t c_baseaddr, uint32_t ctl_cmd_size, uint16_t a_row, \
+void gen_ctl_cmd(ctl_cmd_t* ctl_cmd, uint64_t a_baseaddr, uint64_t b_baseaddr, \
+									uint64_t c_baseaddr, uint32_t ctl_cmd_size, uint16_t a_row, \
 									uint16_t a_col, uint16_t b_col, uint16_t work_id) {
+	if((a_baseaddr | b_baseaddr | c_baseaddr) >> 32) {
+		ctl_cmd_size = CTL_CMD_SIZE_64;
+	}
 	ctl_cmd->ctl_cmd_size = ctl_cmd_size;
 	ctl_cmd->a_baseaddr = a_baseaddr;
 	ctl_cmd->b_baseaddr = b_baseaddr;
@@ -47,9 +50,18 @@ void gen_ctl_cmd(ctl_cmd_t* ctl_cmd, uint32_t a_baseaddr, uint32_t b_baseaddr, \
 void issue_ctl_cmd(void* axil_base, uint32_t offset, ctl_cmd_t* ctl_cmd) {
 	uint32_t ctl_cmd_element;
 	write32_data((uint32_t*) axil_base, offset, ctl_cmd->ctl_cmd_size);
-	write32_data((uint32_t*) axil_base, offset, ctl_cmd->a_baseaddr);
-	write32_data((uint32_t*) axil_base, offset, ctl_cmd->b_baseaddr);
-	write32_data((uint32_t*) axil_base, offset, ctl_cmd->c_baseaddr);
+	if(ctl_cmd->ctl_cmd_size == CTL_CMD_SIZE_64) {
+		write32_data((uint32_t*) axil_base, offset, (uint32_t) ctl_cmd->a_baseaddr);
+		write32_data((uint32_t*) axil_base, offset, (uint32_t) (ctl_cmd->a_baseaddr >> 32));
+		write32_data((uint32_t*) axil_base, offset, (uint32_t) ctl_cmd->b_baseaddr);
+		write32_data((uint32_t*) axil_base, offset, (uint32_t) (ctl_cmd->b_baseaddr >> 32));
+		write32_data((uint32_t*) axil_base, offset, (uint32_t) ctl_cmd->c_baseaddr);
+		write32_data((uint32_t*) axil_base, offset, (uint32_t) (ctl_cmd->c_baseaddr >> 32));
+	} else {
+		write32_data((uint32_t*) axil_base, offset, (uint32_t) ctl_cmd->a_baseaddr);
+		write32_data((uint32_t*) axil_base, offset, (uint32_t) ctl_cmd->b_baseaddr);
+		write32_data((uint32_t*) axil_base, offset, (uint32_t) ctl_cmd->c_baseaddr);
+	}
 	ctl_cmd_element = ((ctl_cmd->a_row << 16) & 0xffff0000) | (ctl_cmd->a_col & 0x0000ffff);
 	write32_data((uint32_t*) axil_base, offset, ctl_cmd_element);
 	ctl_cmd_element = ((ctl_cmd->b_col << 16) & 0xffff0000) | (ctl_cmd->work_id & 0x0000ffff);
@@ -57,9 +69,31 @@ void issue_ctl_cmd(void* axil_base, uint32_t offset, ctl_cmd_t* ctl_cmd) {
 }
 
 uint32_t wait_compute(void* axil_base, uint32_t offset) {
+  return wait_compute_policy(axil_base, offset, NULL);
+}
+
+uint32_t wait_compute_policy(void* axil_base, uint32_t offset, struct poll_policy_t* policy) {
   uint32_t compute_done = 0;
-	while(compute_done == 0) {
-			compute_done = read32_data((uint32_t*) axil_base, offset);
-	}
+  struct poll_state_t poll_state;
+
+  poll_wait_begin(&poll_state);
+  while(1) {
+    compute_done = read32_data((uint32_t*) axil_base, offset);
+    if(compute_done != 0) {
+      break;
+    }
+    if(policy == NULL) {
+      cpu_relax();
+      continue;
+    }
+    if(poll_wait_step(policy, &poll_state) != 0) {
+      poll_wait_end(policy, &poll_state, 1);
+      fprintf(stderr, "Error: wait_compute timeout! offset = 0x%x\n", offset);
+      return 0;
+    }
+  }
+  if(policy != NULL) {
+    poll_wait_end(policy, &poll_state, 0);
+  }
   return compute_done;
 }
\ No newline at end of file
@@ -18,14 +18,26 @@
 #include "auxiliary.h"
 #include "reconic_reg.h"
 
+/*! \def CTL_CMD_SIZE_32
+    \brief Number of words of a compute control command with 32-bit base addresses.
+*/
+#define CTL_CMD_SIZE_32 6
+
+/*! \def CTL_CMD_SIZE_64
+    \brief Number of words of a compute control command with 64-bit base addresses.
+
+    Each base address is sent as a {low, high} pair of 32-bit words.
+*/
+#define CTL_CMD_SIZE_64 9
+
 /*! \struct ctl_cmd_t
     \brief Compute control command structure.
 */
 typedef struct {
 	uint32_t ctl_cmd_size; /*!< ctl_cmd_size size of a compute control command. */
-	uint32_t a_baseaddr;   /*!< a_baseaddr baseaddress of array A. */
-	uint32_t b_baseaddr;   /*!< b_baseaddr baseaddress of array B. */
-	uint32_t c_baseaddr;   /*!< c_baseaddr baseaddress of array C. */
+	uint64_t a_baseaddr;   /*!< a_baseaddr baseaddress of array A. */
+	uint64_t b_baseaddr;   /*!< b_baseaddr baseaddress of array B. */
+	uint64_t c_baseaddr;   /*!< c_baseaddr baseaddress of array C. */
 	uint16_t a_row;        /*!< a_row row size of array A. */
 	uint16_t a_col;        /*!< a_col column size of array A. */
 	uint16_t b_col;        /*!< b_col column size of array B. */
@@ -48,6 +60,8 @@ void write32_data(uint32_t* pcie_axil_base, off_t offset, uint32_t value);
 uint32_t read32_data(uint32_t* pcie_axil_base, off_t offset);
 
 /** @brief Compute control API: A function used to construct a compute control command.
+ *
+ *  The command uses CTL_CMD_SIZE_64 words if any base address does not fit in 32 bits.
  *  @param ctl_cmd A compute control command pointer.
  *  @param a_baseaddr baseaddress of array A.
  *  @param b_baseaddr baseaddress of array B.
@@ -59,8 +73,8 @@ uint32_t read32_data(uint32_t* pcie_axil_base, off_t offset);
  *  @param work_id a work/job ID.
  *  @return void.
  */
-void gen_ctl_cmd(ctl_cmd_t* ctl_cmd, uint32_t a_baseaddr, uint32_t b_baseaddr, \
-									uint32_t c_baseaddr, uint32_t ctl_cmd_size, uint16_t a_row, \
+void gen_ctl_cmd(ctl_cmd_t* ctl_cmd, uint64_t a_baseaddr, uint64_t b_baseaddr, \
+									uint64_t c_baseaddr, uint32_t ctl_cmd_size, uint16_t a_row, \
 									uint16_t a_col, uint16_t b_col, uint16_t work_id);
 
 /** @brief Compute control API: A function used to issue a compute control command to 
@@ -86,4 +100,13 @@ void issue_ctl_cmd(void* axil_base, uint32_t offset, ctl_cmd_t* ctl_cmd);
  */
 uint32_t wait_compute(void* axil_base, uint32_t offset);
 
+/** @brief Compute control API: wait_compute() following a polling policy.
+ *  @param axil_base AXIL base address of a PCIe device.
+ *  @param offset address offset of a status FIFO associated to the target accelerator.
+ *  @param policy a pointer to the polling policy, e.g. the policy of the RDMA device.
+ *                NULL busy-spins without deadline, like wait_compute().
+ *  @return the work ID or 0 if the deadline of the polling policy has passed.
+ */
+uint32_t wait_compute_policy(void* axil_base, uint32_t offset, struct poll_policy_t* policy);
+
 #endif /* __CONTROL_API_H__ */
\ No newline at end of file
@@ -0,0 +1,360 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+/** @file mem_alloc.c
+ *  @brief Buddy and slab allocator for RecoNIC buffer pools.
+ *
+ */
+
+#include "mem_alloc.h"
+
+#define BLOCK_NONE 0xffffffff
+
+/* Block states */
+#define BLOCK_TAIL       0
+#define BLOCK_FREE_HEAD  1
+#define BLOCK_ALLOC_HEAD 2
+#define BLOCK_SLAB       3
+
+static void list_push(struct mem_alloc_t* alloc, uint32_t* head, uint32_t blk) {
+  alloc->prev[blk] = BLOCK_NONE;
+  alloc->next[blk] = *head;
+  if(*head != BLOCK_NONE) {
+    alloc->prev[*head] = blk;
+  }
+  *head = blk;
+}
+
+static void list_remove(struct mem_alloc_t* alloc, uint32_t* head, uint32_t blk) {
+  if(alloc->prev[blk] != BLOCK_NONE) {
+    alloc->next[alloc->prev[blk]] = alloc->next[blk];
+  } else {
+    *head = alloc->next[blk];
+  }
+  if(alloc->next[blk] != BLOCK_NONE) {
+    alloc->prev[alloc->next[blk]] = alloc->prev[blk];
+  }
+}
+
+static void buddy_push_free(struct mem_alloc_t* alloc, uint32_t blk, uint32_t order) {
+  alloc->state[blk] = BLOCK_FREE_HEAD;
+  alloc->order[blk] = (uint8_t) order;
+  list_push(alloc, &alloc->free_head[order], blk);
+}
+
+static uint32_t buddy_alloc(struct mem_alloc_t* alloc, uint32_t order) {
+  uint32_t k;
+  uint32_t blk;
+
+  for(k = order; k <= alloc->max_order; k++) {
+    if(alloc->free_head[k] != BLOCK_NONE) {
+      break;
+    }
+  }
+  if(k > alloc->max_order) {
+    return BLOCK_NONE;
+  }
+
+  blk = alloc->free_head[k];
+  list_remove(alloc, &alloc->free_head[k], blk);
+
+  // Split down to the requested order, keeping the upper halves free
+  while(k > order) {
+    k--;
+    buddy_push_free(alloc, blk + (1U << k), k);
+  }
+
+  alloc->state[blk] = BLOCK_ALLOC_HEAD;
+  alloc->order[blk] = (uint8_t) order;
+  return blk;
+}
+
+static void buddy_free(struct mem_alloc_t* alloc, uint32_t blk) {
+  uint32_t order = alloc->order[blk];
+  uint32_t buddy;
+
+  alloc->state[blk] = BLOCK_TAIL;
+  while(order < alloc->max_order) {
+    buddy = blk ^ (1U << order);
+    if((buddy + (1U << order) > alloc->num_blocks) || (alloc->state[buddy] != BLOCK_FREE_HEAD) ||
+       (alloc->order[buddy] != order)) {
+      break;
+    }
+    list_remove(alloc, &alloc->free_head[order], buddy);
+    alloc->state[buddy] = BLOCK_TAIL;
+    blk = (blk < buddy) ? blk : buddy;
+    order++;
+  }
+  buddy_push_free(alloc, blk, order);
+}
+
+static uint64_t slab_full_mask(struct mem_alloc_t* alloc, uint32_t cls) {
+  uint32_t num_objects = 1U << (MEM_ALLOC_SLAB_OBJECTS_SHIFT - cls);
+
+  return (num_objects == 64) ? 0xffffffffffffffff : ((1UL << num_objects) - 1);
+}
+
+static uint32_t slab_class_shift(struct mem_alloc_t* alloc, uint32_t cls) {
+  return alloc->min_shift - MEM_ALLOC_SLAB_OBJECTS_SHIFT + cls;
+}
+
+static uint64_t slab_alloc(struct mem_alloc_t* alloc, uint32_t cls) {
+  uint32_t blk = alloc->partial_head[cls];
+  uint32_t obj;
+
+  if(blk == BLOCK_NONE) {
+    blk = buddy_alloc(alloc, 0);
+    if(blk == BLOCK_NONE) {
+      return MEM_ALLOC_FAILED;
+    }
+    alloc->state[blk] = BLOCK_SLAB;
+    alloc->order[blk] = (uint8_t) cls;
+    alloc->slab_free[blk] = slab_full_mask(alloc, cls);
+    list_push(alloc, &alloc->partial_head[cls], blk);
+    alloc->stats.num_slabs++;
+  }
+
+  obj = __builtin_ctzll(alloc->slab_free[blk]);
+  alloc->slab_free[blk] &= ~(1UL << obj);
+  if(alloc->slab_free[blk] == 0) {
+    list_remove(alloc, &alloc->partial_head[cls], blk);
+  }
+
+  return ((uint64_t) blk << alloc->min_shift) + ((uint64_t) obj << slab_class_shift(alloc, cls));
+}
+
+static int slab_free(struct mem_alloc_t* alloc, uint32_t blk, uint64_t offset) {
+  uint32_t cls = alloc->order[blk];
+  uint32_t shift = slab_class_shift(alloc, cls);
+  uint64_t in_block = offset & ((1UL << alloc->min_shift) - 1);
+  uint32_t obj = (uint32_t) (in_block >> shift);
+
+  if((in_block & ((1UL << shift) - 1)) || (alloc->slab_free[blk] & (1UL << obj))) {
+    return -1;
+  }
+
+  if(alloc->slab_free[blk] == 0) {
+    list_push(alloc, &alloc->partial_head[cls], blk);
+  }
+  alloc->slab_free[blk] |= (1UL << obj);
+  if(alloc->slab_free[blk] == slab_full_mask(alloc, cls)) {
+    // Slab is empty, return its block to the buddy allocator
+    list_remove(alloc, &alloc->partial_head[cls], blk);
+    alloc->order[blk] = 0;
+    alloc->stats.num_slabs--;
+    buddy_free(alloc, blk);
+  }
+  alloc->stats.slab_bytes_in_use -= (1UL << shift);
+  alloc->stats.bytes_in_use -= (1UL << shift);
+  return 0;
+}
+
+struct mem_alloc_t* mem_alloc_create(uint64_t size, uint32_t min_shift) {
+  struct mem_alloc_t* alloc = mem_alloc_create_reserved(size, min_shift);
+
+  if((alloc != NULL) && (mem_alloc_add_range(alloc, 0, alloc->size) != 0)) {
+    mem_alloc_destroy(alloc);
+    return NULL;
+  }
+  return alloc;
+}
+
+struct mem_alloc_t* mem_alloc_create_reserved(uint64_t size, uint32_t min_shift) {
+  struct mem_alloc_t* alloc;
+  uint64_t num_blocks = size >> min_shift;
+  uint32_t order;
+  uint32_t i;
+
+  if((num_blocks == 0) || (num_blocks >= BLOCK_NONE) || (min_shift < MEM_ALLOC_SLAB_OBJECTS_SHIFT)) {
+    fprintf(stderr, "Error: invalid allocator size 0x%lx with block shift %d\n", size, min_shift);
+    return NULL;
+  }
+
+  alloc = (struct mem_alloc_t* ) calloc(1, sizeof(struct mem_alloc_t));
+  if(alloc == NULL) {
+    fprintf(stderr, "Error: failed to allocate mem_alloc\n");
+    return NULL;
+  }
+  alloc->num_blocks = (uint32_t) num_blocks;
+  alloc->size       = num_blocks << min_shift;
+  alloc->min_shift  = min_shift;
+  alloc->state      = (uint8_t* ) calloc(num_blocks, sizeof(uint8_t));
+  alloc->order      = (uint8_t* ) calloc(num_blocks, sizeof(uint8_t));
+  alloc->next       = (uint32_t* ) malloc(num_blocks * sizeof(uint32_t));
+  alloc->prev       = (uint32_t* ) malloc(num_blocks * sizeof(uint32_t));
+  alloc->slab_free  = (uint64_t* ) calloc(num_blocks, sizeof(uint64_t));
+  if((alloc->state == NULL) || (alloc->order == NULL) || (alloc->next == NULL) ||
+     (alloc->prev == NULL) || (alloc->slab_free == NULL)) {
+    fprintf(stderr, "Error: failed to allocate mem_alloc metadata\n");
+    mem_alloc_destroy(alloc);
+    return NULL;
+  }
+
+  for(order = 0; (order < MEM_ALLOC_MAX_ORDER) && ((2UL << order) <= num_blocks); order++);
+  alloc->max_order = order;
+  for(i = 0; i <= MEM_ALLOC_MAX_ORDER; i++) {
+    alloc->free_head[i] = BLOCK_NONE;
+  }
+  for(i = 0; i < MEM_ALLOC_NUM_CLASSES; i++) {
+    alloc->partial_head[i] = BLOCK_NONE;
+  }
+
+  return alloc;
+}
+
+int mem_alloc_add_range(struct mem_alloc_t* alloc, uint64_t offset, uint64_t size) {
+  uint64_t end_blk = (offset + size) >> alloc->min_shift;
+  uint32_t blk;
+  uint32_t order;
+
+  if(((offset | size) & ((1UL << alloc->min_shift) - 1)) || (offset + size > alloc->size)) {
+    fprintf(stderr, "Error: invalid allocator range 0x%lx + 0x%lx\n", offset, size);
+    return -1;
+  }
+
+  // Carve the range into the largest naturally aligned blocks, merging them with free 
+  // neighbours added before
+  for(blk = (uint32_t) (offset >> alloc->min_shift); blk < end_blk; blk += (1U << order)) {
+    for(order = alloc->max_order; order > 0; order--) {
+      if(((blk & ((1U << order) - 1)) == 0) && ((uint64_t) blk + (1U << order) <= end_blk)) {
+        break;
+      }
+    }
+    alloc->order[blk] = (uint8_t) order;
+    buddy_free(alloc, blk);
+  }
+
+  alloc->stats.size += size;
+  return 0;
+}
+
+void mem_alloc_destroy(struct mem_alloc_t* alloc) {
+  if(alloc != NULL) {
+    free(alloc->state);
+    free(alloc->order);
+    free(alloc->next);
+    free(alloc->prev);
+    free(alloc->slab_free);
+    free(alloc);
+  }
+}
+
+uint64_t mem_alloc_alloc(struct mem_alloc_t* alloc, uint64_t size, uint64_t* alloc_size) {
+  uint64_t offset;
+  uint64_t usable;
+  uint32_t cls;
+  uint32_t order;
+  uint32_t blk;
+
+  if(size == 0) {
+    size = 1;
+  }
+
+  if(size <= (1UL << (alloc->min_shift - 1))) {
+    // Smallest size class that fits
+    for(cls = 0; (1UL << slab_class_shift(alloc, cls)) < size; cls++);
+    offset = slab_alloc(alloc, cls);
+    usable = 1UL << slab_class_shift(alloc, cls);
+    if(offset != MEM_ALLOC_FAILED) {
+      alloc->stats.slab_bytes_in_use += usable;
+    }
+  } else {
+    for(order = 0; (order <= alloc->max_order) && ((1UL << (alloc->min_shift + order)) < size); order++);
+    blk = (order <= alloc->max_order) ? buddy_alloc(alloc, order) : BLOCK_NONE;
+    offset = (blk == BLOCK_NONE) ? MEM_ALLOC_FAILED : ((uint64_t) blk << alloc->min_shift);
+    usable = 1UL << (alloc->min_shift + order);
+  }
+
+  if(offset == MEM_ALLOC_FAILED) {
+    alloc->stats.num_failures++;
+    return MEM_ALLOC_FAILED;
+  }
+
+  alloc->stats.num_allocs++;
+  alloc->stats.bytes_in_use += usable;
+  if(alloc_size != NULL) {
+    *alloc_size = usable;
+  }
+  return offset;
+}
+
+int mem_alloc_free(struct mem_alloc_t* alloc, uint64_t offset) {
+  uint32_t blk;
+
+  if(offset >= alloc->size) {
+    fprintf(stderr, "Error: free of offset 0x%lx outside of the allocator\n", offset);
+    return -1;
+  }
+
+  blk = (uint32_t) (offset >> alloc->min_shift);
+  if(alloc->state[blk] == BLOCK_SLAB) {
+    if(slab_free(alloc, blk, offset) != 0) {
+      fprintf(stderr, "Error: invalid free of slab object at offset 0x%lx\n", offset);
+      return -1;
+    }
+  } else {
+    if((alloc->state[blk] != BLOCK_ALLOC_HEAD) || (offset & ((1UL << alloc->min_shift) - 1))) {
+      fprintf(stderr, "Error: invalid free of block at offset 0x%lx\n", offset);
+      return -1;
+    }
+    alloc->stats.bytes_in_use -= (1UL << (alloc->min_shift + alloc->order[blk]));
+    buddy_free(alloc, blk);
+  }
+
+  alloc->stats.num_frees++;
+  return 0;
+}
+
+uint64_t mem_alloc_usable_size(struct mem_alloc_t* alloc, uint64_t offset) {
+  uint32_t blk;
+
+  if(offset >= alloc->size) {
+    return 0;
+  }
+
+  blk = (uint32_t) (offset >> alloc->min_shift);
+  if(alloc->state[blk] == BLOCK_SLAB) {
+    return 1UL << slab_class_shift(alloc, alloc->order[blk]);
+  }
+  if((alloc->state[blk] == BLOCK_ALLOC_HEAD) && !(offset & ((1UL << alloc->min_shift) - 1))) {
+    return 1UL << (alloc->min_shift + alloc->order[blk]);
+  }
+  return 0;
+}
+
+void mem_alloc_get_stats(struct mem_alloc_t* alloc, struct mem_alloc_stats_t* stats) {
+  uint32_t order;
+  uint32_t blk;
+
+  *stats = alloc->stats;
+  stats->bytes_free = 0;
+  stats->largest_free = 0;
+  stats->num_free_blocks = 0;
+  for(order = 0; order <= alloc->max_order; order++) {
+    for(blk = alloc->free_head[order]; blk != BLOCK_NONE; blk = alloc->next[blk]) {
+      stats->bytes_free += (1UL << (alloc->min_shift + order));
+      stats->largest_free = (1UL << (alloc->min_shift + order));
+      stats->num_free_blocks++;
+    }
+  }
+}
+
+void mem_alloc_dump_stats(struct mem_alloc_t* alloc, const char* name) {
+  struct mem_alloc_stats_t stats;
+  double fragmentation = 0.0;
+
+  mem_alloc_get_stats(alloc, &stats);
+  if(stats.bytes_free != 0) {
+    fragmentation = 100.0 * (1.0 - (double) stats.largest_free / (double) stats.bytes_free);
+  }
+
+  fprintf(stderr, "Info: %s allocator: size = 0x%lx, in use = 0x%lx, free = 0x%lx in %ld blocks, largest free = 0x%lx\n",
+          name, stats.size, stats.bytes_in_use, stats.bytes_free, stats.num_free_blocks, stats.largest_free);
+  fprintf(stderr, "Info: %s allocator: slabs = %ld, slab bytes in use = 0x%lx, external fragmentation = %.1f%%\n",
+          name, stats.num_slabs, stats.slab_bytes_in_use, fragmentation);
+  fprintf(stderr, "Info: %s allocator: allocs = %ld, frees = %ld, failures = %ld\n",
+          name, stats.num_allocs, stats.num_frees, stats.num_failures);
+}
@@ -0,0 +1,151 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+/** @file mem_alloc.h
+ *  @brief Buddy and slab allocator for RecoNIC buffer pools
+ *
+ *  The allocator manages a range of offsets [0, size) and keeps all of its
+ *  metadata outside the managed range, so it can be used for both the host
+ *  hugepage pool and the device memory. Requests of at least one block are
+ *  served by a buddy allocator, which returns naturally aligned power-of-two
+ *  blocks and coalesces them again on free. Smaller requests are served from
+ *  slabs, single blocks carved into objects of one size class, so a small
+ *  object never crosses a block boundary.
+ */
+
+#ifndef __MEM_ALLOC_H__
+#define __MEM_ALLOC_H__
+
+#include "auxiliary.h"
+
+/*! \def MEM_ALLOC_FAILED
+    \brief Offset returned by mem_alloc_alloc() when the request cannot be served.
+*/
+#define MEM_ALLOC_FAILED 0xffffffffffffffff
+
+/*! \def MEM_ALLOC_MAX_ORDER
+    \brief Largest buddy order. A block of order k spans 2^k minimum blocks.
+*/
+#define MEM_ALLOC_MAX_ORDER 31
+
+/*! \def MEM_ALLOC_SLAB_OBJECTS_SHIFT
+    \brief log2 of the number of objects of the smallest size class in a slab.
+
+    A slab keeps a 64-bit free bitmap, so the smallest size class is 1/64 of a block.
+*/
+#define MEM_ALLOC_SLAB_OBJECTS_SHIFT 6
+
+/*! \def MEM_ALLOC_NUM_CLASSES
+    \brief Number of slab size classes: 1/64, 1/32, ..., 1/2 of a block.
+*/
+#define MEM_ALLOC_NUM_CLASSES MEM_ALLOC_SLAB_OBJECTS_SHIFT
+
+/*! \struct mem_alloc_stats_t
+    \brief Usage and fragmentation statistics of an allocator.
+*/
+struct mem_alloc_stats_t {
+  uint64_t size;               /*!< size Number of bytes managed, see mem_alloc_add_range(). */
+  uint64_t bytes_in_use;       /*!< bytes_in_use Bytes held by allocated blocks and slab objects. */
+  uint64_t bytes_free;         /*!< bytes_free Bytes in free buddy blocks. */
+  uint64_t largest_free;       /*!< largest_free Size of the largest free buddy block. */
+  uint64_t num_free_blocks;    /*!< num_free_blocks Number of free buddy blocks. */
+  uint64_t num_slabs;          /*!< num_slabs Number of blocks used as slabs. */
+  uint64_t slab_bytes_in_use;  /*!< slab_bytes_in_use Bytes held by slab objects. */
+  uint64_t num_allocs;         /*!< num_allocs Number of successful allocations. */
+  uint64_t num_frees;          /*!< num_frees Number of frees. */
+  uint64_t num_failures;       /*!< num_failures Number of allocations that could not be served. */
+};
+
+/*! \struct mem_alloc_t
+    \brief Allocator state. Per-block metadata is indexed by offset >> min_shift.
+*/
+struct mem_alloc_t {
+  uint64_t size;               /*!< size Size of the offset range, a multiple of the block size. */
+  uint32_t min_shift;          /*!< min_shift log2 of the minimum block size. */
+  uint32_t max_order;          /*!< max_order Largest buddy order that fits in the range. */
+  uint32_t num_blocks;         /*!< num_blocks Number of minimum blocks. */
+  uint8_t* state;              /*!< state State of each block: free head, allocated head, slab or tail. */
+  uint8_t* order;              /*!< order Buddy order of a head block, or size class of a slab. */
+  uint32_t* next;              /*!< next Next block in a free list or partial slab list. */
+  uint32_t* prev;              /*!< prev Previous block in a free list or partial slab list. */
+  uint64_t* slab_free;         /*!< slab_free Free object bitmap of each slab. */
+  uint32_t free_head[MEM_ALLOC_MAX_ORDER + 1];      /*!< free_head Free list of each buddy order. */
+  uint32_t partial_head[MEM_ALLOC_NUM_CLASSES];     /*!< partial_head Slabs with free objects of each size class. */
+  struct mem_alloc_stats_t stats; /*!< stats Usage statistics. */
+};
+
+/** @brief Create an allocator for the offset range [0, size).
+ *  @param size Number of bytes to manage. It is rounded down to the block size.
+ *  @param min_shift log2 of the minimum block size, and the alignment of every
+ *                   allocation of at least one block.
+ *  @return A pointer to the allocator, or NULL on failure.
+ */
+struct mem_alloc_t* mem_alloc_create(uint64_t size, uint32_t min_shift);
+
+/** @brief Create an allocator for the offset range [0, size) with no free memory.
+ *
+ *  Parts of the range are made available with mem_alloc_add_range(), e.g. as a 
+ *  memory pool grows.
+ *  @param size Size of the offset range. It is rounded down to the block size.
+ *  @param min_shift log2 of the minimum block size.
+ *  @return A pointer to the allocator, or NULL on failure.
+ */
+struct mem_alloc_t* mem_alloc_create_reserved(uint64_t size, uint32_t min_shift);
+
+/** @brief Make a range of offsets available for allocation.
+ *  @param alloc A pointer to the allocator.
+ *  @param offset Start of the range, a multiple of the block size.
+ *  @param size Size of the range, a multiple of the block size.
+ *  @return Success (0) or Failure (-1).
+ */
+int mem_alloc_add_range(struct mem_alloc_t* alloc, uint64_t offset, uint64_t size);
+
+/** @brief Destroy an allocator.
+ *  @param alloc A pointer to the allocator.
+ *  @return void.
+ */
+void mem_alloc_destroy(struct mem_alloc_t* alloc);
+
+/** @brief Allocate a range.
+ *
+ *  Requests smaller than half a block are served from slabs. Larger requests
+ *  are rounded up to a power-of-two number of blocks.
+ *  @param alloc A pointer to the allocator.
+ *  @param size Number of bytes requested.
+ *  @param alloc_size Returns the usable size of the range. Can be NULL.
+ *  @return Offset of the range, or MEM_ALLOC_FAILED.
+ */
+uint64_t mem_alloc_alloc(struct mem_alloc_t* alloc, uint64_t size, uint64_t* alloc_size);
+
+/** @brief Free a range returned by mem_alloc_alloc().
+ *  @param alloc A pointer to the allocator.
+ *  @param offset Offset of the range.
+ *  @return Success (0) or Failure (-1) if offset is not an allocated range.
+ */
+int mem_alloc_free(struct mem_alloc_t* alloc, uint64_t offset);
+
+/** @brief Get the usable size of an allocated range.
+ *  @param alloc A pointer to the allocator.
+ *  @param offset Offset of the range.
+ *  @return Usable size in bytes, or 0 if offset is not an allocated range.
+ */
+uint64_t mem_alloc_usable_size(struct mem_alloc_t* alloc, uint64_t offset);
+
+/** @brief Get usage statistics.
+ *  @param alloc A pointer to the allocator.
+ *  @param stats Returns the statistics.
+ *  @return void.
+ */
+void mem_alloc_get_stats(struct mem_alloc_t* alloc, struct mem_alloc_stats_t* stats);
+
+/** @brief Print usage and fragmentation statistics to stderr.
+ *  @param alloc A pointer to the allocator.
+ *  @param name Name printed with the statistics.
+ *  @return void.
+ */
+void mem_alloc_dump_stats(struct mem_alloc_t* alloc, const char* name);
+
+#endif /* __MEM_ALLOC_H__ */
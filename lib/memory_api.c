@@ -29,24 +29,8 @@ ssize_t read_to_buffer(char *char_device, int fd, char *buffer, uint64_t size,
 		if (bytes > RW_MAX_SIZE)
 			bytes = RW_MAX_SIZE;
 
-    rc = lseek(fd, offset, SEEK_SET);
-    if (rc < 0) {
-      fprintf(stderr,
-        "%s, seek off 0x%lx failed %zd.\n",
-        char_device, offset, rc);
-      perror("seek file");
-      return -EIO;
-    }
-    if (rc != offset) {
-      fprintf(stderr,
-        "%s, seek off 0x%lx != 0x%lx.\n",
-        char_device, rc, offset);
-      return -EIO;
-    }
-		
-
-		/* read data from file into memory buffer */
-		rc = read(fd, buf, bytes);
+		/* read data from file into memory buffer, seek and read in one syscall */
+		rc = pread(fd, buf, bytes, offset);
 		if (rc < 0) {
 			fprintf(stderr,
 				"%s, read off 0x%lx + 0x%lx failed %zd.\n",
@@ -88,23 +72,8 @@ ssize_t write_from_buffer(char *char_device, int fd, char *buffer, uint64_t size
 		if (bytes > RW_MAX_SIZE)
 			bytes = RW_MAX_SIZE;
 
-    rc = lseek(fd, offset, SEEK_SET);
-    if (rc < 0) {
-      fprintf(stderr,
-        "%s, seek off 0x%lx failed %zd.\n",
-        char_device, offset, rc);
-      perror("seek file");
-      return -EIO;
-    }
-    if (rc != offset) {
-      fprintf(stderr,
-        "%s, seek off 0x%lx != 0x%lx.\n",
-        char_device, rc, offset);
-      return -EIO;
-    }
-
-		/* write data to file from memory buffer */
-		rc = write(fd, buf, bytes);
+		/* write data to file from memory buffer, seek and write in one syscall */
+		rc = pwrite(fd, buf, bytes, offset);
 		if (rc < 0) {
 			fprintf(stderr, "%s, W off 0x%lx, 0x%lx failed %zd.\n",
 				char_device, offset, bytes, rc);
@@ -9,24 +9,32 @@
  */
 
 #include "rdma_api.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 struct rdma_dev_t* create_rdma_dev(struct rn_dev_t* rn_dev) {
-    int i;
     uint32_t num_qp;
     struct rdma_dev_t* rdma_dev = NULL;
     num_qp = rn_dev->num_qp;
 
     rdma_dev = (struct rdma_dev_t*) malloc(sizeof(struct rdma_dev_t));
     rdma_dev->glb_csr = (struct rdma_glb_csr_t*) malloc(sizeof(struct rdma_glb_csr_t));
-    rdma_dev->qps_ptr = (struct rdma_qp_t**) malloc(num_qp * (sizeof(struct rdma_qp_t*)));
+    // QP IDs run from 1 to num_qp, chunks are allocated by rdma_set_qp()
+    rdma_dev->num_qp_chunks = (num_qp >> RDMA_QP_TABLE_CHUNK_SHIFT) + 1;
+    rdma_dev->qp_table = (struct rdma_qp_t***) calloc(rdma_dev->num_qp_chunks, sizeof(struct rdma_qp_t**));
+    rdma_dev->num_qp_allocated = 0;
     rdma_dev->axil_ctl = rn_dev->axil_ctl;
-
-    for(i=0; i<num_qp; i++) {
-        rdma_dev->qps_ptr[i] = NULL;
+    if(rdma_dev->qp_table == NULL) {
+        fprintf(stderr, "Error: failed to allocate QP table\n");
+        exit(EXIT_FAILURE);
     }
+
     rdma_dev->winSize = rn_dev->winSize;
     rdma_dev->rn_dev = rn_dev;
     rdma_dev->num_qp = rn_dev->num_qp;
+    poll_policy_init(&rdma_dev->poll_policy, POLL_BUSY_SPIN, 0, POLL_BACKOFF_MIN_NS, 0);
+    rdma_dev->mr_cache = NULL;
     rn_dev->rdma_dev = (void* ) rdma_dev;
 
     return rdma_dev;
@@ -122,6 +130,109 @@ void open_rdma_dev(struct rdma_dev_t* rdma_dev, struct mac_addr_t local_mac,
   fprintf(stderr, "Info: rdma_dev opened\n");
 }
 
+/* Clamp a number of entries to [min_entries, RDMA_GLB_MAX_ENTRIES] */
+static uint16_t clamp_glb_entries(uint64_t entries, uint64_t min_entries) {
+  if(entries < min_entries) {
+    entries = min_entries;
+  }
+  if(entries > RDMA_GLB_MAX_ENTRIES) {
+    entries = RDMA_GLB_MAX_ENTRIES;
+  }
+  return (uint16_t) entries;
+}
+
+int get_rdma_glb_buf_sizes(uint32_t num_qp, uint32_t outstanding_ops, uint32_t mtu, struct rdma_glb_buf_t* glb_buf) {
+  uint64_t num_ops = (uint64_t) num_qp * outstanding_ops;
+
+  if((num_qp == 0) || (outstanding_ops == 0)) {
+    fprintf(stderr, "Error: invalid ERNIC global buffers for %d QPs with %d outstanding packets\n", num_qp, outstanding_ops);
+    return -1;
+  }
+  if((mtu < 256) || (mtu > 4096) || ((mtu & (mtu - 1)) != 0)) {
+    fprintf(stderr, "Error: unsupported MTU %d\n", mtu);
+    return -1;
+  }
+
+  glb_buf->num_qp                = num_qp;
+  glb_buf->outstanding_ops       = outstanding_ops;
+  glb_buf->mtu                   = mtu;
+  glb_buf->num_data_buf          = clamp_glb_entries(num_ops, RDMA_GLB_MIN_DATA_BUF);
+  glb_buf->per_data_buf_size     = (uint16_t) mtu;
+  glb_buf->ipkt_err_stat_q_size  = clamp_glb_entries(num_ops, (1 << HARDWARE_PAGE_SHIFT) / RDMA_IPKT_ERR_STAT_ENTRY_SIZE);
+  glb_buf->num_err_buf           = clamp_glb_entries((uint64_t) num_qp * RDMA_ERR_BUF_PER_QP, (1 << HARDWARE_PAGE_SHIFT) / RDMA_ERR_BUF_ENTRY_SIZE);
+  glb_buf->per_err_buf_size      = RDMA_ERR_BUF_ENTRY_SIZE;
+  glb_buf->resp_err_pkt_buf_size = num_ops * RDMA_RESP_ERR_PKT_ENTRY_SIZE;
+  if(glb_buf->resp_err_pkt_buf_size < (1 << HARDWARE_PAGE_SHIFT)) {
+    glb_buf->resp_err_pkt_buf_size = 1 << HARDWARE_PAGE_SHIFT;
+  }
+  glb_buf->data_buf         = NULL;
+  glb_buf->ipkterr_buf      = NULL;
+  glb_buf->err_buf          = NULL;
+  glb_buf->resp_err_pkt_buf = NULL;
+
+  return 0;
+}
+
+struct rdma_glb_buf_t* allocate_rdma_glb_buf(struct rdma_dev_t* rdma_dev, uint32_t outstanding_ops, 
+                                             uint32_t mtu, char* buf_location) {
+  struct rdma_glb_buf_t* glb_buf = (struct rdma_glb_buf_t* ) malloc(sizeof(struct rdma_glb_buf_t));
+
+  if(glb_buf == NULL) {
+    fprintf(stderr, "Error: failed to allocate rdma_glb_buf_t\n");
+    return NULL;
+  }
+  if(outstanding_ops == 0) {
+    outstanding_ops = RDMA_GLB_OUTSTANDING_OPS;
+  }
+  if(get_rdma_glb_buf_sizes(rdma_dev->num_qp, outstanding_ops, mtu, glb_buf) != 0) {
+    free(glb_buf);
+    return NULL;
+  }
+
+  glb_buf->data_buf         = allocate_rdma_buffer(rdma_dev->rn_dev, (uint64_t) glb_buf->num_data_buf * glb_buf->per_data_buf_size, buf_location);
+  glb_buf->ipkterr_buf      = allocate_rdma_buffer(rdma_dev->rn_dev, (uint64_t) glb_buf->ipkt_err_stat_q_size * RDMA_IPKT_ERR_STAT_ENTRY_SIZE, buf_location);
+  glb_buf->err_buf          = allocate_rdma_buffer(rdma_dev->rn_dev, (uint64_t) glb_buf->num_err_buf * glb_buf->per_err_buf_size, buf_location);
+  glb_buf->resp_err_pkt_buf = allocate_rdma_buffer(rdma_dev->rn_dev, glb_buf->resp_err_pkt_buf_size, buf_location);
+
+  return glb_buf;
+}
+
+void open_rdma_dev_glb_buf(struct rdma_dev_t* rdma_dev, struct mac_addr_t local_mac, uint32_t local_ip, 
+                           uint32_t udp_sport, struct rdma_glb_buf_t* glb_buf) {
+  open_rdma_dev(rdma_dev, local_mac, local_ip, udp_sport, glb_buf->num_data_buf, glb_buf->per_data_buf_size,
+                glb_buf->data_buf->dma_addr, glb_buf->ipkt_err_stat_q_size, glb_buf->ipkterr_buf->dma_addr,
+                glb_buf->num_err_buf, glb_buf->per_err_buf_size, glb_buf->err_buf->dma_addr,
+                glb_buf->resp_err_pkt_buf_size, glb_buf->resp_err_pkt_buf->dma_addr);
+}
+
+uint64_t dump_rdma_glb_buf_footprint(struct rdma_glb_buf_t* glb_buf) {
+  uint64_t data_size   = (uint64_t) glb_buf->num_data_buf * glb_buf->per_data_buf_size;
+  uint64_t ipkterr_size = (uint64_t) glb_buf->ipkt_err_stat_q_size * RDMA_IPKT_ERR_STAT_ENTRY_SIZE;
+  uint64_t err_size    = (uint64_t) glb_buf->num_err_buf * glb_buf->per_err_buf_size;
+  uint64_t total       = data_size + ipkterr_size + err_size + glb_buf->resp_err_pkt_buf_size;
+  const char* location = ((glb_buf->data_buf != NULL) && is_device_address(glb_buf->data_buf->dma_addr)) ? "device" : "host";
+
+  fprintf(stderr, "Info: ERNIC global buffers for %d QPs x %d outstanding packets, MTU %d, in %s memory:\n",
+          glb_buf->num_qp, glb_buf->outstanding_ops, glb_buf->mtu, location);
+  fprintf(stderr, "Info:   data buffer            : %d x %d bytes = %ld bytes\n", glb_buf->num_data_buf, glb_buf->per_data_buf_size, data_size);
+  fprintf(stderr, "Info:   IPKTERR queue          : %d x %d bytes = %ld bytes\n", glb_buf->ipkt_err_stat_q_size, RDMA_IPKT_ERR_STAT_ENTRY_SIZE, ipkterr_size);
+  fprintf(stderr, "Info:   error buffer           : %d x %d bytes = %ld bytes\n", glb_buf->num_err_buf, glb_buf->per_err_buf_size, err_size);
+  fprintf(stderr, "Info:   response error buffer  : %ld bytes\n", glb_buf->resp_err_pkt_buf_size);
+  fprintf(stderr, "Info:   total                  : %ld bytes\n", total);
+
+  return total;
+}
+
+void free_rdma_glb_buf(struct rdma_dev_t* rdma_dev, struct rdma_glb_buf_t* glb_buf) {
+  if(glb_buf != NULL) {
+    free_rdma_buffer(rdma_dev->rn_dev, glb_buf->data_buf);
+    free_rdma_buffer(rdma_dev->rn_dev, glb_buf->ipkterr_buf);
+    free_rdma_buffer(rdma_dev->rn_dev, glb_buf->err_buf);
+    free_rdma_buffer(rdma_dev->rn_dev, glb_buf->resp_err_pkt_buf);
+    free(glb_buf);
+  }
+}
+
 void config_rdma_global_csr (struct rdma_dev_t* rdma_dev) {
   uint32_t data_buf_baseaddr_lsb;
   uint32_t data_buf_baseaddr_msb;
@@ -239,6 +350,49 @@ uint32_t get_rdma_per_q_config_addr(uint32_t offset, uint32_t qpid) {
   return offset + 0x100 * (qpid-1);
 }
 
+/* Polling policy of a queue pair, falling back to the device policy */
+static struct poll_policy_t* rdma_qp_poll_policy(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp) {
+  if((qp != NULL) && (qp->poll_policy != NULL)) {
+    return qp->poll_policy;
+  }
+  return &rdma_dev->poll_policy;
+}
+
+struct rdma_qp_t* rdma_get_qp(struct rdma_dev_t* rdma_dev, uint32_t qpid) {
+  struct rdma_qp_t** chunk;
+
+  if(qpid > rdma_dev->num_qp) {
+    return NULL;
+  }
+  chunk = rdma_dev->qp_table[qpid >> RDMA_QP_TABLE_CHUNK_SHIFT];
+  if(chunk == NULL) {
+    return NULL;
+  }
+  return chunk[qpid & ((1 << RDMA_QP_TABLE_CHUNK_SHIFT) - 1)];
+}
+
+/* Store a queue pair in the QP table, allocating its chunk on first use */
+static int rdma_set_qp(struct rdma_dev_t* rdma_dev, uint32_t qpid, struct rdma_qp_t* qp) {
+  struct rdma_qp_t*** chunk = &rdma_dev->qp_table[qpid >> RDMA_QP_TABLE_CHUNK_SHIFT];
+  uint32_t idx = qpid & ((1 << RDMA_QP_TABLE_CHUNK_SHIFT) - 1);
+
+  if(*chunk == NULL) {
+    *chunk = (struct rdma_qp_t** ) calloc(1 << RDMA_QP_TABLE_CHUNK_SHIFT, sizeof(struct rdma_qp_t* ));
+    if(*chunk == NULL) {
+      fprintf(stderr, "Error: failed to allocate QP table chunk\n");
+      return -1;
+    }
+  }
+  if((*chunk)[idx] == NULL) {
+    rdma_dev->num_qp_allocated += (qp != NULL) ? 1 : 0;
+  } else if(qp == NULL) {
+    rdma_dev->num_qp_allocated--;
+  }
+  (*chunk)[idx] = qp;
+
+  return 0;
+}
+
 uint32_t get_rdma_pd_config_addr(uint32_t offset, uint32_t pd_num) {
   return offset + 0x100 * pd_num;
 }
@@ -263,7 +417,8 @@ struct rdma_pd_t* allocate_rdma_pd(struct rdma_dev_t* rdma_dev, uint32_t pd_num)
   return rdma_pd;
 }
 
-void rdma_register_memory_region(struct rdma_dev_t* rdma_dev, struct rdma_pd_t* rdma_pd, uint32_t r_key, struct rdma_buff_t* rdma_buf) {
+/* Write the PD table entry of a protection domain whose mr_buffer and r_key are set */
+static void rdma_write_pdt_entry(struct rdma_dev_t* rdma_dev, struct rdma_pd_t* rdma_pd) {
   uint32_t pd_num;
   uint64_t buffer_size;
   uint32_t access_config;
@@ -271,24 +426,7 @@ void rdma_register_memory_region(struct rdma_dev_t* rdma_dev, struct rdma_pd_t*
   uint32_t win_size_low  = rdma_dev->winSize->win_size_lsb;
   uint32_t win_size_high = rdma_dev->winSize->win_size_msb;
 
-  fprintf(stderr, "Info: rdma_register_memory_region - registering memory region\n");
-  if(rdma_dev == NULL) {
-    fprintf(stderr, "Error: rdma_dev is NULL\n");
-    exit(EXIT_FAILURE);    
-  }
-
-  if(rdma_pd == NULL) {
-    fprintf(stderr, "Error: rdma_pd is NULL\n");
-    exit(EXIT_FAILURE);
-  }
-
-  if(rdma_buf == NULL) {
-    fprintf(stderr, "Error: rdma_buf is NULL\n");
-    exit(EXIT_FAILURE);
-  }
-
-  rdma_pd->mr_buffer = rdma_buf;
-  if(is_device_address(rdma_buf->dma_addr)) {
+  if(is_device_address(rdma_pd->mr_buffer->dma_addr)) {
     // Buffer in device memory
     rdma_pd->dma_addr_lsb = (uint32_t) (rdma_pd->mr_buffer->dma_addr & 0x00000000ffffffff);
     rdma_pd->dma_addr_msb = (uint32_t) ((rdma_pd->mr_buffer->dma_addr >> 32) & 0x00000000ffffffff);
@@ -305,12 +443,6 @@ void rdma_register_memory_region(struct rdma_dev_t* rdma_dev, struct rdma_pd_t*
   rdma_pd->virtual_addr_msb = (uint32_t)((((uint64_t) rdma_pd->mr_buffer->buffer)>>32) & 0x00000000ffffffff);
   rdma_pd->buffer_size_lsb = (uint32_t) (buffer_size & 0x00000000ffffffff);
   rdma_pd->buffer_size_msb = (uint32_t) ((buffer_size>>32) & 0x00000000ffffffff);
-  rdma_pd->r_key = r_key;
-
-  if(rdma_dev->axil_ctl == 0) {
-    fprintf(stderr, "Error: rdma_dev->axil_ctl=0x%lx is not valid!\n", (uint64_t) rdma_dev->axil_ctl);
-    exit(EXIT_FAILURE);
-  }
 
   write32_data(rdma_dev->axil_ctl, get_rdma_pd_config_addr(RN_RDMA_PDT_VIRTADDRLSB, pd_num), rdma_pd->virtual_addr_lsb);
   Debug("[Register] RN_RDMA_PDT_VIRTADDRLSB=0x%x, pd_num=%d, value=0x%x\n", get_rdma_pd_config_addr(RN_RDMA_PDT_VIRTADDRLSB, pd_num), pd_num, rdma_pd->virtual_addr_lsb);
@@ -320,184 +452,875 @@ void rdma_register_memory_region(struct rdma_dev_t* rdma_dev, struct rdma_pd_t*
   Debug("[Register] RN_RDMA_PDT_BUFBASEADDRLSB=0x%x, pd_num=%d, value=0x%x\n", get_rdma_pd_config_addr(RN_RDMA_PDT_BUFBASEADDRLSB, pd_num), pd_num, rdma_pd->dma_addr_lsb);
   write32_data(rdma_dev->axil_ctl, get_rdma_pd_config_addr(RN_RDMA_PDT_BUFBASEADDRMSB, pd_num), rdma_pd->dma_addr_msb);
   Debug("[Register] RN_RDMA_PDT_BUFBASEADDRMSB=0x%x, pd_num=%d, value=0x%x\n", get_rdma_pd_config_addr(RN_RDMA_PDT_BUFBASEADDRMSB, pd_num), pd_num, rdma_pd->dma_addr_msb);
-  write32_data(rdma_dev->axil_ctl, get_rdma_pd_config_addr(RN_RDMA_PDT_BUFRKEY, pd_num), r_key);
-  Debug("[Register] RN_RDMA_PDT_BUFRKEY=0x%x, pd_num=%d, value=0x%x\n", get_rdma_pd_config_addr(RN_RDMA_PDT_BUFRKEY, pd_num), pd_num, r_key);
+  write32_data(rdma_dev->axil_ctl, get_rdma_pd_config_addr(RN_RDMA_PDT_BUFRKEY, pd_num), rdma_pd->r_key);
+  Debug("[Register] RN_RDMA_PDT_BUFRKEY=0x%x, pd_num=%d, value=0x%x\n", get_rdma_pd_config_addr(RN_RDMA_PDT_BUFRKEY, pd_num), pd_num, rdma_pd->r_key);
 
   write32_data(rdma_dev->axil_ctl, get_rdma_pd_config_addr(RN_RDMA_PDT_WRRDBUFLEN, pd_num), buffer_size);
   Debug("[Register] RN_RDMA_PDT_WRRDBUFLEN=0x%x, pd_num=%d, value=0x%lx B\n", get_rdma_pd_config_addr(RN_RDMA_PDT_WRRDBUFLEN, pd_num), pd_num, buffer_size);
   access_config = ((rdma_pd->buffer_size_msb<<16) | rdma_pd->pd_access_type);
   write32_data(rdma_dev->axil_ctl, get_rdma_pd_config_addr(RN_RDMA_PDT_ACCESSDESC, pd_num), access_config);
   Debug("[Register] RN_RDMA_PDT_ACCESSDESC=0x%x, pd_num=%d, value=0x%x\n", get_rdma_pd_config_addr(RN_RDMA_PDT_ACCESSDESC, pd_num), pd_num, access_config);
+}
 
-  fprintf(stderr, "Info: memory region for the %d-th PD is registered\n", pd_num);
+/* Order of the address index: start address, then slot address for equal starts */
+static int rdma_mr_cmp_key(const struct rdma_mr_t* a, const struct rdma_mr_t* b) {
+  if(a->vaddr != b->vaddr) {
+    return (a->vaddr > b->vaddr) ? 1 : -1;
+  }
+  return (a > b) - (a < b);
 }
 
-struct rdma_buff_t* allocate_hugepages_buffer(uint32_t num_hugepages) {
-  struct rdma_buff_t* rdma_buffer;
-  rdma_buffer = (struct rdma_buff_t*) malloc(sizeof(struct rdma_buff_t));
+static uint32_t rdma_mr_height(const struct rdma_mr_t* mr) {
+  return (mr == NULL) ? 0 : mr->height;
+}
 
-  if(rdma_buffer == NULL) {
-    fprintf(stderr, "Error: failed to create rdma_buffer\n");
-    exit(EXIT_FAILURE);
+/* Recompute the height and the largest end address of a subtree from its children */
+static void rdma_mr_node_update(struct rdma_mr_t* mr) {
+  uint32_t left_height  = rdma_mr_height(mr->left);
+  uint32_t right_height = rdma_mr_height(mr->right);
+
+  mr->height  = 1 + ((left_height > right_height) ? left_height : right_height);
+  mr->max_end = mr->vaddr + mr->length;
+  if((mr->left != NULL) && (mr->left->max_end > mr->max_end)) {
+    mr->max_end = mr->left->max_end;
   }
+  if((mr->right != NULL) && (mr->right->max_end > mr->max_end)) {
+    mr->max_end = mr->right->max_end;
+  }
+}
 
-  rdma_buffer->buffer = mmap(NULL, num_hugepages * (1 << HUGE_PAGE_SHIFT),
-                             PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | 
-                             MAP_HUGETLB, -1, 0);
+static struct rdma_mr_t* rdma_mr_rotate_right(struct rdma_mr_t* mr) {
+  struct rdma_mr_t* top = mr->left;
 
-  if(rdma_buffer->buffer == NULL) {
-    fprintf(stderr, "Error: failed to allocate hugepage memory\n");
-    exit(EXIT_FAILURE);
+  mr->left = top->right;
+  top->right = mr;
+  rdma_mr_node_update(mr);
+  rdma_mr_node_update(top);
+  return top;
+}
+
+static struct rdma_mr_t* rdma_mr_rotate_left(struct rdma_mr_t* mr) {
+  struct rdma_mr_t* top = mr->right;
+
+  mr->right = top->left;
+  top->left = mr;
+  rdma_mr_node_update(mr);
+  rdma_mr_node_update(top);
+  return top;
+}
+
+/* Restore the AVL balance of a subtree whose children differ in height by at most 2 */
+static struct rdma_mr_t* rdma_mr_rebalance(struct rdma_mr_t* mr) {
+  rdma_mr_node_update(mr);
+  if(rdma_mr_height(mr->left) > rdma_mr_height(mr->right) + 1) {
+    if(rdma_mr_height(mr->left->left) < rdma_mr_height(mr->left->right)) {
+      mr->left = rdma_mr_rotate_left(mr->left);
+    }
+    return rdma_mr_rotate_right(mr);
+  }
+  if(rdma_mr_height(mr->right) > rdma_mr_height(mr->left) + 1) {
+    if(rdma_mr_height(mr->right->right) < rdma_mr_height(mr->right->left)) {
+      mr->right = rdma_mr_rotate_right(mr->right);
+    }
+    return rdma_mr_rotate_left(mr);
   }
+  return mr;
+}
 
-  // Lock the buffer in physical memory
-  if(mlock(rdma_buffer->buffer, num_hugepages * (1 << HUGE_PAGE_SHIFT)) == -1) {
-    fprintf(stderr, "Error: failed to lock %d page in memory\n", num_hugepages);
-    exit(EXIT_FAILURE);
+static struct rdma_mr_t* rdma_mr_tree_insert(struct rdma_mr_t* root, struct rdma_mr_t* mr) {
+  if(root == NULL) {
+    mr->left  = NULL;
+    mr->right = NULL;
+    rdma_mr_node_update(mr);
+    return mr;
+  }
+  if(rdma_mr_cmp_key(mr, root) < 0) {
+    root->left = rdma_mr_tree_insert(root->left, mr);
+  } else {
+    root->right = rdma_mr_tree_insert(root->right, mr);
   }
+  return rdma_mr_rebalance(root);
+}
 
-  rdma_buffer->dma_addr = get_buffer_paddr(rdma_buffer->buffer);
+/* Unlink the first region of a subtree, returned in min */
+static struct rdma_mr_t* rdma_mr_tree_remove_min(struct rdma_mr_t* root, struct rdma_mr_t** min) {
+  if(root->left == NULL) {
+    *min = root;
+    return root->right;
+  }
+  root->left = rdma_mr_tree_remove_min(root->left, min);
+  return rdma_mr_rebalance(root);
+}
 
-  return rdma_buffer;
+static struct rdma_mr_t* rdma_mr_tree_remove(struct rdma_mr_t* root, struct rdma_mr_t* mr) {
+  struct rdma_mr_t* min;
+  int cmp;
+
+  if(root == NULL) {
+    return NULL;
+  }
+  cmp = rdma_mr_cmp_key(mr, root);
+  if(cmp < 0) {
+    root->left = rdma_mr_tree_remove(root->left, mr);
+  } else if(cmp > 0) {
+    root->right = rdma_mr_tree_remove(root->right, mr);
+  } else {
+    if(root->right == NULL) {
+      return root->left;
+    }
+    root->right = rdma_mr_tree_remove_min(root->right, &min);
+    min->left  = root->left;
+    min->right = root->right;
+    root = min;
+  }
+  return rdma_mr_rebalance(root);
 }
 
-void config_last_rq_psn(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint32_t last_rq_psn)
-{              
-  uint32_t rq_opcode = 0x0000000a; // Just a random op-code to avoid opcode sequence error
-  uint32_t rq_conf = ((rq_opcode<<24) & 0xff000000) | (last_rq_psn & 0x00ffffff);
+/* Find a registered MR covering [vaddr, vaddr + length) */
+static struct rdma_mr_t* rdma_mr_cache_find(struct rdma_mr_cache_t* cache, uint64_t vaddr, uint64_t length) {
+  struct rdma_mr_t* mr = cache->root;
+  uint64_t end = vaddr + length;
+
+  // Find a region starting at or before vaddr and ending at or after end
+  while(mr != NULL) {
+    if(mr->vaddr > vaddr) {
+      mr = mr->left;
+    } else if((mr->left != NULL) && (mr->left->max_end >= end)) {
+      // Every region of the left subtree starts at or before vaddr, one of them reaches end
+      mr = mr->left;
+      while(mr->vaddr + mr->length < end) {
+        mr = ((mr->left != NULL) && (mr->left->max_end >= end)) ? mr->left : mr->right;
+      }
+      return mr;
+    } else if(mr->vaddr + mr->length >= end) {
+      return mr;
+    } else {
+      mr = mr->right;
+    }
+  }
+  return NULL;
+}
 
-  write32_data(rdma_dev->axil_ctl, 
-              get_rdma_per_q_config_addr(RN_RDMA_QCSR_LSTRQREQi, qpid), 
-              rq_conf);
-  fprintf(stderr, "[Register] RN_RDMA_QCSR_LSTRQREQi=0x%x, qpid=%d, value=0x%x\n", 
-                    get_rdma_per_q_config_addr(RN_RDMA_QCSR_LSTRQREQi, qpid), 
-                    qpid, 
-                    rq_conf);
-  rdma_dev->qps_ptr[qpid]->last_rq_psn = last_rq_psn;
+/* Find a registered MR overlapping [start, end) */
+static struct rdma_mr_t* rdma_mr_cache_find_overlap(struct rdma_mr_cache_t* cache, uint64_t start, uint64_t end) {
+  struct rdma_mr_t* mr = cache->root;
+
+  // If the left subtree reaches past start but has no overlap, neither has the right one
+  while(mr != NULL) {
+    if((mr->vaddr < end) && (mr->vaddr + mr->length > start)) {
+      return mr;
+    }
+    mr = ((mr->left != NULL) && (mr->left->max_end > start)) ? mr->left : mr->right;
+  }
+  return NULL;
 }
 
-void config_sq_psn(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint32_t sq_psn){
-  write32_data(rdma_dev->axil_ctl, 
-              get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPSNi, qpid), 
-              sq_psn);
-  fprintf(stderr, "[Register] RN_RDMA_QCSR_SQPSNi=0x%x, qpid=%d, value=0x%x\n", 
-                  get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPSNi, qpid), 
-                  qpid, 
-                  sq_psn);
-  rdma_dev->qps_ptr[qpid]->sq_psn = sq_psn;
+static void rdma_mr_cache_insert(struct rdma_mr_cache_t* cache, struct rdma_mr_t* mr) {
+  cache->root = rdma_mr_tree_insert(cache->root, mr);
+  mr->indexed = 1;
+  cache->num_mr++;
 }
 
-struct rdma_qp_t* allocate_rdma_qp(struct rdma_dev_t* rdma_dev,
-                                   uint32_t qpid,
-                                   uint32_t dst_qpid,
-                                   struct rdma_pd_t* pd_entry,
-                                   uint64_t cq_cidb_addr,
-                                   uint64_t rq_cidb_addr,
-                                   uint32_t qdepth,
-                                   char*    buf_location,
-                                   struct mac_addr_t* dst_mac,
-                                   uint32_t dst_ip,
-                                   uint32_t partion_key,
-                                   uint32_t r_key) {
-  uint32_t sq_addr_lsb;
-  uint32_t sq_addr_msb;
-  uint32_t cq_addr_lsb;
-  uint32_t cq_addr_msb;
-  uint32_t rq_addr_lsb;
-  uint32_t rq_addr_msb;
-  uint32_t cq_cidb_addr_lsb;
-  uint32_t cq_cidb_addr_msb;
-  uint32_t rq_cidb_addr_lsb;
-  uint32_t rq_cidb_addr_msb;
-  struct rdma_qp_t* qp;
-  uint32_t mtu_config;
-  uint32_t en_qp;
-  //uint32_t ip_proto;
-  uint32_t qp_config;
-  uint32_t traffic_class;
-  uint32_t time_to_live;
-  uint32_t qp_adv_conf;
-  uint32_t rq_buffer_entry_size;
-  uint32_t cq_size;
-  uint32_t rq_size;
-  uint32_t sq_size;
-  uint32_t win_size_low  = rdma_dev->winSize->win_size_lsb;
-  uint32_t win_size_high = rdma_dev->winSize->win_size_msb;
+static void rdma_mr_cache_remove(struct rdma_mr_cache_t* cache, struct rdma_mr_t* mr) {
+  if(!mr->indexed) {
+    return;
+  }
+  cache->root = rdma_mr_tree_remove(cache->root, mr);
+  mr->indexed = 0;
+  cache->num_mr--;
+}
 
-  qp = (struct rdma_qp_t* ) malloc(sizeof(struct rdma_qp_t));
-  qp->rdma_dev = rdma_dev;
-  qp->qpid = qpid;
-  qp->dst_qpid = dst_qpid;
-  fprintf(stderr, "Allocating qp->sq\n");
-  // Each WQE has 64 bytes
-  sq_size = rdma_dev->num_qp * qdepth * 64;
-  cq_size = rdma_dev->num_qp * qdepth * 4;
-  rq_size = rdma_dev->num_qp * qdepth * RQE_SIZE;
-
-  Debug("sq_size = %d, cq_size = %d, rq_size %d, buf_location = %s\n", sq_size, cq_size, rq_size, buf_location);
-  qp->sq = allocate_rdma_buffer(rdma_dev->rn_dev, (uint64_t) sq_size, buf_location);
-  qp->sq_pidb = 0;
-  qp->sq_cidb = 0;
+/* Get the slot of a PD allocated by the PD/MR manager, or NULL for other PDs */
+static struct rdma_mr_t* rdma_mr_of_pd(struct rdma_mr_cache_t* cache, struct rdma_pd_t* rdma_pd) {
+  struct rdma_mr_t* mr = (struct rdma_mr_t* ) rdma_pd;
 
-  fprintf(stderr, "Allocating qp->cq\n");
-  // Each CQE has 4 bytes
-  qp->cq = allocate_rdma_buffer(rdma_dev->rn_dev, (uint64_t) cq_size, buf_location);
-  qp->cq_cidb = 0;
+  if((mr < cache->slots) || (mr >= cache->slots + cache->num_pd) || !mr->in_use) {
+    return NULL;
+  }
+  return mr;
+}
 
-  if(is_device_address(cq_cidb_addr)) {
-    // Device memory address
-    cq_cidb_addr_lsb = ((uint32_t) ((cq_cidb_addr) & 0x00000000ffffffff));
-    cq_cidb_addr_msb = ((uint32_t) ((cq_cidb_addr >> 32) & 0x00000000ffffffff));
-  } else {
-    // Host memory address
-    cq_cidb_addr_lsb = ((uint32_t) ((cq_cidb_addr) & 0x00000000ffffffff)) & win_size_low;
-    cq_cidb_addr_msb = ((uint32_t) ((cq_cidb_addr >> 32) & 0x00000000ffffffff)) & win_size_high;
+/* Remove a caller-supplied r_key from the r_key free list, return 1 if it was free */
+static uint8_t rdma_mr_reserve_r_key(struct rdma_mr_cache_t* cache, uint32_t r_key) {
+  uint32_t i;
+
+  for(i=0; i<cache->num_r_key_free; i++) {
+    if(cache->r_key_free[i] == r_key) {
+      // Keep the order of the stack, the lowest free r_key stays on top
+      memmove(&cache->r_key_free[i], &cache->r_key_free[i+1], (cache->num_r_key_free - i - 1) * sizeof(uint32_t));
+      cache->num_r_key_free--;
+      return 1;
+    }
   }
+  Debug("DEBUG: r_key 0x%x is not in the r_key free list\n", r_key);
+  return 0;
+}
 
-  qp->cq_cidb_addr = cq_cidb_addr;
-  fprintf(stderr, "Allocating qp->rq\n");
+void rdma_register_memory_region(struct rdma_dev_t* rdma_dev, struct rdma_pd_t* rdma_pd, uint32_t r_key, struct rdma_buff_t* rdma_buf) {
+  struct rdma_mr_cache_t* cache;
+  struct rdma_mr_t* mr = NULL;
+  uint8_t r_key_owned = 0;
 
-  // Each RQE is 256B
-  qp->rq = allocate_rdma_buffer(rdma_dev->rn_dev, (uint64_t) rq_size, buf_location);
-  //rdma_register_memory_region(rdma_dev, pd_entry, r_key, qp->rq);
-  qp->rq_cidb = 0;
-  qp->rq_pidb = 0;
+  Debug("Info: rdma_register_memory_region - registering memory region\n");
+  if(rdma_dev == NULL) {
+    fprintf(stderr, "Error: rdma_dev is NULL\n");
+    exit(EXIT_FAILURE);    
+  }
 
-  if(is_device_address(rq_cidb_addr)) {
-    // Device memory address
-    rq_cidb_addr_lsb = ((uint32_t) ((rq_cidb_addr) & 0x00000000ffffffff));
-    rq_cidb_addr_msb = ((uint32_t) ((rq_cidb_addr >> 32) & 0x00000000ffffffff));
-  } else {
-    // Host memory address
-    rq_cidb_addr_lsb = ((uint32_t) ((rq_cidb_addr) & 0x00000000ffffffff)) & win_size_low;
-    rq_cidb_addr_msb = ((uint32_t) ((rq_cidb_addr >> 32) & 0x00000000ffffffff)) & win_size_high;
+  if(rdma_pd == NULL) {
+    fprintf(stderr, "Error: rdma_pd is NULL\n");
+    exit(EXIT_FAILURE);
   }
-  qp->rq_cidb_addr = rq_cidb_addr;
-  
-  qp->pd_entry = pd_entry;
-  
-  qp->qdepth   = qdepth;
-  qp->dst_mac = dst_mac;
-  qp->dst_ip  = dst_ip;
-  rdma_dev->qps_ptr[qpid] = qp;
 
-  fprintf(stderr, "Info: queue pair setting is done! Configuring RDMA per-queu CSR registers\n");
-  Debug("DEBUG: rdma_dev->rn_dev->axil_ctl = 0x%lx, rdma_dev->axil_ctl = 0x%lx\n", 
-                  (uint64_t) rdma_dev->rn_dev->axil_ctl, 
-                  (uint64_t) rdma_dev->axil_ctl);
+  if(rdma_buf == NULL) {
+    fprintf(stderr, "Error: rdma_buf is NULL\n");
+    exit(EXIT_FAILURE);
+  }
+
+  cache = rdma_dev->mr_cache;
+  if(cache != NULL) {
+    // A PD of the PD/MR manager gives its r_key back and leaves the address index first
+    mr = rdma_mr_of_pd(cache, rdma_pd);
+    if(mr != NULL) {
+      if(mr->indexed) {
+        rdma_mr_cache_remove(cache, mr);
+      }
+      if(mr->r_key_owned) {
+        cache->r_key_free[cache->num_r_key_free++] = mr->pd.r_key;
+        mr->r_key_owned = 0;
+      }
+    }
+
+    if(r_key == RDMA_R_KEY_AUTO) {
+      if(cache->num_r_key_free == 0) {
+        fprintf(stderr, "Error: no r_key left in the PD/MR manager\n");
+        exit(EXIT_FAILURE);
+      }
+      r_key = cache->r_key_free[--cache->num_r_key_free];
+      r_key_owned = 1;
+    } else {
+      // Keep RDMA_R_KEY_AUTO allocations from handing out the same r_key
+      r_key_owned = rdma_mr_reserve_r_key(cache, r_key);
+    }
+  } else if(r_key == RDMA_R_KEY_AUTO) {
+    fprintf(stderr, "Error: RDMA_R_KEY_AUTO needs the PD/MR manager of rdma_mr_cache_create()\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if(mr != NULL) {
+    mr->buf         = *rdma_buf;
+    mr->vaddr       = (uint64_t) rdma_buf->buffer;
+    mr->length      = rdma_buf->buf_size;
+    mr->r_key_owned = r_key_owned;
+    rdma_pd->mr_buffer = &mr->buf;
+  } else {
+    rdma_pd->mr_buffer = rdma_buf;
+  }
+  rdma_pd->r_key = r_key;
 
   if(rdma_dev->axil_ctl == 0) {
-    fprintf(stderr, "Error: rdma_dev->axil_ctl=0x%lx is not valid!\n", 
-                    (uint64_t) rdma_dev->axil_ctl);
+    fprintf(stderr, "Error: rdma_dev->axil_ctl=0x%lx is not valid!\n", (uint64_t) rdma_dev->axil_ctl);
     exit(EXIT_FAILURE);
   }
 
-  // Configure RDMA per-queue CSR registers
-  write32_data(rdma_dev->axil_ctl, 
-              get_rdma_per_q_config_addr(RN_RDMA_QCSR_IPDESADDR1i, qpid), 
-              dst_ip);
-  Debug("[Register] RN_RDMA_QCSR_IPDESADDR1i=0x%x, qpid=%d, value=0x%x\n", 
-                    get_rdma_per_q_config_addr(RN_RDMA_QCSR_IPDESADDR1i, qpid),  
+  rdma_write_pdt_entry(rdma_dev, rdma_pd);
+  if(mr != NULL) {
+    rdma_mr_cache_insert(cache, mr);
+  }
+
+  Debug("Info: memory region for the %d-th PD is registered with r_key 0x%x\n", rdma_pd->pd_num, r_key);
+}
+
+/* Take a PD slot from the free list, or evict the least recently used unreferenced MR */
+static struct rdma_mr_t* rdma_mr_slot_alloc(struct rdma_mr_cache_t* cache) {
+  struct rdma_mr_t* victim = NULL;
+  uint32_t i;
+
+  if(cache->num_pd_free != 0) {
+    cache->num_pd_free--;
+    return &cache->slots[cache->pd_free[cache->num_pd_free]];
+  }
+
+  // A region invalidated while referenced left the address index but can be evicted
+  for(i=0; i<cache->num_pd; i++) {
+    if(cache->slots[i].in_use && (cache->slots[i].refcnt == 0) && 
+       ((victim == NULL) || (cache->slots[i].last_use < victim->last_use))) {
+      victim = &cache->slots[i];
+    }
+  }
+  if(victim == NULL) {
+    Debug("DEBUG: all %d PD slots of the MR cache are referenced\n", cache->num_pd);
+    return NULL;
+  }
+
+  Debug("DEBUG: MR cache evicts pd_num %d (0x%lx, 0x%lx B)\n", victim->pd.pd_num, victim->vaddr, victim->length);
+  rdma_mr_cache_remove(cache, victim);
+  if(victim->r_key_owned) {
+    cache->r_key_free[cache->num_r_key_free++] = victim->pd.r_key;
+  }
+  cache->evictions++;
+  return victim;
+}
+
+/* Return a PD slot and its r_key to the free lists */
+static void rdma_mr_slot_release(struct rdma_mr_cache_t* cache, struct rdma_mr_t* mr) {
+  if(mr->indexed) {
+    rdma_mr_cache_remove(cache, mr);
+  }
+  if(mr->r_key_owned) {
+    cache->r_key_free[cache->num_r_key_free++] = mr->pd.r_key;
+  }
+  mr->in_use = 0;
+  mr->refcnt = 0;
+  cache->pd_free[cache->num_pd_free++] = (uint32_t) (mr - cache->slots);
+}
+
+/* Set up a PD slot for a buffer, without writing the PD table */
+static int rdma_mr_slot_fill(struct rdma_mr_cache_t* cache, struct rdma_mr_t* mr, struct rdma_buff_t* rdma_buf, uint32_t r_key) {
+  mr->r_key_owned = 0;
+  if(r_key == RDMA_R_KEY_AUTO) {
+    if(cache->num_r_key_free == 0) {
+      Debug("DEBUG: no r_key left in the PD/MR manager\n");
+      return -1;
+    }
+    r_key = cache->r_key_free[--cache->num_r_key_free];
+    mr->r_key_owned = 1;
+  } else if(rdma_buf != NULL) {
+    mr->r_key_owned = rdma_mr_reserve_r_key(cache, r_key);
+  }
+
+  mr->vaddr             = (rdma_buf == NULL) ? 0 : (uint64_t) rdma_buf->buffer;
+  mr->length            = (rdma_buf == NULL) ? 0 : rdma_buf->buf_size;
+  if(rdma_buf != NULL) {
+    mr->buf = *rdma_buf;
+  }
+  mr->refcnt            = 1;
+  mr->last_use          = cache->tick;
+  mr->in_use            = 1;
+  mr->indexed           = 0;
+  mr->pd.pd_num         = cache->first_pd_num + (uint32_t) (mr - cache->slots);
+  mr->pd.pd_access_type = 2 & 0x0000ffff;
+  mr->pd.r_key          = r_key;
+  mr->pd.mr_buffer      = (rdma_buf == NULL) ? NULL : &mr->buf;
+  return 0;
+}
+
+static void rdma_mr_write_pd(struct rdma_dev_t* rdma_dev, struct rdma_mr_t* mr) {
+  write32_data(rdma_dev->axil_ctl, get_rdma_pd_config_addr(RN_RDMA_PDT_PDPDNUM, mr->pd.pd_num), mr->pd.pd_num);
+  rdma_write_pdt_entry(rdma_dev, &mr->pd);
+}
+
+int rdma_mr_cache_create(struct rdma_dev_t* rdma_dev, uint32_t first_pd_num, uint32_t num_pd) {
+  struct rdma_mr_cache_t* cache;
+  uint32_t i;
+
+  if((rdma_dev == NULL) || (num_pd == 0)) {
+    fprintf(stderr, "Error: rdma_dev is NULL or num_pd is 0\n");
+    return -1;
+  }
+
+  if(rdma_dev->mr_cache != NULL) {
+    fprintf(stderr, "Error: MR cache of the RDMA device already exists\n");
+    return -1;
+  }
+
+  cache = (struct rdma_mr_cache_t* ) calloc(1, sizeof(struct rdma_mr_cache_t));
+  if(cache == NULL) {
+    fprintf(stderr, "Error: failed to allocate MR cache\n");
+    return -1;
+  }
+  cache->first_pd_num = first_pd_num;
+  cache->num_pd = num_pd;
+  cache->slots   = (struct rdma_mr_t* ) calloc(num_pd, sizeof(struct rdma_mr_t));
+  cache->pd_free = (uint32_t* ) calloc(num_pd, sizeof(uint32_t));
+  if((cache->slots == NULL) || (cache->pd_free == NULL)) {
+    fprintf(stderr, "Error: failed to allocate MR cache entries\n");
+    free(cache->slots);
+    free(cache->pd_free);
+    free(cache);
+    return -1;
+  }
+
+  // Free lists are stacks, lowest PD number and r_key are allocated first
+  for(i=0; i<num_pd; i++) {
+    cache->pd_free[i] = num_pd - 1 - i;
+  }
+  cache->num_pd_free = num_pd;
+  for(i=0; i<RDMA_NUM_R_KEY-1; i++) {
+    cache->r_key_free[i] = RDMA_NUM_R_KEY - 1 - i;
+  }
+  cache->num_r_key_free = RDMA_NUM_R_KEY - 1;
+
+  rdma_dev->mr_cache = cache;
+  return 0;
+}
+
+struct rdma_mr_t* rdma_mr_cache_get(struct rdma_dev_t* rdma_dev, struct rdma_buff_t* rdma_buf, uint32_t r_key) {
+  struct rdma_mr_cache_t* cache;
+  struct rdma_mr_t* mr;
+
+  if((rdma_dev == NULL) || (rdma_dev->mr_cache == NULL) || (rdma_buf == NULL)) {
+    fprintf(stderr, "Error: rdma_dev, its MR cache or rdma_buf is NULL\n");
+    return NULL;
+  }
+  cache = rdma_dev->mr_cache;
+  cache->tick++;
+
+  mr = rdma_mr_cache_find(cache, (uint64_t) rdma_buf->buffer, rdma_buf->buf_size);
+  if(mr != NULL) {
+    mr->refcnt++;
+    mr->last_use = cache->tick;
+    cache->hits++;
+    return mr;
+  }
+  cache->misses++;
+
+  mr = rdma_mr_slot_alloc(cache);
+  if(mr == NULL) {
+    return NULL;
+  }
+  if(rdma_mr_slot_fill(cache, mr, rdma_buf, r_key) != 0) {
+    rdma_mr_slot_release(cache, mr);
+    return NULL;
+  }
+
+  rdma_mr_write_pd(rdma_dev, mr);
+  rdma_mr_cache_insert(cache, mr);
+
+  return mr;
+}
+
+/* Order MRs by PD number, so that PD table registers are written in address order */
+static int rdma_mr_cmp_pd_num(const void* a, const void* b) {
+  const struct rdma_mr_t* mr_a = *(struct rdma_mr_t* const* ) a;
+  const struct rdma_mr_t* mr_b = *(struct rdma_mr_t* const* ) b;
+
+  return (mr_a->pd.pd_num > mr_b->pd.pd_num) - (mr_a->pd.pd_num < mr_b->pd.pd_num);
+}
+
+int rdma_mr_register_bulk(struct rdma_dev_t* rdma_dev, struct rdma_buff_t* rdma_bufs, uint32_t num_buf, struct rdma_mr_t** mrs) {
+  struct rdma_mr_cache_t* cache;
+  struct rdma_mr_t** new_mrs;
+  struct rdma_mr_t* mr;
+  uint32_t num_new = 0;
+  uint32_t num_done;
+  uint32_t i;
+
+  if((rdma_dev == NULL) || (rdma_dev->mr_cache == NULL) || (rdma_bufs == NULL) || (mrs == NULL)) {
+    fprintf(stderr, "Error: rdma_dev, its MR cache, rdma_bufs or mrs is NULL\n");
+    return -1;
+  }
+  cache = rdma_dev->mr_cache;
+
+  new_mrs = (struct rdma_mr_t** ) malloc((num_buf + 1) * sizeof(struct rdma_mr_t* ));
+  if(new_mrs == NULL) {
+    fprintf(stderr, "Error: failed to allocate bulk registration list\n");
+    return -1;
+  }
+
+  for(num_done=0; num_done<num_buf; num_done++) {
+    cache->tick++;
+    // Regions registered earlier in this batch are already in the address index
+    mr = rdma_mr_cache_find(cache, (uint64_t) rdma_bufs[num_done].buffer, rdma_bufs[num_done].buf_size);
+    if(mr != NULL) {
+      mr->refcnt++;
+      mr->last_use = cache->tick;
+      cache->hits++;
+      mrs[num_done] = mr;
+      continue;
+    }
+
+    cache->misses++;
+    mr = rdma_mr_slot_alloc(cache);
+    if(mr == NULL) {
+      break;
+    }
+    if(rdma_mr_slot_fill(cache, mr, &rdma_bufs[num_done], RDMA_R_KEY_AUTO) != 0) {
+      rdma_mr_slot_release(cache, mr);
+      break;
+    }
+    rdma_mr_cache_insert(cache, mr);
+    new_mrs[num_new++] = mr;
+    mrs[num_done] = mr;
+  }
+
+  // One pass over the PD table in PD number order
+  qsort(new_mrs, num_new, sizeof(struct rdma_mr_t* ), rdma_mr_cmp_pd_num);
+  for(i=0; i<num_new; i++) {
+    rdma_mr_write_pd(rdma_dev, new_mrs[i]);
+  }
+
+  free(new_mrs);
+  Debug("DEBUG: bulk registration of %d buffers, %d new PD entries\n", num_done, num_new);
+  return (int) num_done;
+}
+
+struct rdma_mr_t* rdma_mr_lookup(struct rdma_dev_t* rdma_dev, void* vaddr, uint64_t length) {
+  if((rdma_dev == NULL) || (rdma_dev->mr_cache == NULL)) {
+    return NULL;
+  }
+  return rdma_mr_cache_find(rdma_dev->mr_cache, (uint64_t) vaddr, length);
+}
+
+int rdma_mr_cache_invalidate(struct rdma_dev_t* rdma_dev, void* vaddr, uint64_t length) {
+  struct rdma_mr_cache_t* cache;
+  struct rdma_mr_t* mr;
+  int num_invalidated = 0;
+
+  if((rdma_dev == NULL) || (rdma_dev->mr_cache == NULL) || (length == 0)) {
+    return 0;
+  }
+  cache = rdma_dev->mr_cache;
+
+  while((mr = rdma_mr_cache_find_overlap(cache, (uint64_t) vaddr, (uint64_t) vaddr + length)) != NULL) {
+    Debug("DEBUG: MR cache invalidates pd_num %d (0x%lx, 0x%lx B)\n", mr->pd.pd_num, mr->vaddr, mr->length);
+    rdma_mr_cache_remove(cache, mr);
+    // An unreferenced cache entry frees its PD entry and r_key now, the others when
+    // their last reference is put or their PD is freed
+    if(mr->refcnt == 0) {
+      rdma_mr_slot_release(cache, mr);
+    }
+    num_invalidated++;
+  }
+
+  return num_invalidated;
+}
+
+struct rdma_pd_t* rdma_alloc_pd(struct rdma_dev_t* rdma_dev) {
+  struct rdma_mr_cache_t* cache;
+  struct rdma_mr_t* mr;
+
+  if((rdma_dev == NULL) || (rdma_dev->mr_cache == NULL)) {
+    fprintf(stderr, "Error: rdma_dev or its PD/MR manager is NULL\n");
+    return NULL;
+  }
+  cache = rdma_dev->mr_cache;
+
+  mr = rdma_mr_slot_alloc(cache);
+  if(mr == NULL) {
+    return NULL;
+  }
+  // The r_key is set by rdma_register_memory_region()
+  rdma_mr_slot_fill(cache, mr, NULL, 0);
+  write32_data(rdma_dev->axil_ctl, get_rdma_pd_config_addr(RN_RDMA_PDT_PDPDNUM, mr->pd.pd_num), mr->pd.pd_num);
+  Debug("[Register] RN_RDMA_PDT_PDPDNUM=0x%x, pd_num=%d, value=0x%x\n", get_rdma_pd_config_addr(RN_RDMA_PDT_PDPDNUM, mr->pd.pd_num), mr->pd.pd_num, mr->pd.pd_num);
+
+  return &mr->pd;
+}
+
+void rdma_free_pd(struct rdma_dev_t* rdma_dev, struct rdma_pd_t* rdma_pd) {
+  struct rdma_mr_cache_t* cache;
+  struct rdma_mr_t* mr;
+
+  if((rdma_dev == NULL) || (rdma_dev->mr_cache == NULL) || (rdma_pd == NULL)) {
+    return;
+  }
+  cache = rdma_dev->mr_cache;
+
+  mr = rdma_mr_of_pd(cache, rdma_pd);
+  if(mr == NULL) {
+    fprintf(stderr, "Error: pd_num %d was not allocated by rdma_alloc_pd()\n", rdma_pd->pd_num);
+    return;
+  }
+  rdma_mr_slot_release(cache, mr);
+}
+
+void rdma_mr_cache_put(struct rdma_dev_t* rdma_dev, struct rdma_mr_t* mr) {
+  if((rdma_dev == NULL) || (mr == NULL)) {
+    return;
+  }
+  if(mr->refcnt == 0) {
+    fprintf(stderr, "Error: MR of pd_num %d is not referenced\n", mr->pd.pd_num);
+    return;
+  }
+  // The PD entry stays registered until its slot is needed
+  mr->refcnt--;
+}
+
+void rdma_mr_cache_destroy(struct rdma_dev_t* rdma_dev) {
+  struct rdma_mr_cache_t* cache;
+
+  if((rdma_dev == NULL) || (rdma_dev->mr_cache == NULL)) {
+    return;
+  }
+  cache = rdma_dev->mr_cache;
+  Debug("DEBUG: MR cache hits = %ld, misses = %ld, evictions = %ld\n", cache->hits, cache->misses, cache->evictions);
+  free(cache->slots);
+  free(cache->pd_free);
+  free(cache);
+  rdma_dev->mr_cache = NULL;
+}
+
+struct rdma_buff_t* allocate_hugepages_buffer(uint32_t num_hugepages) {
+  struct rdma_buff_t* rdma_buffer;
+  rdma_buffer = (struct rdma_buff_t*) malloc(sizeof(struct rdma_buff_t));
+
+  if(rdma_buffer == NULL) {
+    fprintf(stderr, "Error: failed to create rdma_buffer\n");
+    exit(EXIT_FAILURE);
+  }
+
+  rdma_buffer->buffer = mmap(NULL, num_hugepages * (1 << HUGE_PAGE_SHIFT),
+                             PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | 
+                             MAP_HUGETLB, -1, 0);
+
+  if(rdma_buffer->buffer == NULL) {
+    fprintf(stderr, "Error: failed to allocate hugepage memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Lock the buffer in physical memory
+  if(mlock(rdma_buffer->buffer, num_hugepages * (1 << HUGE_PAGE_SHIFT)) == -1) {
+    fprintf(stderr, "Error: failed to lock %d page in memory\n", num_hugepages);
+    exit(EXIT_FAILURE);
+  }
+
+  rdma_buffer->dma_addr = get_buffer_paddr(rdma_buffer->buffer);
+
+  return rdma_buffer;
+}
+
+void config_last_rq_psn(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint32_t last_rq_psn)
+{              
+  uint32_t rq_opcode = 0x0000000a; // Just a random op-code to avoid opcode sequence error
+  uint32_t rq_conf = ((rq_opcode<<24) & 0xff000000) | (last_rq_psn & 0x00ffffff);
+
+  write32_data(rdma_dev->axil_ctl, 
+              get_rdma_per_q_config_addr(RN_RDMA_QCSR_LSTRQREQi, qpid), 
+              rq_conf);
+  fprintf(stderr, "[Register] RN_RDMA_QCSR_LSTRQREQi=0x%x, qpid=%d, value=0x%x\n", 
+                    get_rdma_per_q_config_addr(RN_RDMA_QCSR_LSTRQREQi, qpid), 
+                    qpid, 
+                    rq_conf);
+  rdma_get_qp(rdma_dev, qpid)->last_rq_psn = last_rq_psn;
+}
+
+void config_sq_psn(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint32_t sq_psn){
+  write32_data(rdma_dev->axil_ctl, 
+              get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPSNi, qpid), 
+              sq_psn);
+  fprintf(stderr, "[Register] RN_RDMA_QCSR_SQPSNi=0x%x, qpid=%d, value=0x%x\n", 
+                  get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPSNi, qpid), 
+                  qpid, 
+                  sq_psn);
+  rdma_get_qp(rdma_dev, qpid)->sq_psn = sq_psn;
+}
+
+void get_rdma_qp_ring_layout(uint32_t qdepth, uint32_t rqe_size, struct rdma_qp_ring_layout_t* layout) {
+  layout->rq_size = (uint64_t) qdepth * rqe_size;
+  layout->sq_size = (uint64_t) qdepth * sizeof(struct rdma_wqe_t);
+  layout->cq_size = (uint64_t) qdepth * CQE_SIZE;
+  layout->total_size = layout->rq_size + layout->sq_size + layout->cq_size;
+}
+
+uint64_t dump_rdma_qp_footprint(struct rdma_dev_t* rdma_dev) {
+  struct rdma_qp_t* qp;
+  uint64_t total = 0;
+  uint64_t rings = 0;
+  uint64_t blocks;
+  uint32_t num_qp = 0;
+  uint32_t i;
+
+  for(i=1; i<=rdma_dev->num_qp; i++) {
+    qp = rdma_get_qp(rdma_dev, i);
+    if((qp == NULL) || (qp->sq == NULL) || (qp->cq == NULL) || (qp->rq == NULL)) {
+      continue;
+    }
+    blocks = get_rdma_buffer_block_size(rdma_dev->rn_dev, qp->sq) + get_rdma_buffer_block_size(rdma_dev->rn_dev, qp->cq) + 
+             get_rdma_buffer_block_size(rdma_dev->rn_dev, qp->rq);
+    fprintf(stderr, "Info: QP%d depth %d, RQE %d bytes: SQ %ld + CQ %ld + RQ %ld bytes in %ld bytes of buffer blocks\n",
+            qp->qpid, qp->qdepth, qp->rqe_size, qp->sq->buf_size, qp->cq->buf_size, qp->rq->buf_size, blocks);
+    rings += qp->sq->buf_size + qp->cq->buf_size + qp->rq->buf_size;
+    total += blocks;
+    num_qp++;
+  }
+  fprintf(stderr, "Info: %d QPs use %ld bytes of buffer blocks for %ld bytes of rings\n", num_qp, total, rings);
+
+  return total;
+}
+
+uint32_t get_rdma_rqe_size_class(uint32_t max_msg_size) {
+  uint32_t rqe_size = RDMA_RQE_UNIT;
+
+  if(max_msg_size > RDMA_RQE_MAX_SIZE) {
+    return 0;
+  }
+  while(rqe_size < max_msg_size) {
+    rqe_size <<= 1;
+  }
+
+  return rqe_size;
+}
+
+struct rdma_qp_t* allocate_rdma_qp(struct rdma_dev_t* rdma_dev,
+                                   uint32_t qpid,
+                                   uint32_t dst_qpid,
+                                   struct rdma_pd_t* pd_entry,
+                                   uint64_t cq_cidb_addr,
+                                   uint64_t rq_cidb_addr,
+                                   uint32_t qdepth,
+                                   char*    buf_location,
+                                   struct mac_addr_t* dst_mac,
+                                   uint32_t dst_ip,
+                                   uint32_t partion_key,
+                                   uint32_t r_key) {
+  return allocate_rdma_qp_rqe(rdma_dev, qpid, dst_qpid, pd_entry, cq_cidb_addr, rq_cidb_addr, qdepth, 
+                              buf_location, dst_mac, dst_ip, partion_key, r_key, RQE_SIZE);
+}
+
+struct rdma_qp_t* allocate_rdma_qp_rqe(struct rdma_dev_t* rdma_dev,
+                                       uint32_t qpid,
+                                       uint32_t dst_qpid,
+                                       struct rdma_pd_t* pd_entry,
+                                       uint64_t cq_cidb_addr,
+                                       uint64_t rq_cidb_addr,
+                                       uint32_t qdepth,
+                                       char*    buf_location,
+                                       struct mac_addr_t* dst_mac,
+                                       uint32_t dst_ip,
+                                       uint32_t partion_key,
+                                       uint32_t r_key,
+                                       uint32_t rqe_size) {
+  uint32_t sq_addr_lsb;
+  uint32_t sq_addr_msb;
+  uint32_t cq_addr_lsb;
+  uint32_t cq_addr_msb;
+  uint32_t rq_addr_lsb;
+  uint32_t rq_addr_msb;
+  uint32_t cq_cidb_addr_lsb;
+  uint32_t cq_cidb_addr_msb;
+  uint32_t rq_cidb_addr_lsb;
+  uint32_t rq_cidb_addr_msb;
+  struct rdma_qp_t* qp;
+  uint32_t mtu_config;
+  uint32_t en_qp;
+  //uint32_t ip_proto;
+  uint32_t qp_config;
+  uint32_t traffic_class;
+  uint32_t time_to_live;
+  uint32_t qp_adv_conf;
+  uint32_t rq_buffer_entry_size;
+  struct rdma_qp_ring_layout_t layout;
+  uint32_t win_size_low  = rdma_dev->winSize->win_size_lsb;
+  uint32_t win_size_high = rdma_dev->winSize->win_size_msb;
+
+  if((qpid == 0) || (qpid > rdma_dev->num_qp)) {
+    fprintf(stderr, "Error: invalid qpid %d, it must be from 1 to %d\n", qpid, rdma_dev->num_qp);
+    return NULL;
+  }
+  if(rdma_get_qp(rdma_dev, qpid) != NULL) {
+    fprintf(stderr, "Error: qp %d is already allocated\n", qpid);
+    return NULL;
+  }
+  if((rqe_size == 0) || (rqe_size % RDMA_RQE_UNIT != 0) || (rqe_size > RDMA_RQE_MAX_SIZE)) {
+    fprintf(stderr, "Error: invalid RQ entry size %d, it must be a multiple of %d up to %d bytes\n", 
+            rqe_size, RDMA_RQE_UNIT, RDMA_RQE_MAX_SIZE);
+    return NULL;
+  }
+
+  qp = (struct rdma_qp_t* ) malloc(sizeof(struct rdma_qp_t));
+  qp->rdma_dev = rdma_dev;
+  qp->qpid = qpid;
+  qp->dst_qpid = dst_qpid;
+  fprintf(stderr, "Allocating qp rings\n");
+  // SQ, CQ and RQ are sized from the depth of this QP. Each one gets its own 
+  // power-of-two block, which a power-of-two depth fills exactly.
+  get_rdma_qp_ring_layout(qdepth, rqe_size, &layout);
+  Debug("sq_size = %ld, cq_size = %ld, rq_size %ld, ring size = %ld, buf_location = %s\n", 
+        layout.sq_size, layout.cq_size, layout.rq_size, layout.total_size, buf_location);
+  qp->sq = allocate_rdma_buffer(rdma_dev->rn_dev, layout.sq_size, buf_location);
+  qp->sq_pidb = 0;
+  qp->sq_cidb = 0;
+  qp->sq_stage = NULL;
+  if(is_device_address(qp->sq->dma_addr)) {
+    // Build WQEs on the host and copy them to the device SQ in bulk
+    if(posix_memalign((void** ) &qp->sq_stage, sizeof(struct rdma_wqe_t), qdepth * sizeof(struct rdma_wqe_t)) != 0) {
+      fprintf(stderr, "Error: failed to allocate SQ staging ring\n");
+      exit(EXIT_FAILURE);
+    }
+    memset(qp->sq_stage, 0, qdepth * sizeof(struct rdma_wqe_t));
+  }
+  qp->sq_credits = qdepth - 1;
+  qp->db_batch_threshold = 0;
+  qp->db_time_budget_ns = 0;
+  qp->sq_staged = 0;
+  qp->db_writes_saved = 0;
+  qp->poll_policy = NULL;
+
+  qp->cq = allocate_rdma_buffer(rdma_dev->rn_dev, layout.cq_size, buf_location);
+  qp->cq_cidb = 0;
+  qp->cq_stage = NULL;
+  if(is_device_address(qp->cq->dma_addr)) {
+    qp->cq_stage = (uint32_t* ) calloc(qdepth, CQE_SIZE);
+    if(qp->cq_stage == NULL) {
+      fprintf(stderr, "Error: failed to allocate CQ staging ring\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if(is_device_address(cq_cidb_addr)) {
+    // Device memory address
+    cq_cidb_addr_lsb = ((uint32_t) ((cq_cidb_addr) & 0x00000000ffffffff));
+    cq_cidb_addr_msb = ((uint32_t) ((cq_cidb_addr >> 32) & 0x00000000ffffffff));
+  } else {
+    // Host memory address
+    cq_cidb_addr_lsb = ((uint32_t) ((cq_cidb_addr) & 0x00000000ffffffff)) & win_size_low;
+    cq_cidb_addr_msb = ((uint32_t) ((cq_cidb_addr >> 32) & 0x00000000ffffffff)) & win_size_high;
+  }
+
+  qp->cq_cidb_addr = cq_cidb_addr;
+  qp->cq_db_shadow = NULL;
+
+  qp->rq = allocate_rdma_buffer(rdma_dev->rn_dev, layout.rq_size, buf_location);
+  //rdma_register_memory_region(rdma_dev, pd_entry, r_key, qp->rq);
+  qp->rq_cidb = 0;
+  qp->rq_pidb = 0;
+
+  if(is_device_address(rq_cidb_addr)) {
+    // Device memory address
+    rq_cidb_addr_lsb = ((uint32_t) ((rq_cidb_addr) & 0x00000000ffffffff));
+    rq_cidb_addr_msb = ((uint32_t) ((rq_cidb_addr >> 32) & 0x00000000ffffffff));
+  } else {
+    // Host memory address
+    rq_cidb_addr_lsb = ((uint32_t) ((rq_cidb_addr) & 0x00000000ffffffff)) & win_size_low;
+    rq_cidb_addr_msb = ((uint32_t) ((rq_cidb_addr >> 32) & 0x00000000ffffffff)) & win_size_high;
+  }
+  qp->rq_cidb_addr = rq_cidb_addr;
+  qp->rq_db_shadow = NULL;
+  qp->rq_recv_idx = 0;
+  qp->rq_released = (uint8_t* ) calloc(qdepth, sizeof(uint8_t));
+  if(qp->rq_released == NULL) {
+    fprintf(stderr, "Error: failed to allocate RQ release flags\n");
+    exit(EXIT_FAILURE);
+  }
+  
+  qp->pd_entry = pd_entry;
+  
+  qp->qdepth   = qdepth;
+  qp->rqe_size = rqe_size;
+  qp->dst_mac = dst_mac;
+  qp->dst_ip  = dst_ip;
+  if(rdma_set_qp(rdma_dev, qpid, qp) != 0) {
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(stderr, "Info: queue pair setting is done! Configuring RDMA per-queu CSR registers\n");
+  Debug("DEBUG: rdma_dev->rn_dev->axil_ctl = 0x%lx, rdma_dev->axil_ctl = 0x%lx\n", 
+                  (uint64_t) rdma_dev->rn_dev->axil_ctl, 
+                  (uint64_t) rdma_dev->axil_ctl);
+
+  if(rdma_dev->axil_ctl == 0) {
+    fprintf(stderr, "Error: rdma_dev->axil_ctl=0x%lx is not valid!\n", 
+                    (uint64_t) rdma_dev->axil_ctl);
+    exit(EXIT_FAILURE);
+  }
+
+  // Configure RDMA per-queue CSR registers
+  write32_data(rdma_dev->axil_ctl, 
+              get_rdma_per_q_config_addr(RN_RDMA_QCSR_IPDESADDR1i, qpid), 
+              dst_ip);
+  Debug("[Register] RN_RDMA_QCSR_IPDESADDR1i=0x%x, qpid=%d, value=0x%x\n", 
+                    get_rdma_per_q_config_addr(RN_RDMA_QCSR_IPDESADDR1i, qpid),  
                     qpid, 
                     dst_ip);
   write32_data(rdma_dev->axil_ctl, 
@@ -689,7 +1512,7 @@ struct rdma_qp_t* allocate_rdma_qp(struct rdma_dev_t* rdma_dev,
   en_qp = 1;
   //ip_proto = 0;
   mtu_config = 4;
-  rq_buffer_entry_size = RQE_SIZE;
+  rq_buffer_entry_size = rqe_size / RDMA_RQE_UNIT;
   //qp_config = (en_qp & 0x0000000f) | (0x20 & 0x000000f0) | ((mtu_config<<8) & 0x0000ff00) | ((rq_buffer_entry_size<<16) & 0xffff0000);
   // set QPCONFi[4] = 1 to disable HW handshake
   // enable QPCONFi[2] and QPCONFi[3]
@@ -733,7 +1556,58 @@ struct rdma_qp_t* allocate_rdma_qp(struct rdma_dev_t* rdma_dev,
   return qp;
 }
 
-void create_a_wqe(struct rdma_dev_t* rdma_dev, 
+/* Check whether the oldest staged WQE has waited longer than the time budget */
+static uint8_t rdma_sq_staged_expired(struct rdma_qp_t* qp) {
+  struct timespec now;
+
+  if((qp->db_time_budget_ns == 0) || (qp->sq_staged == 0)) {
+    return 0;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  timespec_sub(&now, &qp->sq_staged_ts);
+  return (((uint64_t) now.tv_sec * NSEC_DIV + (uint64_t) now.tv_nsec) >= qp->db_time_budget_ns);
+}
+
+void rdma_config_doorbell_coalescing(struct rdma_qp_t* qp, uint32_t batch_threshold, uint64_t time_budget_ns) {
+  if(qp == NULL) {
+    fprintf(stderr, "Error: qp is NULL\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Publish whatever was staged under the previous configuration
+  rdma_flush_doorbell(qp);
+  qp->db_batch_threshold = batch_threshold;
+  qp->db_time_budget_ns  = time_budget_ns;
+  Debug("DEBUG: qp %d doorbell coalescing: batch_threshold = %d, time_budget_ns = %ld\n", qp->qpid, batch_threshold, time_budget_ns);
+}
+
+int rdma_flush_doorbell(struct rdma_qp_t* qp) {
+  uint32_t num_wqe;
+  int rc;
+
+  if(qp == NULL) {
+    fprintf(stderr, "Error: qp is NULL\n");
+    return -1;
+  }
+
+  if(qp->sq_staged == 0) {
+    return 0;
+  }
+
+  num_wqe = qp->sq_staged;
+  rc = rdma_post_send_async(qp->rdma_dev, qp->qpid, num_wqe);
+  if(rc < 0) {
+    return rc;
+  }
+  qp->sq_staged = 0;
+  qp->db_writes_saved += num_wqe - 1;
+  Debug("DEBUG: qp %d published %d WQEs with one doorbell, db_writes_saved = %ld\n", qp->qpid, num_wqe, qp->db_writes_saved);
+
+  return 0;
+}
+
+int create_a_wqe(struct rdma_dev_t* rdma_dev, 
                   uint32_t qpid, 
                   uint16_t wrid, 
                   uint32_t wqe_idx, 
@@ -755,141 +1629,1027 @@ void create_a_wqe(struct rdma_dev_t* rdma_dev,
   uint32_t win_size_low  = rdma_dev->winSize->win_size_lsb;
   uint32_t win_size_high = rdma_dev->winSize->win_size_msb;
 
-  if(is_device_address(laddr)) {
-    // Device memory address
-    high_addr = (uint32_t) ((laddr & 0xffffffff00000000) >> 32);
-    low_addr  = (uint32_t) (laddr & 0x00000000ffffffff);
-  } else {
-    // Host memory address
-    high_addr = ((uint32_t) ((laddr & 0xffffffff00000000) >> 32)) & win_size_high;
-    low_addr  = ((uint32_t) (laddr & 0x00000000ffffffff)) & win_size_low;
+  if(is_device_address(laddr)) {
+    // Device memory address
+    high_addr = (uint32_t) ((laddr & 0xffffffff00000000) >> 32);
+    low_addr  = (uint32_t) (laddr & 0x00000000ffffffff);
+  } else {
+    // Host memory address
+    high_addr = ((uint32_t) ((laddr & 0xffffffff00000000) >> 32)) & win_size_high;
+    low_addr  = ((uint32_t) (laddr & 0x00000000ffffffff)) & win_size_low;
+  }
+
+  masked_buf_addr = (((uint64_t) high_addr) << 32) | ((uint64_t) low_addr);
+  Debug("Info: WQE mem_buffer = 0x%lx, masked_mem_buffer = 0x%lx\n", laddr, masked_buf_addr);
+
+  struct rdma_qp_t* qp = rdma_get_qp(rdma_dev, qpid);
+  struct rdma_buff_t* sq = qp->sq;
+  if(qp->db_batch_threshold != 0) {
+    // Doorbell coalescing: WQEs are staged in order at the tail of the SQ ring
+    if(qp->sq_staged >= qp->sq_credits) {
+      Debug("DEBUG: SQ of qp %d is full, sq_staged = %d\n", qpid, qp->sq_staged);
+      return -EAGAIN;
+    }
+    wqe_idx = rdma_sq_wqe_idx(qp, qp->sq_staged);
+  }
+  wqe_idx = wqe_idx % qp->qdepth;
+  if(qp->sq_stage != NULL) {
+    // SQ is allocated at device memory, build the WQE in the staging ring
+    wqe = &(qp->sq_stage[wqe_idx]);
+  } else {
+    // SQ is allocated at host memory
+    wqe = &(((struct rdma_wqe_t*) sq->buffer)[wqe_idx]);
+  }
+  memset(wqe, 0, sizeof(struct rdma_wqe_t));
+
+  wqe->wrid = wrid;
+  //wqe->laddr = masked_buf_addr;
+  wqe->laddr_low = low_addr;
+  wqe->laddr_high = high_addr;
+  wqe->opcode = opcode & 0x000000ff;
+  wqe->length = length;
+  //wqe->remote_offset = remote_offset;
+  wqe->remote_offset_low  = (uint32_t) (remote_offset & 0x00000000ffffffff);
+  wqe->remote_offset_high = (uint32_t) ((remote_offset & 0xffffffff00000000) >> 32);
+  wqe->r_key = r_key;
+  wqe->send_small_payload0 = send_small_payload0;
+  wqe->send_small_payload1 = send_small_payload1;
+  wqe->send_small_payload2 = send_small_payload2;
+  wqe->send_small_payload3 = send_small_payload3;
+  wqe->immdt_data = immdt_data;
+  Debug("[WQE] wrid=0x%x\n", (uint32_t) wqe->wrid);
+  Debug("[WQE] laddr_low=0x%x\n", wqe->laddr_low);
+  Debug("[WQE] laddr_high=0x%x\n", wqe->laddr_high);
+  Debug("[WQE] length=0x%x\n", wqe->length);
+  Debug("[WQE] opcode=0x%x\n", wqe->opcode);
+  Debug("[WQE] remote_offset_low=0x%x\n", wqe->remote_offset_low);
+  Debug("[WQE] remote_offset_high=0x%x\n", wqe->remote_offset_high);
+  Debug("[WQE] r_key=0x%x\n", wqe->r_key);
+  Debug("[WQE] send_small_payload0=0x%x\n", wqe->send_small_payload0);
+  Debug("[WQE] send_small_payload1=0x%x\n", wqe->send_small_payload1);
+  Debug("[WQE] send_small_payload2=0x%x\n", wqe->send_small_payload2);
+  Debug("[WQE] send_small_payload3=0x%x\n", wqe->send_small_payload3);
+  Debug("[WQE] immdt_data=0x%x\n", wqe->immdt_data);
+
+  if(qp->db_batch_threshold != 0) {
+    if((qp->sq_staged == 0) && (qp->db_time_budget_ns != 0)) {
+      clock_gettime(CLOCK_MONOTONIC, &qp->sq_staged_ts);
+    }
+    qp->sq_staged++;
+    if((qp->sq_staged >= qp->db_batch_threshold) || rdma_sq_staged_expired(qp)) {
+      return rdma_flush_doorbell(qp);
+    }
+  }
+
+  return 0;
+}
+
+/* Whether an opcode is a SEND that can carry its payload inline */
+static uint8_t rdma_is_send_opcode(uint32_t opcode) {
+  return (opcode == RNIC_OP_SEND) || (opcode == RNIC_OP_SEND_IMMDT) || (opcode == RNIC_OP_SEND_INV);
+}
+
+int create_an_inline_wqe(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint16_t wrid, 
+                         uint32_t wqe_idx, const void* payload, uint32_t length, 
+                         uint32_t opcode, uint32_t immdt_data) {
+  uint32_t inline_payload[4] = {0, 0, 0, 0};
+
+  if((length > RDMA_INLINE_MAX_SIZE) || !rdma_is_send_opcode(opcode)) {
+    fprintf(stderr, "Error: opcode %d with %d bytes can not be sent inline\n", opcode, length);
+    return -EINVAL;
+  }
+  if((payload == NULL) && (length != 0)) {
+    fprintf(stderr, "Error: inline payload is NULL\n");
+    return -EINVAL;
+  }
+
+  if(length != 0) {
+    memcpy(inline_payload, payload, length);
+  }
+  return create_a_wqe(rdma_dev, qpid, wrid, wqe_idx, 0, length, opcode, 0, 0, 
+                      inline_payload[0], inline_payload[1], inline_payload[2], inline_payload[3], 
+                      immdt_data);
+}
+
+int create_a_send_wqe(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint16_t wrid, 
+                      uint32_t wqe_idx, struct rdma_buff_t* local_buf, uint64_t local_offset, 
+                      uint32_t length, uint32_t opcode, uint32_t immdt_data) {
+  uint64_t laddr;
+  uint64_t contig_len;
+
+  if(local_buf == NULL) {
+    fprintf(stderr, "Error: local_buf is NULL\n");
+    return -EINVAL;
+  }
+
+  if((length <= RDMA_INLINE_MAX_SIZE) && rdma_is_send_opcode(opcode) && !is_device_address(local_buf->dma_addr)) {
+    return create_an_inline_wqe(rdma_dev, qpid, wrid, wqe_idx, 
+                                (void* ) ((uint64_t) local_buf->buffer + local_offset), 
+                                length, opcode, immdt_data);
+  }
+
+  // A SEND is one message on the wire and can not be split into several WQEs
+  laddr = get_rdma_buffer_paddr(rdma_dev->rn_dev, local_buf, local_offset, length, &contig_len);
+  if(contig_len < length) {
+    fprintf(stderr, "Error: SEND payload of %d bytes at offset 0x%lx is not physically contiguous\n", length, local_offset);
+    return -EINVAL;
+  }
+
+  return create_a_wqe(rdma_dev, qpid, wrid, wqe_idx, laddr, length, opcode, 0, 0, 0, 0, 0, 0, immdt_data);
+}
+
+int create_buffer_wqes(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint16_t wrid, 
+                       uint32_t wqe_idx, struct rdma_buff_t* local_buf, uint64_t local_offset, 
+                       uint32_t length, uint32_t opcode, uint64_t remote_offset, uint32_t r_key) {
+  struct rdma_qp_t* qp;
+  uint64_t laddr;
+  uint64_t contig_len;
+  uint32_t done;
+  int num_wqe;
+  int rc;
+
+  if((rdma_dev == NULL) || (local_buf == NULL)) {
+    fprintf(stderr, "Error: rdma_dev or local_buf is NULL\n");
+    return -EINVAL;
+  }
+  qp = rdma_get_qp(rdma_dev, qpid);
+  if(qp == NULL) {
+    fprintf(stderr, "Error: qp %d is not allocated\n", qpid);
+    return -EINVAL;
+  }
+
+  if(rdma_is_send_opcode(opcode)) {
+    rc = create_a_send_wqe(rdma_dev, qpid, wrid, wqe_idx, local_buf, local_offset, length, opcode, 0);
+    return (rc < 0) ? rc : 1;
+  }
+
+  // Count the WQEs first, so that a staged transfer is never left half built
+  num_wqe = 0;
+  done = 0;
+  do {
+    get_rdma_buffer_paddr(rdma_dev->rn_dev, local_buf, local_offset + done, length - done, &contig_len);
+    done += (uint32_t) contig_len;
+    num_wqe++;
+  } while(done < length);
+  if((qp->db_batch_threshold != 0) && ((uint32_t) num_wqe > qp->sq_credits - qp->sq_staged)) {
+    return -EAGAIN;
+  }
+
+  // One WQE per physically contiguous range of the local buffer
+  num_wqe = 0;
+  done = 0;
+  do {
+    laddr = get_rdma_buffer_paddr(rdma_dev->rn_dev, local_buf, local_offset + done, length - done, &contig_len);
+    rc = create_a_wqe(rdma_dev, qpid, wrid, wqe_idx + (uint32_t) num_wqe, laddr, (uint32_t) contig_len, opcode, 
+                      remote_offset + done, r_key, 0, 0, 0, 0, 0);
+    if(rc < 0) {
+      return rc;
+    }
+    done += (uint32_t) contig_len;
+    num_wqe++;
+  } while(done < length);
+
+  return num_wqe;
+}
+
+/* Mask a buffer address for the hardware, host memory addresses are converted by the
+ * PCIe BDF window */
+static uint64_t rdma_mask_buf_addr(struct rdma_dev_t* rdma_dev, uint64_t addr) {
+  uint64_t win_size;
+
+  if(is_device_address(addr)) {
+    return addr;
+  }
+  win_size = (((uint64_t) rdma_dev->winSize->win_size_msb) << 32) | ((uint64_t) rdma_dev->winSize->win_size_lsb);
+  return addr & win_size;
+}
+
+/* Write one WQE to an SQ slot. A host SQ slot that is 16B aligned gets non-temporal stores */
+static inline void rdma_store_wqe(struct rdma_wqe_t* slot_wqe, uint8_t use_stream, struct rdma_wqe_desc_t* desc, 
+                                  uint64_t laddr, uint32_t length, uint64_t remote_offset, uint32_t* small_payload) {
+#if defined(__SSE2__)
+  __m128i* slot = (__m128i* ) slot_wqe;
+  __m128i x0 = _mm_set_epi32((int) length, (int) (laddr >> 32), (int) (laddr & 0x00000000ffffffff), (int) desc->wrid);
+  __m128i x1 = _mm_set_epi32((int) desc->r_key, (int) (remote_offset >> 32), (int) (remote_offset & 0x00000000ffffffff), (int) (desc->opcode & 0x000000ff));
+  __m128i x2 = _mm_loadu_si128((__m128i* ) small_payload);
+  __m128i x3 = _mm_set_epi32(0, 0, 0, (int) desc->immdt_data);
+  if(use_stream && ((((uintptr_t) slot) & 0xf) == 0)) {
+    // Non-temporal stores of a whole WQE to the host SQ
+    _mm_stream_si128(slot + 0, x0);
+    _mm_stream_si128(slot + 1, x1);
+    _mm_stream_si128(slot + 2, x2);
+    _mm_stream_si128(slot + 3, x3);
+  } else {
+    _mm_storeu_si128(slot + 0, x0);
+    _mm_storeu_si128(slot + 1, x1);
+    _mm_storeu_si128(slot + 2, x2);
+    _mm_storeu_si128(slot + 3, x3);
+  }
+#else
+  struct rdma_wqe_t wqe;
+  memset(&wqe, 0, sizeof(struct rdma_wqe_t));
+  wqe.wrid                = desc->wrid;
+  wqe.laddr_low           = (uint32_t) (laddr & 0x00000000ffffffff);
+  wqe.laddr_high          = (uint32_t) (laddr >> 32);
+  wqe.length              = length;
+  wqe.opcode              = desc->opcode & 0x000000ff;
+  wqe.remote_offset_low   = (uint32_t) (remote_offset & 0x00000000ffffffff);
+  wqe.remote_offset_high  = (uint32_t) (remote_offset >> 32);
+  wqe.r_key               = desc->r_key;
+  wqe.send_small_payload0 = small_payload[0];
+  wqe.send_small_payload1 = small_payload[1];
+  wqe.send_small_payload2 = small_payload[2];
+  wqe.send_small_payload3 = small_payload[3];
+  wqe.immdt_data          = desc->immdt_data;
+  memcpy(slot_wqe, &wqe, sizeof(struct rdma_wqe_t));
+#endif
+}
+
+int rdma_post_wqe_batch(struct rdma_dev_t* rdma_dev, uint32_t qpid, struct rdma_wqe_desc_t* descs, uint32_t num_desc) {
+  struct rdma_qp_t* qp;
+  struct rdma_wqe_t* sq_ring;
+  struct rdma_wqe_desc_t* desc;
+  struct rdma_buff_t* seg_buf = NULL;
+  uint64_t seg_start = 0;
+  uint64_t seg_len = 0;
+  uint64_t seg_laddr = 0;
+  uint64_t offset;
+  uint64_t laddr;
+  uint64_t contig_len;
+  uint32_t inline_payload[4];
+  uint32_t* small_payload;
+  uint32_t num_free;
+  uint32_t num_wqe = 0;
+  uint32_t desc_wqe;
+  uint32_t done;
+  uint32_t wqe_idx;
+  uint32_t i;
+  uint8_t  use_stream;
+  int rc;
+
+  if((rdma_dev == NULL) || (descs == NULL)) {
+    fprintf(stderr, "Error: rdma_dev or descs is NULL\n");
+    return -1;
+  }
+
+  qp = rdma_get_qp(rdma_dev, qpid);
+  if(qp == NULL) {
+    fprintf(stderr, "Error: qp %d is not allocated\n", qpid);
+    return -1;
+  }
+
+  num_free = qp->sq_credits - qp->sq_staged;
+  if(num_free == 0) {
+    return -EAGAIN;
+  }
+
+  // WQEs for an SQ at device memory are built in the staging ring and copied in bulk
+  use_stream = (qp->sq_stage == NULL);
+  sq_ring = use_stream ? (struct rdma_wqe_t* ) qp->sq->buffer : qp->sq_stage;
+
+  for(i=0; i<num_desc; i++) {
+    desc = &descs[i];
+    small_payload = desc->send_small_payload;
+    if((desc->local_buf != NULL) && (desc->length <= RDMA_INLINE_MAX_SIZE) && 
+       rdma_is_send_opcode(desc->opcode) && !is_device_address(desc->local_buf->dma_addr)) {
+      // Small SEND from host memory: carry the payload in the WQE, no payload DMA
+      if(num_wqe == num_free) {
+        break;
+      }
+      memset(inline_payload, 0, sizeof(inline_payload));
+      memcpy(inline_payload, (void* ) ((uint64_t) desc->local_buf->buffer + desc->local_offset), desc->length);
+      wqe_idx = rdma_sq_wqe_idx(qp, qp->sq_staged + num_wqe);
+      rdma_store_wqe(&sq_ring[wqe_idx], use_stream, desc, 0, desc->length, desc->remote_offset, inline_payload);
+      Debug("[WQE] qpid=%d, wqe_idx=%d, wrid=0x%x, inline, length=0x%x, opcode=0x%x\n", qpid, wqe_idx, desc->wrid, desc->length, desc->opcode);
+      num_wqe++;
+      continue;
+    }
+
+    // One WQE per physically contiguous range of the local buffer. WQEs written past the
+    // free slots are not published, so a descriptor is posted whole or not at all
+    desc_wqe = 0;
+    done = 0;
+    do {
+      if(num_wqe + desc_wqe == num_free) {
+        break;
+      }
+      if(desc->local_buf == NULL) {
+        laddr = rdma_mask_buf_addr(rdma_dev, desc->local_offset);
+        contig_len = desc->length;
+      } else {
+        // The masked address of a contiguous segment of the local buffer is computed once,
+        // descriptors falling in the last segment translated reuse it
+        offset = desc->local_offset + done;
+        if((desc->local_buf != seg_buf) || (offset < seg_start) || (offset >= seg_start + seg_len)) {
+          contig_len = desc->length - done;
+          if((offset < desc->local_buf->buf_size) && (desc->local_buf->buf_size - offset > contig_len)) {
+            contig_len = desc->local_buf->buf_size - offset;
+          }
+          seg_laddr = rdma_mask_buf_addr(rdma_dev, get_rdma_buffer_paddr(rdma_dev->rn_dev, desc->local_buf, offset, contig_len, &seg_len));
+          seg_buf = desc->local_buf;
+          seg_start = offset;
+        }
+        laddr = seg_laddr + (offset - seg_start);
+        contig_len = seg_start + seg_len - offset;
+        if(contig_len > desc->length - done) {
+          contig_len = desc->length - done;
+        }
+      }
+      if((contig_len < desc->length) && rdma_is_send_opcode(desc->opcode)) {
+        // A SEND is one message on the wire and can not be split
+        fprintf(stderr, "Error: SEND payload of descriptor %d is not physically contiguous\n", i);
+        if(num_wqe == 0) {
+          return -EINVAL;
+        }
+        break;
+      }
+      wqe_idx = rdma_sq_wqe_idx(qp, qp->sq_staged + num_wqe + desc_wqe);
+      rdma_store_wqe(&sq_ring[wqe_idx], use_stream, desc, laddr, (uint32_t) contig_len, desc->remote_offset + done, small_payload);
+      Debug("[WQE] qpid=%d, wqe_idx=%d, wrid=0x%x, laddr=0x%lx, length=0x%x, opcode=0x%x\n", qpid, wqe_idx, desc->wrid, laddr, (uint32_t) contig_len, desc->opcode);
+      done += (uint32_t) contig_len;
+      desc_wqe++;
+    } while(done < desc->length);
+    if((desc_wqe == 0) || (done < desc->length)) {
+      break;
+    }
+    num_wqe += desc_wqe;
+  }
+
+#if defined(__SSE2__)
+  // Make the non-temporal stores visible before the doorbell
+  _mm_sfence();
+#endif
+
+  if(num_wqe == 0) {
+    return -EAGAIN;
+  }
+
+  // Publish the batch, and WQEs staged before it, with one doorbell
+  qp->sq_staged += num_wqe;
+  rc = rdma_flush_doorbell(qp);
+  if(rc < 0) {
+    qp->sq_staged -= num_wqe;
+    return rc;
+  }
+
+  return (int) i;
+}
+
+/* Reap the completions of the WQEs still in flight on a QP, until the SQ is empty or the
+ * deadline of the QP polling policy has passed */
+static int rdma_drain_sq(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp, struct rdma_completion_t* completions) {
+  struct poll_policy_t* policy = rdma_qp_poll_policy(rdma_dev, qp);
+  struct poll_state_t poll_state;
+  int num;
+
+  poll_wait_begin(&poll_state);
+  while(qp->sq_credits != qp->qdepth - 1) {
+    num = rdma_poll_cq(qp, completions, qp->qdepth);
+    if(num < 0) {
+      poll_wait_end(policy, &poll_state, 1);
+      return -1;
+    }
+    if((num == 0) && (poll_wait_step(policy, &poll_state) != 0)) {
+      poll_wait_end(policy, &poll_state, 1);
+      fprintf(stderr, "Error: qp %d still has %d WQEs in flight\n", qp->qpid, qp->qdepth - 1 - qp->sq_credits);
+      return -1;
+    }
+  }
+  poll_wait_end(policy, &poll_state, 0);
+  return 0;
+}
+
+/* Split a large RDMA WRITE or READ into chunks, keeping the SQ ring full. Chunks end at 
+ * physically discontiguous hugepage boundaries of the local buffer, so each chunk is one WQE */
+static int rdma_transfer_large(struct rdma_dev_t* rdma_dev, uint32_t qpid, struct rdma_buff_t* local_buf, 
+                               uint64_t local_offset, uint64_t remote_offset, uint32_t r_key, 
+                               uint64_t length, uint32_t chunk_size, uint32_t opcode) {
+  struct rdma_qp_t* qp;
+  struct rdma_wqe_desc_t* descs;
+  struct rdma_completion_t* completions;
+  struct poll_policy_t* policy;
+  struct poll_state_t poll_state;
+  uint64_t num_posted = 0;
+  uint64_t num_completed = 0;
+  uint64_t posted_bytes = 0;
+  uint64_t offset;
+  uint64_t contig_len;
+  uint32_t num_free;
+  uint32_t i;
+  int rc = 0;
+  int num;
+
+  if((rdma_dev == NULL) || (local_buf == NULL)) {
+    fprintf(stderr, "Error: rdma_dev or local_buf is NULL\n");
+    return -1;
+  }
+
+  qp = rdma_get_qp(rdma_dev, qpid);
+  if(qp == NULL) {
+    fprintf(stderr, "Error: qp %d is not allocated\n", qpid);
+    return -1;
+  }
+
+  if((local_offset > local_buf->buf_size) || (length > local_buf->buf_size - local_offset)) {
+    fprintf(stderr, "Error: transfer of 0x%lx bytes at offset 0x%lx exceeds the local buffer size 0x%lx\n", length, local_offset, local_buf->buf_size);
+    return -1;
+  }
+
+  // Completions of other WQEs would be mixed with the chunk completions
+  if((qp->sq_staged != 0) || (qp->sq_credits != qp->qdepth - 1)) {
+    fprintf(stderr, "Error: qp %d has WQEs in flight\n", qpid);
+    return -EBUSY;
+  }
+
+  if(length == 0) {
+    return 0;
+  }
+
+  if(chunk_size == 0) {
+    chunk_size = RDMA_LARGE_CHUNK_SIZE;
+  }
+
+  descs = (struct rdma_wqe_desc_t* ) calloc(qp->qdepth, sizeof(struct rdma_wqe_desc_t));
+  completions = (struct rdma_completion_t* ) calloc(qp->qdepth, sizeof(struct rdma_completion_t));
+  if((descs == NULL) || (completions == NULL)) {
+    fprintf(stderr, "Error: failed to allocate descriptors for a large transfer\n");
+    free(descs);
+    free(completions);
+    return -1;
+  }
+
+  Debug("DEBUG: qp %d transfers 0x%lx bytes in chunks of up to 0x%x bytes, opcode = %d\n", qpid, length, chunk_size, opcode);
+  policy = rdma_qp_poll_policy(rdma_dev, qp);
+  poll_wait_begin(&poll_state);
+  while((posted_bytes < length) || (num_completed < num_posted)) {
+    // Refill the SQ ring with the next chunks
+    num_free = qp->sq_credits - qp->sq_staged;
+    offset = posted_bytes;
+    for(i=0; (i<num_free) && (offset<length); i++) {
+      get_rdma_buffer_paddr(rdma_dev->rn_dev, local_buf, local_offset + offset, 
+                            (length - offset < chunk_size) ? length - offset : chunk_size, &contig_len);
+      descs[i].local_buf     = local_buf;
+      descs[i].local_offset  = local_offset + offset;
+      descs[i].length        = (uint32_t) contig_len;
+      descs[i].opcode        = opcode;
+      descs[i].remote_offset = remote_offset + offset;
+      descs[i].r_key         = r_key;
+      descs[i].wrid          = (uint16_t) ((num_posted + i) & 0x0000ffff);
+      offset += contig_len;
+    }
+    if(i != 0) {
+      num = rdma_post_wqe_batch(rdma_dev, qpid, descs, i);
+      if((num < 0) && (num != -EAGAIN)) {
+        rc = -1;
+        break;
+      }
+      for(i=0; i<(uint32_t) ((num > 0) ? num : 0); i++) {
+        posted_bytes += descs[i].length;
+      }
+      if(num > 0) {
+        num_posted += num;
+      }
+    }
+
+    num = rdma_poll_cq(qp, completions, qp->qdepth);
+    if(num < 0) {
+      rc = -1;
+      break;
+    }
+    for(i=0; i<(uint32_t) num; i++) {
+      if(completions[i].status != 0) {
+        fprintf(stderr, "Error: chunk with wrid 0x%x of qp %d failed with status 0x%x\n", completions[i].wrid, qpid, completions[i].status);
+        rc = -1;
+      }
+    }
+    num_completed += num;
+    if(rc != 0) {
+      break;
+    }
+
+    if(num != 0) {
+      // Progress was made, restart the wait
+      poll_wait_end(policy, &poll_state, 0);
+      poll_wait_begin(&poll_state);
+    } else if(poll_wait_step(policy, &poll_state) != 0) {
+      poll_wait_end(policy, &poll_state, 1);
+      fprintf(stderr, "Error: large transfer on qp %d timed out, %ld of %ld chunks posted completed\n", qpid, num_completed, num_posted);
+      rc = -1;
+      break;
+    }
+  }
+
+  // Do not return with chunks in flight, their completions would fail the next transfer
+  if((rc != 0) && (num_completed < num_posted)) {
+    rdma_drain_sq(rdma_dev, qp, completions);
+  }
+
+  free(descs);
+  free(completions);
+  return rc;
+}
+
+int rdma_write_large(struct rdma_dev_t* rdma_dev, uint32_t qpid, struct rdma_buff_t* local_buf, 
+                     uint64_t local_offset, uint64_t remote_offset, uint32_t r_key, 
+                     uint64_t length, uint32_t chunk_size) {
+  return rdma_transfer_large(rdma_dev, qpid, local_buf, local_offset, remote_offset, r_key, 
+                             length, chunk_size, RNIC_OP_WRITE);
+}
+
+int rdma_read_large(struct rdma_dev_t* rdma_dev, uint32_t qpid, struct rdma_buff_t* local_buf, 
+                    uint64_t local_offset, uint64_t remote_offset, uint32_t r_key, 
+                    uint64_t length, uint32_t chunk_size) {
+  return rdma_transfer_large(rdma_dev, qpid, local_buf, local_offset, remote_offset, r_key, 
+                             length, chunk_size, RNIC_OP_READ);
+}
+
+int rdma_config_rq_shadow_poll(struct rdma_qp_t* qp, uint8_t enable) {
+  if(qp == NULL) {
+    fprintf(stderr, "Error: qp is NULL\n");
+    return -1;
+  }
+
+  if(!enable) {
+    qp->rq_db_shadow = NULL;
+    return 0;
+  }
+
+  if(is_device_address(qp->rq_cidb_addr)) {
+    fprintf(stderr, "Error: RQ doorbell of qp %d is in device memory\n", qp->qpid);
+    return -1;
+  }
+
+  qp->rq_db_shadow = (volatile uint32_t* ) get_buffer_vaddr(qp->rdma_dev->rn_dev, qp->rq_cidb_addr);
+  if(qp->rq_db_shadow == NULL) {
+    fprintf(stderr, "Error: RQ doorbell address 0x%lx of qp %d is not in the hugepage buffer\n", qp->rq_cidb_addr, qp->qpid);
+    return -1;
   }
+  Debug("DEBUG: qp %d polls RQ doorbell at %p (0x%lx)\n", qp->qpid, (void* ) qp->rq_db_shadow, qp->rq_cidb_addr);
 
-  masked_buf_addr = (((uint64_t) high_addr) << 32) | ((uint64_t) low_addr);
-  Debug("Info: WQE mem_buffer = 0x%lx, masked_mem_buffer = 0x%lx\n", laddr, masked_buf_addr);
+  return 0;
+}
 
-  struct rdma_buff_t* sq = rdma_dev->qps_ptr[qpid]->sq;
-  if(is_device_address(sq->dma_addr)) {
-    // SQ is allocated at device memory
-    wqe = (struct rdma_wqe_t* ) malloc(sizeof(struct rdma_wqe_t));
-  } else {
-    // SQ is allocated at host memory
-    wqe = &(((struct rdma_wqe_t*) sq->buffer)[wqe_idx]);
+/* Re-arm the RQ interrupt of a queue pair by clearing its RQINTSTS bit */
+static int rdma_arm_rq_intr(void* arg) {
+  struct rdma_qp_t* qp = (struct rdma_qp_t* ) arg;
+  uint32_t idx = qp->qpid - 1;
+
+  write32_data(qp->rdma_dev->axil_ctl, RN_RDMA_GCSR_RQINTSTS1 + ((idx >> 5) << 2), (uint32_t) BIT(idx & 0x1f));
+  return 0;
+}
+
+/* Read the CQ head, from the host-memory doorbell if enabled */
+static int rdma_read_cq_head(struct rdma_qp_t* qp) {
+  if(qp->cq_db_shadow != NULL) {
+    return (int) *(qp->cq_db_shadow);
   }
-  memset(wqe, 0, sizeof(struct rdma_wqe_t));
+  return read32_data(qp->rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qp->qpid));
+}
 
-  wqe->wrid = wrid;
-  //wqe->laddr = masked_buf_addr;
-  wqe->laddr_low = low_addr;
-  wqe->laddr_high = high_addr;
-  wqe->opcode = opcode & 0x000000ff;
-  wqe->length = length;
-  //wqe->remote_offset = remote_offset;
-  wqe->remote_offset_low  = (uint32_t) (remote_offset & 0x00000000ffffffff);
-  wqe->remote_offset_high = (uint32_t) ((remote_offset & 0xffffffff00000000) >> 32);
-  wqe->r_key = r_key;
-  wqe->send_small_payload0 = send_small_payload0;
-  wqe->send_small_payload1 = send_small_payload1;
-  wqe->send_small_payload2 = send_small_payload2;
-  wqe->send_small_payload3 = send_small_payload3;
-  wqe->immdt_data = immdt_data;
-  Debug("[WQE] wrid=0x%x\n", (uint32_t) wqe->wrid);
-  Debug("[WQE] laddr_low=0x%x\n", wqe->laddr_low);
-  Debug("[WQE] laddr_high=0x%x\n", wqe->laddr_high);
-  Debug("[WQE] length=0x%x\n", wqe->length);
-  Debug("[WQE] opcode=0x%x\n", wqe->opcode);
-  Debug("[WQE] remote_offset_low=0x%x\n", wqe->remote_offset_low);
-  Debug("[WQE] remote_offset_high=0x%x\n", wqe->remote_offset_high);
-  Debug("[WQE] r_key=0x%x\n", wqe->r_key);
-  Debug("[WQE] send_small_payload0=0x%x\n", wqe->send_small_payload0);
-  Debug("[WQE] send_small_payload1=0x%x\n", wqe->send_small_payload1);
-  Debug("[WQE] send_small_payload2=0x%x\n", wqe->send_small_payload2);
-  Debug("[WQE] send_small_payload3=0x%x\n", wqe->send_small_payload3);
-  Debug("[WQE] immdt_data=0x%x\n", wqe->immdt_data);
-  if(is_device_address(sq->dma_addr)) {
-    // Write WQE to SQ in the device memory
-    Debug("DEBUG: Write WQE to the device memory\n");
-    ssize_t rc = write_from_buffer(device, fpga_fd, (char* ) wqe, sizeof(struct rdma_wqe_t), (sq->dma_addr + (wqe_idx*sizeof(struct rdma_wqe_t))));
-    if (rc < 0){
-      fprintf(stderr, "Error: Failed to write WQE to the device memory!\n");
-      exit(EXIT_FAILURE);
-    } else {
-      Debug("DEBUG: successfully write WQE to the device memory!\n");
-    }
-    free(wqe);
+/* Read the RQ producer index, from the host-memory doorbell if enabled */
+static int rdma_read_rq_pidb(struct rdma_qp_t* qp) {
+  if(qp->rq_db_shadow != NULL) {
+    return (int) *(qp->rq_db_shadow);
   }
+  return read32_data(qp->rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_STATRQPIDBi, qp->qpid));
 }
 
 int poll_rq_pidb(struct rdma_dev_t* rdma_dev, uint32_t qpid) {
-  struct rdma_qp_t* qp = rdma_dev->qps_ptr[qpid];
-  int rq_pidb = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_STATRQPIDBi, qpid));
+  struct rdma_qp_t* qp = rdma_get_qp(rdma_dev, qpid);
+  struct poll_policy_t* policy = rdma_qp_poll_policy(rdma_dev, qp);
+  struct poll_state_t poll_state;
+  uint32_t poll_cnt = 0;
+  int rq_pidb = rdma_read_rq_pidb(qp);
 
   // If poll, read until greater than what we previously have read
   Debug("DEBUG: Polling on RQ PIDB. Count: 0x%x\n", rq_pidb);
-  if(getenv("DEBUG") && atoi(getenv("DEBUG")) == 1) {
+  if(debug == 1) {
     dump_registers(rdma_dev, 0, qpid);
   }
+  poll_wait_begin(&poll_state);
+  poll_wait_set_arm(&poll_state, rdma_arm_rq_intr, qp);
   while(rq_pidb == qp->rq_pidb) {
+    if(poll_wait_step(policy, &poll_state) != 0) {
+      poll_wait_end(policy, &poll_state, 1);
+      fprintf(stderr, "Error: poll_rq_pidb timeout! qpid = %d; RQ PIDB = %d\n", qpid, rq_pidb);
+      return -1;
+    }
+    rq_pidb = rdma_read_rq_pidb(qp);
+    if((qp->rq_db_shadow != NULL) && (++poll_cnt >= RQ_SHADOW_POLL_THRESHOLD)) {
+      // The doorbell write may be delayed or lost, check STATRQPIDBi
+      poll_cnt = 0;
       rq_pidb = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_STATRQPIDBi, qpid));
+    }
   }
+  poll_wait_end(policy, &poll_state, 0);
 
   qp->rq_pidb = rq_pidb;        
   return qp->rq_pidb;
 }
 
+void rdma_set_qp_poll_policy(struct rdma_qp_t* qp, struct poll_policy_t* policy) {
+  qp->poll_policy = policy;
+}
+
+void rdma_qp_set_zero(struct rdma_qp_set_t* qp_set) {
+  memset(qp_set, 0, sizeof(struct rdma_qp_set_t));
+}
+
+void rdma_qp_set_add(struct rdma_qp_set_t* qp_set, uint32_t qpid) {
+  if((qpid == 0) || (qpid > (RDMA_QP_SET_WORDS * 32))) {
+    fprintf(stderr, "Error: qpid %d can not be added to a QP set\n", qpid);
+    return;
+  }
+  qp_set->bitmap[(qpid-1) >> 5] |= (uint32_t) BIT((qpid-1) & 0x1f);
+}
+
+void rdma_qp_set_del(struct rdma_qp_set_t* qp_set, uint32_t qpid) {
+  if((qpid == 0) || (qpid > (RDMA_QP_SET_WORDS * 32))) {
+    return;
+  }
+  qp_set->bitmap[(qpid-1) >> 5] &= ~((uint32_t) BIT((qpid-1) & 0x1f));
+}
+
+/* Scan a QP set once and report QPs with new completions or receives */
+static int rdma_scan_qp_set(struct rdma_dev_t* rdma_dev, struct rdma_qp_set_t* qp_set, struct rdma_qp_event_t* events, uint32_t max_events) {
+  struct rdma_qp_t* qp;
+  uint32_t num_events = 0;
+  uint32_t members;
+  uint32_t bits;
+  uint32_t cq_mmio;
+  uint32_t rq_mmio;
+  uint32_t cq_clr;
+  uint32_t rq_clr;
+  uint32_t qp_events;
+  uint32_t qpid;
+  uint32_t w;
+  uint32_t b;
+
+  for(w=0; (w<RDMA_QP_SET_WORDS) && (num_events<max_events); w++) {
+    members = qp_set->bitmap[w];
+    if(members == 0) {
+      continue;
+    }
+
+    // Ignore QPs that are not allocated, and find the QPs without a host-memory doorbell
+    cq_mmio = 0;
+    rq_mmio = 0;
+    for(bits = members; bits != 0; bits &= bits - 1) {
+      b  = __builtin_ctz(bits);
+      qp = rdma_get_qp(rdma_dev, (w << 5) + b + 1);
+      if(qp == NULL) {
+        members &= ~((uint32_t) BIT(b));
+        continue;
+      }
+      if(qp->cq_db_shadow == NULL) {
+        cq_mmio |= (uint32_t) BIT(b);
+      }
+      if(qp->rq_db_shadow == NULL) {
+        rq_mmio |= (uint32_t) BIT(b);
+      }
+    }
+
+    // Clear the interrupt status bits of these QPs by writing 1, as rdma_arm_cq_intr()
+    // and rdma_arm_rq_intr() do, before their CQ head or RQ producer index is read. A
+    // completion arriving after the read sets its bit again instead of being cleared.
+    cq_clr = (cq_mmio != 0) ? (read32_data(rdma_dev->axil_ctl, RN_RDMA_GCSR_CQINTSTS1 + (w << 2)) & cq_mmio) : 0;
+    rq_clr = (rq_mmio != 0) ? (read32_data(rdma_dev->axil_ctl, RN_RDMA_GCSR_RQINTSTS1 + (w << 2)) & rq_mmio) : 0;
+    if(cq_clr != 0) {
+      write32_data(rdma_dev->axil_ctl, RN_RDMA_GCSR_CQINTSTS1 + (w << 2), cq_clr);
+    }
+    if(rq_clr != 0) {
+      write32_data(rdma_dev->axil_ctl, RN_RDMA_GCSR_RQINTSTS1 + (w << 2), rq_clr);
+    }
+
+    for(bits = members; (bits != 0) && (num_events<max_events); bits &= bits - 1) {
+      b    = __builtin_ctz(bits);
+      qpid = (w << 5) + b + 1;
+      qp   = rdma_get_qp(rdma_dev, qpid);
+      qp_events = 0;
+
+      // Events are level-triggered: a QP is reported while its CQ head or RQ producer 
+      // index differs from what was consumed, whether or not its status bit is set
+      if(rdma_read_cq_head(qp) != qp->sq_cidb) {
+        qp_events |= RDMA_EVENT_CQ;
+      }
+      if(rdma_read_rq_pidb(qp) != qp->rq_pidb) {
+        qp_events |= RDMA_EVENT_RQ;
+      }
+
+      if(qp_events != 0) {
+        events[num_events].qpid   = qpid;
+        events[num_events].events = qp_events;
+        num_events++;
+      }
+    }
+  }
+
+  return (int) num_events;
+}
+
+int rdma_wait_any(struct rdma_dev_t* rdma_dev, struct rdma_qp_set_t* qp_set, struct rdma_qp_event_t* events, uint32_t max_events) {
+  int num_events;
+  struct poll_state_t poll_state;
+
+  if((rdma_dev == NULL) || (qp_set == NULL) || (events == NULL)) {
+    fprintf(stderr, "Error: rdma_dev, qp_set or events is NULL\n");
+    return -1;
+  }
+
+  if(max_events == 0) {
+    return 0;
+  }
+
+  poll_wait_begin(&poll_state);
+  while((num_events = rdma_scan_qp_set(rdma_dev, qp_set, events, max_events)) == 0) {
+    if(poll_wait_step(&rdma_dev->poll_policy, &poll_state) != 0) {
+      poll_wait_end(&rdma_dev->poll_policy, &poll_state, 1);
+      return 0;
+    }
+  }
+  poll_wait_end(&rdma_dev->poll_policy, &poll_state, 0);
+
+  Debug("DEBUG: rdma_wait_any reported %d events\n", num_events);
+  return num_events;
+}
+
+int rdma_config_cq_shadow_poll(struct rdma_qp_t* qp, uint8_t enable) {
+  if(qp == NULL) {
+    fprintf(stderr, "Error: qp is NULL\n");
+    return -1;
+  }
+
+  if(!enable) {
+    qp->cq_db_shadow = NULL;
+    return 0;
+  }
+
+  if(is_device_address(qp->cq_cidb_addr)) {
+    fprintf(stderr, "Error: CQ doorbell of qp %d is in device memory\n", qp->qpid);
+    return -1;
+  }
+
+  qp->cq_db_shadow = (volatile uint32_t* ) get_buffer_vaddr(qp->rdma_dev->rn_dev, qp->cq_cidb_addr);
+  if(qp->cq_db_shadow == NULL) {
+    fprintf(stderr, "Error: CQ doorbell address 0x%lx of qp %d is not in the hugepage buffer\n", qp->cq_cidb_addr, qp->qpid);
+    return -1;
+  }
+  Debug("DEBUG: qp %d polls CQ doorbell at %p (0x%lx)\n", qp->qpid, (void* ) qp->cq_db_shadow, qp->cq_cidb_addr);
+
+  return 0;
+}
+
+/* Re-arm the CQ interrupt of a queue pair by clearing its CQINTSTS bit */
+static int rdma_arm_cq_intr(void* arg) {
+  struct rdma_qp_t* qp = (struct rdma_qp_t* ) arg;
+  uint32_t idx = qp->qpid - 1;
+
+  write32_data(qp->rdma_dev->axil_ctl, RN_RDMA_GCSR_CQINTSTS1 + ((idx >> 5) << 2), (uint32_t) BIT(idx & 0x1f));
+  return 0;
+}
+
 int poll_cq_cidb(struct rdma_dev_t* rdma_dev, uint32_t qpid, int sq_cidb) {
   int cq_cidb;
-  uint32_t timeout_cnt = 0;
-  cq_cidb = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid));
-  Debug("[Register] RN_RDMA_QCSR_CQHEADi=0x%x, qpid=%d, value=0x%x\n", get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid), qpid, cq_cidb);
+  uint32_t shadow_cnt = 0;
+  struct rdma_qp_t* qp = rdma_get_qp(rdma_dev, qpid);
+  struct poll_policy_t* policy = rdma_qp_poll_policy(rdma_dev, qp);
+  struct poll_state_t poll_state;
+  uint8_t use_shadow = ((qp != NULL) && (qp->cq_db_shadow != NULL));
+
+  if(use_shadow) {
+    // Spin on the CQ doorbell in host memory, no PCIe reads
+    cq_cidb = (int) *(qp->cq_db_shadow);
+  } else {
+    cq_cidb = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid));
+    Debug("[Register] RN_RDMA_QCSR_CQHEADi=0x%x, qpid=%d, value=0x%x\n", get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid), qpid, cq_cidb);
+  }
 
   Debug("DEBUG: before polling: sq_cidb = %d; Polling CQ CIDB = %d\n", sq_cidb, cq_cidb);
   // dump_registers(rdma_dev, 1, qpid);
+  poll_wait_begin(&poll_state);
+  if(qp != NULL) {
+    poll_wait_set_arm(&poll_state, rdma_arm_cq_intr, qp);
+  }
   while(cq_cidb == sq_cidb) {
-    cq_cidb = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid));
-    timeout_cnt += 1;
-    if(timeout_cnt > TIMEOUT_THRESHOLD) {
+    if(poll_wait_step(policy, &poll_state) != 0) {
       goto timeout_action;
     }
+    if(use_shadow && (shadow_cnt < CQ_SHADOW_POLL_THRESHOLD)) {
+      cq_cidb = (int) *(qp->cq_db_shadow);
+      if(++shadow_cnt == CQ_SHADOW_POLL_THRESHOLD) {
+        // The doorbell write may be delayed or lost, fall back to CQHEADi
+        Debug("DEBUG: CQ doorbell in host memory did not move, falling back to CQHEADi\n");
+      }
+      continue;
+    }
+    cq_cidb = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid));
     //fprintf(stderr, "Waiting for completion doorbell index update\n");
   }
+  poll_wait_end(policy, &poll_state, 0);
 
   Debug("DEBUG: after polling: sq_cidb = %d; Polling CQ CIDB = %d\n", sq_cidb, cq_cidb);
   return cq_cidb;
 
 timeout_action:
+  poll_wait_end(policy, &poll_state, 1);
   fprintf(stderr, "ERROR: poll_cq_cidb timeout! sq_cidb = %d; Polling CQ CIDB = %d\n", sq_cidb, cq_cidb);
   dump_registers(rdma_dev, 1, qpid);
   return -1;
 }
 
-int rdma_post_send(struct rdma_dev_t* rdma_dev, uint32_t qpid) {
+/* Number of outstanding WQEs completed by hardware according to the CQ head */
+static uint32_t rdma_sq_num_completed(struct rdma_qp_t* qp, int cq_head) {
+  uint32_t num_completed;
+  uint32_t num_outstanding;
+
+  num_completed   = (uint32_t) ((cq_head - qp->sq_cidb + (int) qp->qdepth) % (int) qp->qdepth);
+  num_outstanding = (qp->qdepth - 1) - qp->sq_credits;
+  if(num_completed > num_outstanding) {
+    num_completed = num_outstanding;
+  }
+  return num_completed;
+}
+
+/* Consume completed WQEs and return their slots to the SQ */
+static void rdma_sq_consume(struct rdma_qp_t* qp, uint32_t num_completed) {
+  qp->sq_cidb = (qp->sq_cidb + num_completed) % qp->qdepth;
+  qp->sq_credits += num_completed;
+}
+
+/* Copy WQEs from the staging ring to the SQ in the device memory, one DMA per 
+ * contiguous range of the ring */
+static int rdma_sq_stage_flush(struct rdma_qp_t* qp, uint32_t first_idx, uint32_t num_wqe) {
+  uint32_t num_to_end;
+  uint32_t i;
+  ssize_t rc;
+
+  for(i=0; i<2 && num_wqe>0; i++) {
+    num_to_end = qp->qdepth - first_idx;
+    if(num_to_end > num_wqe) {
+      num_to_end = num_wqe;
+    }
+    Debug("DEBUG: Write %d WQEs from SQ slot %d to the device memory\n", num_to_end, first_idx);
+    rc = write_from_buffer(device, fpga_fd, (char* ) &(qp->sq_stage[first_idx]), 
+                           num_to_end * sizeof(struct rdma_wqe_t), 
+                           qp->sq->dma_addr + (first_idx * sizeof(struct rdma_wqe_t)));
+    if(rc < 0) {
+      fprintf(stderr, "Error: Failed to write WQE to the device memory!\n");
+      return -1;
+    }
+    // The rest of WQEs wrap around to the head of the SQ ring
+    num_wqe  -= num_to_end;
+    first_idx = 0;
+  }
+
+  return 0;
+}
+
+uint32_t rdma_sq_wqe_idx(struct rdma_qp_t* qp, uint32_t offset) {
+  return (qp->sq_pidb + offset) % qp->qdepth;
+}
+
+int rdma_post_send_async(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint32_t num_wqe) {
   if(rdma_dev == NULL) {
-    fprintf(stderr, "Error: rdma_dev is NULL\n");  
-    exit(EXIT_FAILURE);
+    fprintf(stderr, "Error: rdma_dev is NULL\n");
+    return -1;
+  }
+
+  struct rdma_qp_t* qp = rdma_get_qp(rdma_dev, qpid);
+  if(qp == NULL) {
+    fprintf(stderr, "Error: qp %d is not allocated\n", qpid);
+    return -1;
+  }
+
+  if(num_wqe > qp->sq_credits) {
+    // Not enough free SQ slots, the caller has to harvest completions first
+    Debug("DEBUG: SQ of qp %d is full, num_wqe = %d, sq_credits = %d\n", qpid, num_wqe, qp->sq_credits);
+    return -EAGAIN;
   }
 
-  struct rdma_qp_t* qp = rdma_dev->qps_ptr[qpid];
+  if(qp->sq_stage != NULL) {
+    // WQEs must reach the device SQ before the doorbell
+    if(rdma_sq_stage_flush(qp, (uint32_t) qp->sq_pidb, num_wqe) < 0) {
+      return -1;
+    }
+  }
 
   // Increase send queue producer index doorbell
   Debug("DEBUG: Reading hardware SQPIi (0x%x) = 0x%x\n", get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid), read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid)));
   Debug("DEBUG: original qp->sq_pidb = 0x%x\n", qp->sq_pidb);
-  
-  qp->sq_pidb++;
+
+  qp->sq_pidb = (qp->sq_pidb + num_wqe) % qp->qdepth;
+  qp->sq_credits -= num_wqe;
+  // WQEs staged by doorbell coalescing are at the head of the published range
+  qp->sq_staged -= (num_wqe < qp->sq_staged) ? num_wqe : qp->sq_staged;
 
   // Update sq_pidb to hardware
   write32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid), qp->sq_pidb);
   Debug("[Register] RN_RDMA_QCSR_SQPIi=0x%x, qpid=%d, value=0x%x\n", get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid), qpid, qp->sq_pidb);
   Debug("DEBUG: Update hardware sq db idx from software = %d\n", qp->sq_pidb);
+
+  return 0;
+}
+
+int rdma_poll_cq(struct rdma_qp_t* qp, struct rdma_completion_t* completions, uint32_t max_completions) {
+  uint32_t* cqe_ring;
+  uint32_t cqe;
+  uint32_t cq_idx;
+  uint32_t num_cqe;
+  uint32_t num_to_end;
+  uint32_t num_fetched;
+  uint32_t i;
+  int cq_head;
+
+  if((qp == NULL) || (completions == NULL)) {
+    fprintf(stderr, "Error: qp or completions is NULL\n");
+    return -1;
+  }
+
+  if(rdma_sq_staged_expired(qp)) {
+    rdma_flush_doorbell(qp);
+  }
+
+  cq_head = rdma_read_cq_head(qp);
+  qp->cq_cidb = cq_head;
+
+  // sq_cidb tracks the completions already harvested by software
+  num_cqe = rdma_sq_num_completed(qp, cq_head);
+  if(num_cqe > max_completions) {
+    num_cqe = max_completions;
+  }
+  if(num_cqe == 0) {
+    return 0;
+  }
+
+  if(qp->cq_stage != NULL) {
+    // CQ is allocated at device memory, fetch the new CQEs only, one DMA per 
+    // contiguous range of the ring
+    cqe_ring = qp->cq_stage;
+    cq_idx = (uint32_t) qp->sq_cidb;
+    for(num_fetched = 0; num_fetched < num_cqe; num_fetched += num_to_end) {
+      num_to_end = qp->qdepth - cq_idx;
+      if(num_to_end > num_cqe - num_fetched) {
+        num_to_end = num_cqe - num_fetched;
+      }
+      if(read_to_buffer(device, fpga_fd, (char* ) &cqe_ring[cq_idx], num_to_end * CQE_SIZE, 
+                        qp->cq->dma_addr + (cq_idx * CQE_SIZE)) < 0) {
+        fprintf(stderr, "Error: Failed to read CQEs from the device memory!\n");
+        return -1;
+      }
+      cq_idx = 0;
+    }
+  } else {
+    // CQ is allocated at host memory
+    cqe_ring = (uint32_t* ) qp->cq->buffer;
+  }
+
+  for(i=0; i<num_cqe; i++) {
+    cq_idx = (uint32_t) (qp->sq_cidb + i) % qp->qdepth;
+    cqe = ((volatile uint32_t* ) cqe_ring)[cq_idx];
+    completions[i].qpid   = qp->qpid;
+    completions[i].wrid   = (uint16_t) (cqe & 0x0000ffff);
+    completions[i].opcode = (uint8_t) ((cqe >> 16) & 0x000000ff);
+    completions[i].status = (uint8_t) ((cqe >> 24) & 0x000000ff);
+    Debug("[CQE] qpid=%d, cq_idx=%d, cqe=0x%x\n", qp->qpid, cq_idx, cqe);
+  }
+  rdma_sq_consume(qp, num_cqe);
+
+  return (int) num_cqe;
+}
+
+int rdma_post_send(struct rdma_dev_t* rdma_dev, uint32_t qpid) {
+  if(rdma_dev == NULL) {
+    fprintf(stderr, "Error: rdma_dev is NULL\n");  
+    exit(EXIT_FAILURE);
+  }
+
+  struct rdma_qp_t* qp = rdma_get_qp(rdma_dev, qpid);
+  int rc;
+
+  if(qp == NULL) {
+    fprintf(stderr, "Error: qp %d is not allocated\n", qpid);
+    return -1;
+  }
+
+  if(qp->db_batch_threshold != 0) {
+    // With doorbell coalescing the WQEs are staged, or already published if the
+    // batch threshold was reached
+    rc = rdma_flush_doorbell(qp);
+  } else {
+    rc = rdma_post_send_async(rdma_dev, qpid, 1);
+  }
+  if(rc < 0) {
+    return rc;
+  }
   Debug("DEBUG: Reading hardware SQPIi (0x%x) = 0x%x\n", get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid), read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid)));
 
   // polling on completion, by checking CQ doorbell
   qp->cq_cidb = poll_cq_cidb(rdma_dev, qpid, qp->sq_cidb);
-  qp->sq_cidb++;
 
   if(qp->cq_cidb < 0) {
     return -1;
   } else {
+    rdma_sq_consume(qp, rdma_sq_num_completed(qp, qp->cq_cidb));
     return 0;
   }
 }
@@ -900,37 +2660,37 @@ int rdma_post_batch_send(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint32_t ba
     exit(EXIT_FAILURE);
   }
 
-  struct rdma_qp_t* qp = rdma_dev->qps_ptr[qpid];
-
-  // Increase send queue producer index doorbell
-  Debug("DEBUG: Reading hardware SQPIi (0x%x) = 0x%x\n", get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid), read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid)));
-  Debug("DEBUG: original qp->sq_pidb = 0x%x\n", qp->sq_pidb);
-  
-  qp->sq_pidb += batch_size;
+  struct rdma_qp_t* qp = rdma_get_qp(rdma_dev, qpid);
+  int rc;
 
-    if((qp->qdepth < batch_size) || ((qp->sq_pidb > qp->qdepth))) {
-    fprintf(stderr, "Error: SQ overflow\n");
-    exit(EXIT_FAILURE);
+  if(qp == NULL) {
+    fprintf(stderr, "Error: qp %d is not allocated\n", qpid);
+    return -1;
   }
 
-  // Update sq_pidb to hardware
-  write32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid), qp->sq_pidb);
-  Debug("[Register] RN_RDMA_QCSR_SQPIi=0x%x, qpid=%d, value=0x%x\n", get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid), qpid, qp->sq_pidb);
-  Debug("DEBUG: Update hardware sq db idx from software = %d\n", qp->sq_pidb);
+  if(qp->db_batch_threshold != 0) {
+    // With doorbell coalescing the WQEs are staged, or already published if the
+    // batch threshold was reached
+    rc = rdma_flush_doorbell(qp);
+  } else {
+    rc = rdma_post_send_async(rdma_dev, qpid, batch_size);
+  }
+  if(rc < 0) {
+    return rc;
+  }
   Debug("DEBUG: Reading hardware SQPIi (0x%x) = 0x%x\n", get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid), read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid)));
   Debug("[Register] RN_RDMA_QCSR_CQHEADi=0x%x, qpid=%d, value=0x%x\n", get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid), qpid, qp->cq_cidb);
   // polling on completion, by checking CQ doorbell
-  while(qp->cq_cidb < qp->sq_pidb) {
+  while(qp->sq_cidb != qp->sq_pidb) {
     // Wait for all WQE to be completed
     qp->cq_cidb = poll_cq_cidb(rdma_dev, qpid, qp->sq_cidb);
-    qp->sq_cidb = qp->cq_cidb;
+    if(qp->cq_cidb < 0) {
+      return -1;
+    }
+    rdma_sq_consume(qp, rdma_sq_num_completed(qp, qp->cq_cidb));
   }
 
-  if(qp->cq_cidb < 0) {
-    return -1;
-  } else {
-    return 0;
-  }
+  return 0;
 }
 
 void write_rq_cidb(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp, uint32_t db_val) {
@@ -959,15 +2719,15 @@ void* rdma_post_receive(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp) {
   int rq_pidb = poll_rq_pidb(rdma_dev, qp->qpid);
   if(rq_pidb == -1) {
     fprintf(stderr, "Error: rdma_post_receive failed\n");
-    exit(EXIT_FAILURE);
+    return NULL;
   }
 
   // Pointing to the RQE
   if(rq_pidb == 0) {
-    rqe = (void* ) ((uint64_t) qp->rq->buffer + (uint64_t) ((qp->qdepth - 1) * RQE_SIZE));
+    rqe = (void* ) ((uint64_t) qp->rq->buffer + (uint64_t) (qp->qdepth - 1) * qp->rqe_size);
   }
   else {
-    rqe = (void* ) ((uint64_t) qp->rq->buffer + (uint64_t) ((rq_pidb - 1) * RQE_SIZE));
+    rqe = (void* ) ((uint64_t) qp->rq->buffer + (uint64_t) (rq_pidb - 1) * qp->rqe_size);
   }
 
   return rqe;
@@ -978,7 +2738,7 @@ uint8_t rdma_release_rq_consumed (struct rdma_dev_t* rdma_dev, struct rdma_qp_t*
   uint8_t rc = 0;
 
   // Check whether all RQ requests are received
-  rq_pidb = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_STATRQPIDBi, qp->qpid));
+  rq_pidb = rdma_read_rq_pidb(qp);
 
   if (rq_pidb != qp->rq_pidb) {
     // We still have RQ requests pending.
@@ -992,6 +2752,99 @@ uint8_t rdma_release_rq_consumed (struct rdma_dev_t* rdma_dev, struct rdma_qp_t*
   return rc;
 }
 
+int rdma_poll_recv(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp, struct rdma_recv_desc_t* descs, uint32_t max_desc) {
+  uint32_t num_avail;
+  uint32_t i;
+  uint32_t idx;
+  int rq_pidb;
+
+  if((rdma_dev == NULL) || (qp == NULL) || (descs == NULL)) {
+    fprintf(stderr, "Error: rdma_dev, qp or descs is NULL\n");
+    return -1;
+  }
+
+  rq_pidb = rdma_read_rq_pidb(qp);
+  qp->rq_pidb = rq_pidb;
+  num_avail = ((uint32_t) rq_pidb + qp->qdepth - qp->rq_recv_idx) % qp->qdepth;
+  if(num_avail > max_desc) {
+    num_avail = max_desc;
+  }
+
+  for(i=0; i<num_avail; i++) {
+    idx = (qp->rq_recv_idx + i) % qp->qdepth;
+    descs[i].qpid     = qp->qpid;
+    descs[i].rq_idx   = idx;
+    descs[i].rqe_addr = qp->rq->dma_addr + (uint64_t) idx * qp->rqe_size;
+    descs[i].rqe      = is_device_address(qp->rq->dma_addr) ? NULL : (void* ) ((uint64_t) qp->rq->buffer + (uint64_t) idx * qp->rqe_size);
+  }
+  qp->rq_recv_idx = (qp->rq_recv_idx + num_avail) % qp->qdepth;
+
+  Debug("DEBUG: qp %d received %d RQEs, RQ PIDB = %d\n", qp->qpid, num_avail, rq_pidb);
+  return (int) num_avail;
+}
+
+int rdma_wait_recv(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp, struct rdma_recv_desc_t* descs, uint32_t max_desc) {
+  struct poll_policy_t* policy;
+  struct poll_state_t poll_state;
+  int num_desc;
+
+  if(max_desc == 0) {
+    return 0;
+  }
+
+  num_desc = rdma_poll_recv(rdma_dev, qp, descs, max_desc);
+  if(num_desc != 0) {
+    return num_desc;
+  }
+
+  policy = rdma_qp_poll_policy(rdma_dev, qp);
+  poll_wait_begin(&poll_state);
+  poll_wait_set_arm(&poll_state, rdma_arm_rq_intr, qp);
+  while((num_desc = rdma_poll_recv(rdma_dev, qp, descs, max_desc)) == 0) {
+    if(poll_wait_step(policy, &poll_state) != 0) {
+      poll_wait_end(policy, &poll_state, 1);
+      return 0;
+    }
+  }
+  poll_wait_end(policy, &poll_state, 0);
+
+  return num_desc;
+}
+
+int rdma_release_recv(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp, struct rdma_recv_desc_t* descs, uint32_t num_desc) {
+  uint32_t rq_cidb;
+  uint32_t num_freed = 0;
+  uint32_t i;
+
+  if((rdma_dev == NULL) || (qp == NULL) || (descs == NULL)) {
+    fprintf(stderr, "Error: rdma_dev, qp or descs is NULL\n");
+    return -1;
+  }
+
+  for(i=0; i<num_desc; i++) {
+    if((descs[i].qpid != qp->qpid) || (descs[i].rq_idx >= qp->qdepth)) {
+      fprintf(stderr, "Error: descriptor %d does not belong to qp %d\n", i, qp->qpid);
+      return -1;
+    }
+    qp->rq_released[descs[i].rq_idx] = 1;
+  }
+
+  // Move the consumer index over the contiguous released RQEs
+  rq_cidb = (uint32_t) qp->rq_cidb;
+  while((rq_cidb != qp->rq_recv_idx) && qp->rq_released[rq_cidb]) {
+    qp->rq_released[rq_cidb] = 0;
+    rq_cidb = (rq_cidb + 1) % qp->qdepth;
+    num_freed++;
+  }
+
+  if(num_freed != 0) {
+    write_rq_cidb(rdma_dev, qp, rq_cidb);
+    Debug("[Register] RN_RDMA_QCSR_RQCIi=0x%x, qpid=%d, value=0x%x\n", get_rdma_per_q_config_addr(RN_RDMA_QCSR_RQCIi, qp->qpid), qp->qpid, rq_cidb);
+  }
+
+  return (int) num_freed;
+}
+
 void rdma_qp_fatal_recovery(struct rdma_dev_t* rdma_dev, uint32_t qpid) {
   fprintf(stderr, "\n\n***** QP%d FATAL RECOVERY *****\n", qpid);
   // Steps to clear traffic on QP:
@@ -1101,11 +2954,16 @@ int destroy_rdma_qp(struct rdma_qp_t* qp) {
                             get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qp->qpid), qp->qpid, test);
   
     // Free memory allocated for SQ, RQ and CQ
-    free(qp->sq);
-    free(qp->rq); 
-    free(qp->cq);
-    
-    destroy_rdma_pd_entry(qp->pd_entry);
+    free(qp->sq_stage);
+    free(qp->cq_stage);
+    free(qp->rq_released);
+    free_rdma_buffer(qp->rdma_dev->rn_dev, qp->sq);
+    free_rdma_buffer(qp->rdma_dev->rn_dev, qp->rq);
+    free_rdma_buffer(qp->rdma_dev->rn_dev, qp->cq);
+
+    // The protection domain can be shared by other QPs and is freed by its owner
+    rdma_set_qp(qp->rdma_dev, qp->qpid, NULL);
+    free(qp);
     qp = NULL;
   }
 
@@ -1113,14 +2971,25 @@ int destroy_rdma_qp(struct rdma_qp_t* qp) {
 }
 
 int destroy_rdma_dev(struct rdma_dev_t* rdma_dev) {
-  int i;
+  uint32_t i;
+  uint32_t j;
   uint32_t rnic_enable;
   uint32_t rnic_config;
   if(rdma_dev != NULL) {
     free(rdma_dev->glb_csr);
-    for(i=0; i<rdma_dev->num_qp; i++) {
-      destroy_rdma_qp(rdma_dev->qps_ptr[i]);
+    if(debug) {
+      dump_rdma_qp_footprint(rdma_dev);
+    }
+    for(i=0; i<rdma_dev->num_qp_chunks; i++) {
+      if(rdma_dev->qp_table[i] != NULL) {
+        for(j=0; j<(1 << RDMA_QP_TABLE_CHUNK_SHIFT); j++) {
+          destroy_rdma_qp(rdma_dev->qp_table[i][j]);
+        }
+        free(rdma_dev->qp_table[i]);
+      }
     }
+    free(rdma_dev->qp_table);
+    rdma_mr_cache_destroy(rdma_dev);
 
     // Disable RNIC hardware
     rnic_enable = 0;
@@ -1133,9 +3002,26 @@ int destroy_rdma_dev(struct rdma_dev_t* rdma_dev) {
 }
 
 int destroy_rn_dev(struct rn_dev_t* rn_dev) {
+  struct rdma_buff_reg_t* reg;
+
   if(rn_dev != NULL) {
-    free(rn_dev->base_buf);
     destroy_rdma_dev((struct rdma_dev_t* ) rn_dev->rdma_dev);
+    // Drop the records of buffers still registered, their memory belongs to the application
+    while(rn_dev->buff_regs != NULL) {
+      reg = rn_dev->buff_regs;
+      rn_dev->buff_regs = reg->next;
+      free(reg);
+    }
+    if(debug) {
+      dump_host_mem_stats(rn_dev);
+      dump_dev_mem_stats(rn_dev);
+    }
+    destroy_rdma_buffer_pool(rn_dev);
+    if((rn_dev->base_buf != NULL) && (rn_dev->base_buf->buffer != NULL)) {
+      munmap(rn_dev->base_buf->buffer, (uint64_t) rn_dev->hugepage_config.max_hugepages << rn_dev->hugepage_shift);
+    }
+    free(rn_dev->base_buf);
+    free(rn_dev->hugepage_paddr);
     rn_dev = NULL;
   }
 
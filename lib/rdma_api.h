@@ -16,14 +16,117 @@
 #include "reconic_reg.h"
 #include "control_api.h"
 
+/*! \def RDMA_RQE_UNIT
+    \brief Granularity in bytes of an RQ entry. QPCONFi[31:16] holds the RQE size in this unit.
+*/
+#define RDMA_RQE_UNIT 256
+
+/*! \def RDMA_RQE_MAX_SIZE
+    \brief Largest RQ entry size class in bytes.
+*/
+#define RDMA_RQE_MAX_SIZE (1 << 23)
+
 /*! \def RQE_SIZE
-    \brief Number of an RQ entry.
+    \brief Default size in bytes of an RQ entry, used by allocate_rdma_qp().
 
-    Size RQ entry is aligned with 256B. Setting RQE_SIZE 512 indicates each RQE entry has 
-    512*256 = 128KB
+    An RQE holds the payload of one incoming SEND. The default keeps the 512-byte RQE 
+    spacing the library has always used, so the RQ of a QP of depth 64 stays at 32KB. 
+    QPs receiving larger SENDs, e.g. up to a 4KB path MTU, use allocate_rdma_qp_rqe() 
+    with a size from get_rdma_rqe_size_class().
 */
 #define RQE_SIZE 512
 
+/*! \def CQE_SIZE
+    \brief Size of a CQ entry in bytes.
+
+    Each CQE is 32-bit wide. The format is [31:24] error status (0 - success);
+                                           [23:16] opcode of the completed WQE;
+                                           [15 : 0] WRID of the completed WQE.
+*/
+#define CQE_SIZE 4
+
+/*! \def RDMA_GLB_OUTSTANDING_OPS
+    \brief Default number of outstanding packets per QP used to size the ERNIC global buffers.
+*/
+#define RDMA_GLB_OUTSTANDING_OPS 16
+
+/*! \def RDMA_GLB_MIN_DATA_BUF
+    \brief Minimum number of ERNIC data buffers.
+*/
+#define RDMA_GLB_MIN_DATA_BUF 64
+
+/*! \def RDMA_GLB_MAX_ENTRIES
+    \brief Maximum number of entries of an ERNIC global buffer, limited by 16-bit size fields.
+*/
+#define RDMA_GLB_MAX_ENTRIES 0xffff
+
+/*! \def RDMA_IPKT_ERR_STAT_ENTRY_SIZE
+    \brief Size in bytes of an incoming packet error status queue entry.
+
+    The format is [63:32] reserved; [31:16] QP ID; [15:0] fatal code.
+*/
+#define RDMA_IPKT_ERR_STAT_ENTRY_SIZE 8
+
+/*! \def RDMA_ERR_BUF_ENTRY_SIZE
+    \brief Size in bytes of an error buffer. Packets that fail validation are written
+    to an error buffer along with 4 bytes of error syndrome.
+*/
+#define RDMA_ERR_BUF_ENTRY_SIZE 256
+
+/*! \def RDMA_ERR_BUF_PER_QP
+    \brief Number of error buffers per QP.
+*/
+#define RDMA_ERR_BUF_PER_QP 4
+
+/*! \def RDMA_RESP_ERR_PKT_ENTRY_SIZE
+    \brief Size in bytes of the response error buffer per outstanding packet.
+
+    The examples used to give a 64KB response error buffer to 256 QPs with up to 16 
+    outstanding packets each, i.e. 64KB / 4096 = 16 bytes per outstanding packet. The 
+    same ratio is kept when the buffer is sized from the QP count, with a 4KB minimum.
+*/
+#define RDMA_RESP_ERR_PKT_ENTRY_SIZE 16
+
+/*! \def RDMA_LARGE_CHUNK_SIZE
+    \brief Default size in bytes of the WQEs a large transfer is split into.
+*/
+#define RDMA_LARGE_CHUNK_SIZE (1 << 20)
+
+/*! \def CQ_SHADOW_POLL_THRESHOLD
+    \brief Number of host-memory CQ doorbell reads before falling back to MMIO polling.
+*/
+#define CQ_SHADOW_POLL_THRESHOLD 1000000
+
+/*! \def RQ_SHADOW_POLL_THRESHOLD
+    \brief Number of host-memory RQ doorbell reads between two STATRQPIDBi reads.
+*/
+#define RQ_SHADOW_POLL_THRESHOLD 1000000
+
+/*! \def RDMA_INLINE_MAX_SIZE
+    \brief Largest SEND payload in bytes carried inline in send_small_payload0..3.
+*/
+#define RDMA_INLINE_MAX_SIZE 16
+
+/*! \def RDMA_QP_SET_WORDS
+    \brief Number of 32-bit words of a QP set, one per CQINTSTS/RQINTSTS register.
+*/
+#define RDMA_QP_SET_WORDS 8
+
+/*! \def RDMA_QP_TABLE_CHUNK_SHIFT
+    \brief log2 of the number of QPs in a chunk of the QP table of an RDMA device.
+*/
+#define RDMA_QP_TABLE_CHUNK_SHIFT 4
+
+/*! \def RDMA_EVENT_CQ
+    \brief Event flag: a QP has new completions.
+*/
+#define RDMA_EVENT_CQ BIT(0)
+
+/*! \def RDMA_EVENT_RQ
+    \brief Event flag: a QP has new receives.
+*/
+#define RDMA_EVENT_RQ BIT(1)
+
 /*! \struct rdma_glb_csr_t
     \brief Structure used to store RDMA global control status registers.
 */
@@ -56,16 +159,43 @@ struct rdma_glb_csr_t {
   uint32_t xrnic_advanced_conf; /*!< xrnic_advanced_conf ERNIC advanced global configuration. */
 };
 
+/*! \struct rdma_glb_buf_t
+    \brief ERNIC global buffers sized by get_rdma_glb_buf_sizes().
+*/
+struct rdma_glb_buf_t {
+  uint32_t num_qp;                /*!< num_qp Number of QPs the buffers are sized for. */
+  uint32_t outstanding_ops;       /*!< outstanding_ops Outstanding packets per QP. */
+  uint32_t mtu;                   /*!< mtu Path MTU in bytes. */
+  uint16_t num_data_buf;          /*!< num_data_buf Number of data buffers, num_qp * outstanding_ops. */
+  uint16_t per_data_buf_size;     /*!< per_data_buf_size Size of each data buffer, the MTU. */
+  uint16_t ipkt_err_stat_q_size;  /*!< ipkt_err_stat_q_size Number of incoming packet error status entries. */
+  uint16_t num_err_buf;           /*!< num_err_buf Number of error buffers. */
+  uint16_t per_err_buf_size;      /*!< per_err_buf_size Size of each error buffer. */
+  uint64_t resp_err_pkt_buf_size; /*!< resp_err_pkt_buf_size Size of the response error packet buffer. */
+  struct rdma_buff_t* data_buf;         /*!< data_buf data buffer. */
+  struct rdma_buff_t* ipkterr_buf;      /*!< ipkterr_buf incoming packet error status queue. */
+  struct rdma_buff_t* err_buf;          /*!< err_buf error buffer. */
+  struct rdma_buff_t* resp_err_pkt_buf; /*!< resp_err_pkt_buf response error packet buffer. */
+};
+
 /*! \struct rdma_dev_t
     \brief RDMA device structure.
 */
 struct rdma_dev_t {
   struct rn_dev_t* rn_dev; /*!< rn_dev a pointer to the RecoNIC device. */
   struct rdma_glb_csr_t* glb_csr; /*!< glb_csr a pointer to RDMA global control status register structure. */
-  struct rdma_qp_t** qps_ptr; /*!< qps_ptr a pointer to RDMA queue pairs. */
+  struct rdma_qp_t*** qp_table; /*!< qp_table RDMA queue pairs indexed by QP ID. Chunks of 
+                                     1 << RDMA_QP_TABLE_CHUNK_SHIFT QPs are allocated when 
+                                     their first QP is allocated. */
+  uint32_t num_qp_chunks; /*!< num_qp_chunks Number of chunks of qp_table. */
+  uint32_t num_qp_allocated; /*!< num_qp_allocated Number of QPs allocated. */
   uint32_t* axil_ctl; /*!< axil_ctl a pointer to PCIe register control interface. */
   uint32_t num_qp;    /*!< num_qp number of queue pair enabled. */
   struct win_size_t* winSize;    /*!< Window size mask for PCIe BDF address conversion. */
+  struct poll_policy_t poll_policy; /*!< poll_policy polling policy of QPs without their own
+                                         policy. Busy-spin with POLL_DEFAULT_DEADLINE_NS by default. */
+  struct rdma_mr_cache_t* mr_cache; /*!< mr_cache memory region registration cache, NULL if
+                                         not created. */
 };
 
 /*! \struct rdma_pd_t
@@ -90,6 +220,56 @@ struct rdma_pd_t {
   struct rdma_buff_t* mr_buffer; /*!< mr_buffer a pointer to the allocated buffer. */
 };
 
+/*! \struct rdma_mr_t
+    \brief Memory region registered through the MR cache.
+*/
+struct rdma_mr_t {
+  struct rdma_pd_t pd;    /*!< pd protection domain entry of the memory region. */
+  struct rdma_buff_t buf; /*!< buf copy of the registered buffer. */
+  uint64_t vaddr;         /*!< vaddr virtual start address of the memory region. */
+  uint64_t length;        /*!< length size of the memory region. */
+  uint32_t refcnt;        /*!< refcnt Number of users of the memory region. */
+  uint64_t last_use;      /*!< last_use cache tick of the last lookup, used for LRU eviction. */
+  uint8_t  in_use;        /*!< in_use 1 if the PD slot is allocated. */
+  uint8_t  indexed;       /*!< indexed 1 if the memory region is in the address index. */
+  uint8_t  r_key_owned;   /*!< r_key_owned 1 if the r_key was taken from the r_key free list. */
+  struct rdma_mr_t* left;  /*!< left memory regions of the address index starting before this one. */
+  struct rdma_mr_t* right; /*!< right memory regions of the address index starting after this one. */
+  uint64_t max_end;       /*!< max_end largest end address in the subtree of the address index. */
+  uint32_t height;        /*!< height height of the subtree of the address index. */
+};
+
+/*! \def RDMA_NUM_R_KEY
+    \brief Number of 8-bit r_key values, r_key 0 is never allocated.
+*/
+#define RDMA_NUM_R_KEY 256
+
+/*! \def RDMA_R_KEY_AUTO
+    \brief r_key argument asking the PD/MR manager to allocate the r_key.
+*/
+#define RDMA_R_KEY_AUTO 0xffffffff
+
+/*! \struct rdma_mr_cache_t
+    \brief PD/MR manager and memory region registration cache over a range of PD table
+           entries.
+*/
+struct rdma_mr_cache_t {
+  uint32_t first_pd_num;    /*!< first_pd_num first PD number managed by the cache. */
+  uint32_t num_pd;          /*!< num_pd Number of PD table entries managed by the cache. */
+  struct rdma_mr_t* slots;  /*!< slots one memory region per PD table entry. */
+  uint32_t* pd_free;        /*!< pd_free free list (stack) of slot indexes. */
+  uint32_t num_pd_free;     /*!< num_pd_free Number of entries in pd_free. */
+  uint32_t r_key_free[RDMA_NUM_R_KEY]; /*!< r_key_free free list (stack) of r_keys. */
+  uint32_t num_r_key_free;  /*!< num_r_key_free Number of entries in r_key_free. */
+  struct rdma_mr_t* root;   /*!< root address index, an AVL tree of the registered memory
+                                 regions ordered by start address. */
+  uint32_t num_mr;          /*!< num_mr Number of registered memory regions. */
+  uint64_t tick;            /*!< tick lookup counter used as LRU clock. */
+  uint64_t hits;            /*!< hits Number of lookups served by a registered region. */
+  uint64_t misses;          /*!< misses Number of lookups that registered a region. */
+  uint64_t evictions;       /*!< evictions Number of regions evicted to free a PD entry. */
+};
+
 /*! \struct rdma_qp_t
     \brief RDMA queue pair structure.
 */
@@ -98,25 +278,68 @@ struct rdma_qp_t {
   uint32_t qpid;               /*!< qpid A queue pair ID. */
   struct rdma_buff_t* sq; /*!< sq a pointer to a send queue buffer. */
   uint32_t sq_psn;        /*!< sq_psn Packet sequence number for a sq request. */
-  int sq_pidb;            /*!< sq_pidb SQ producer index doorbell. */
-  int sq_cidb;            /*!< sq_cidb SQ consumer index doorbell. */
+  int sq_pidb;            /*!< sq_pidb SQ producer index doorbell, wraps around qdepth. */
+  int sq_cidb;            /*!< sq_cidb SQ consumer index doorbell, wraps around qdepth. */
+  struct rdma_wqe_t* sq_stage; /*!< sq_stage Host-side staging ring of an SQ allocated at
+                                    device memory. WQEs are built here and copied to the
+                                    device SQ in bulk when published. NULL for an SQ
+                                    allocated at host memory. */
+  uint32_t sq_credits;    /*!< sq_credits Number of free SQ slots. At most qdepth-1 WQEs
+                               can be outstanding, so that a full SQ is distinguishable
+                               from an empty one. */
 
   struct rdma_buff_t* cq; /*!< cq a pointer to a completion queue buffer. */
   uint64_t cq_cidb_addr;  /*!< cq_cidb_addr completion queue consumer index doorbell address. */
   int cq_cidb;            /*!< cq_cidb completion queue consumer index doorbell. */
+  uint32_t* cq_stage;     /*!< cq_stage Host-side copy of a CQ allocated at device memory.
+                               rdma_poll_cq() fetches only the new CQEs into it. NULL for a
+                               CQ allocated at host memory. */
+  volatile uint32_t* cq_db_shadow; /*!< cq_db_shadow virtual address of the CQ doorbell written 
+                                        by hardware at cq_cidb_addr. NULL if completions are
+                                        polled through CQHEADi. */
 
   // Receive queue and its doorbell
   struct rdma_buff_t* rq; /*!< rq a pointer to a receive queue buffer. */
   uint64_t rq_cidb_addr;  /*!< rq_cidb_addr receive queue consumer index doorbell address. */
   int rq_cidb;            /*!< rq_cidb receive queue consumer index doorbell. */
   int rq_pidb;            /*!< rq_cidb receive queue producer index doorbell. */
+  volatile uint32_t* rq_db_shadow; /*!< rq_db_shadow virtual address of the RQ write pointer
+                                        doorbell written by hardware at rq_cidb_addr. NULL if
+                                        receives are polled through STATRQPIDBi. */
+  uint32_t rq_recv_idx;   /*!< rq_recv_idx index of the next RQE returned by rdma_poll_recv(). */
+  uint8_t* rq_released;   /*!< rq_released per-RQE flags of RQEs released by the application
+                               but not yet returned to hardware through RQCIi. */
   uint32_t pd_num;        /*!< pd_num protection domain number associated. */
   struct rdma_pd_t* pd_entry; /*!< pd_entry protection domain entry associated. */
   uint32_t dst_qpid; /*!< dst_qpid destination queue pair ID. */
   uint32_t qdepth;   /*!< qdepth Queue pair depth. */
+  uint32_t rqe_size; /*!< rqe_size Size of an RQ entry in bytes, a multiple of RDMA_RQE_UNIT. */
   uint32_t last_rq_psn; /*!< last_rq_psn Last RQ request PSN associated. */
   struct mac_addr_t* dst_mac; /*!< dst_mac destination MAC address. */
   uint32_t dst_ip; /*!< dst_ip destination IP address. */
+
+  // Doorbell coalescing
+  uint32_t db_batch_threshold;  /*!< db_batch_threshold Number of staged WQEs that triggers
+                                     an SQPIi doorbell. 0 disables doorbell coalescing. */
+  uint64_t db_time_budget_ns;   /*!< db_time_budget_ns Maximum time in ns a staged WQE waits
+                                     for its doorbell. 0 means no time budget. */
+  uint32_t sq_staged;           /*!< sq_staged Number of WQEs staged but not published yet. */
+  struct timespec sq_staged_ts; /*!< sq_staged_ts Time when the oldest staged WQE was created. */
+  uint64_t db_writes_saved;     /*!< db_writes_saved Number of SQPIi MMIO writes saved by
+                                     doorbell coalescing. */
+
+  struct poll_policy_t* poll_policy; /*!< poll_policy polling policy of the QP. NULL uses the
+                                          polling policy of the RDMA device. */
+};
+
+/*! \struct rdma_qp_ring_layout_t
+    \brief Sizes of the rings of a QP.
+*/
+struct rdma_qp_ring_layout_t {
+  uint64_t rq_size;    /*!< rq_size size of the RQ, qdepth * rqe_size. */
+  uint64_t sq_size;    /*!< sq_size size of the SQ, qdepth * 64. */
+  uint64_t cq_size;    /*!< cq_size size of the CQ, qdepth * CQE_SIZE. */
+  uint64_t total_size; /*!< total_size sum of the ring sizes. */
 };
 
 /*! \struct rdma_wqe_t
@@ -144,12 +367,81 @@ struct rdma_wqe_t {
 
 };
 
+/*! \struct rdma_wqe_desc_t
+    \brief Descriptor of an RDMA operation used to build WQEs in batch.
+*/
+struct rdma_wqe_desc_t {
+  struct rdma_buff_t* local_buf; /*!< local_buf local payload buffer. */
+  uint64_t local_offset;         /*!< local_offset payload offset within local_buf. If local_buf
+                                      is NULL, the host physical or device address of the 
+                                      payload, which is masked like a translated address. */
+  uint32_t length;               /*!< length payload size for the transfer. */
+  uint32_t opcode;               /*!< opcode 8-bit WQE opcode. */
+  uint64_t remote_offset;        /*!< remote_offset remote memory address offset. */
+  uint32_t r_key;                /*!< r_key RDMA security key. */
+  uint16_t wrid;                 /*!< wrid work request ID. */
+  uint32_t send_small_payload[4]; /*!< send_small_payload small payload for RDMA send. Filled
+                                       from local_buf for SENDs of up to RDMA_INLINE_MAX_SIZE
+                                       bytes in host memory. */
+  uint32_t immdt_data;           /*!< immdt_data immediate payload for RDMA packets. */
+};
+
+/*! \struct rdma_qp_set_t
+    \brief A set of queue pairs waited on by rdma_wait_any().
+
+    Bit b of bitmap[w] represents QP (w*32 + b + 1), following the bit order of the 
+    CQINTSTS1..8 and RQINTSTS1..8 registers.
+*/
+struct rdma_qp_set_t {
+  uint32_t bitmap[RDMA_QP_SET_WORDS]; /*!< bitmap bitmap of QP IDs in the set. */
+};
+
+/*! \struct rdma_qp_event_t
+    \brief Event reported by rdma_wait_any().
+*/
+struct rdma_qp_event_t {
+  uint32_t qpid;   /*!< qpid QP ID with new events. */
+  uint32_t events; /*!< events RDMA_EVENT_CQ and/or RDMA_EVENT_RQ. */
+};
+
+/*! \struct rdma_completion_t
+    \brief Work completion decoded from a CQ entry.
+*/
+struct rdma_completion_t {
+  uint32_t qpid;   /*!< qpid QP ID of the completed work request. */
+  uint16_t wrid;   /*!< wrid work request ID of the completed WQE. */
+  uint8_t  opcode; /*!< opcode opcode of the completed WQE. */
+  uint8_t  status; /*!< status completion status, 0 means success. */
+};
+
+/*! \struct rdma_recv_desc_t
+    \brief Descriptor of a received RQ entry, processed in place by the application.
+
+    ERNIC only writes the payload of an incoming SEND to the RQE and moves STATRQPIDBi.
+    The received length, opcode and immediate data are not reported per RQE, so an
+    application needing them has to carry them in its payload. The RQE holds up to
+    rqe_size bytes.
+*/
+struct rdma_recv_desc_t {
+  uint32_t qpid;     /*!< qpid QP ID of the receive queue. */
+  uint32_t rq_idx;   /*!< rq_idx index of the RQE in the receive queue. */
+  void*    rqe;      /*!< rqe virtual address of the RQE. NULL if the RQ is in device memory. */
+  uint64_t rqe_addr; /*!< rqe_addr physical address of the RQE. */
+};
+
 /** @brief Create an RDMA device.
  *  @param rn_dev A pointer to the RecoNIC device.
  *  @return a pointer to the RDMA deivce created.
  */
 struct rdma_dev_t* create_rdma_dev(struct rn_dev_t* rn_dev);
 
+/** @brief Get an RDMA queue pair by its QP ID.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param qpid A QP ID, from 1 to the number of QPs of the device.
+ *  @return a pointer to the queue pair, or NULL if it is not allocated.
+ */
+struct rdma_qp_t* rdma_get_qp(struct rdma_dev_t* rdma_dev, uint32_t qpid);
+
 /** @brief Configure an RDMA device.
  *  @param rdma_dev a pointer to the RDMA deivce created.
  *  @param local_mac local MAC address.
@@ -180,6 +472,55 @@ void open_rdma_dev(struct rdma_dev_t* rdma_dev, struct mac_addr_t local_mac, uin
                    uint16_t per_err_buf_size, uint64_t err_buf_baseaddr, 
                    uint64_t resp_err_pkt_buf_size, uint64_t resp_err_pkt_buf_baseaddr);
 
+/** @brief Size the ERNIC global buffers.
+ *
+ *  The data buffers hold outgoing data until it is acknowledged, so one buffer of 
+ *  mtu bytes is reserved per outstanding packet of every QP. The incoming packet 
+ *  error status queue and the response error packet buffer scale with the number of 
+ *  outstanding packets, and the error buffers with the number of QPs. Entry counts 
+ *  are limited to RDMA_GLB_MAX_ENTRIES.
+ *  @param num_qp Number of QPs.
+ *  @param outstanding_ops Number of outstanding packets per QP.
+ *  @param mtu Path MTU in bytes: 256, 512, 1024, 2048 or 4096.
+ *  @param glb_buf Returns the sizes. Buffer pointers are set to NULL.
+ *  @return Success (0) or Failure (-1) on invalid parameters.
+ */
+int get_rdma_glb_buf_sizes(uint32_t num_qp, uint32_t outstanding_ops, uint32_t mtu, struct rdma_glb_buf_t* glb_buf);
+
+/** @brief Allocate the ERNIC global buffers sized for an RDMA device.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param outstanding_ops Number of outstanding packets per QP, 0 uses RDMA_GLB_OUTSTANDING_OPS.
+ *  @param mtu Path MTU in bytes.
+ *  @param buf_location Location to allocate the buffers: "host_mem" or "dev_mem".
+ *  @return A pointer to the allocated buffers, or NULL on failure.
+ */
+struct rdma_glb_buf_t* allocate_rdma_glb_buf(struct rdma_dev_t* rdma_dev, uint32_t outstanding_ops, 
+                                             uint32_t mtu, char* buf_location);
+
+/** @brief Configure an RDMA device with ERNIC global buffers from allocate_rdma_glb_buf().
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param local_mac local MAC address.
+ *  @param local_ip local IP address.
+ *  @param udp_sport UDP source port.
+ *  @param glb_buf A pointer to the ERNIC global buffers.
+ *  @return void.
+ */
+void open_rdma_dev_glb_buf(struct rdma_dev_t* rdma_dev, struct mac_addr_t local_mac, uint32_t local_ip, 
+                           uint32_t udp_sport, struct rdma_glb_buf_t* glb_buf);
+
+/** @brief Print the sizes and location of the ERNIC global buffers.
+ *  @param glb_buf A pointer to the ERNIC global buffers.
+ *  @return Total number of bytes of the ERNIC global buffers.
+ */
+uint64_t dump_rdma_glb_buf_footprint(struct rdma_glb_buf_t* glb_buf);
+
+/** @brief Free the ERNIC global buffers.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param glb_buf A pointer to the ERNIC global buffers.
+ *  @return void.
+ */
+void free_rdma_glb_buf(struct rdma_dev_t* rdma_dev, struct rdma_glb_buf_t* glb_buf);
+
 /** @brief Configure RDMA global control status registers.
  *  @param rdma_dev A pointer to the RDMA device.
  *  @return void.
@@ -194,15 +535,114 @@ void config_rdma_global_csr (struct rdma_dev_t* rdma_dev);
 struct rdma_pd_t* allocate_rdma_pd(struct rdma_dev_t* rdma_dev, uint32_t pd_num);
 
 /** @brief Register a memory region in the RDMA engine.
+ *
+ *  With a PD/MR manager, the r_key is removed from its r_key free list, and a PD from
+ *  rdma_alloc_pd() is added to the address index searched by rdma_mr_lookup().
  *  @param rdma_dev A pointer to the RDMA device.
  *  @param rdma_pd A pointer to the RDMA protection domain entry.
- *  @param r_key RDMA security key or remote tag.
+ *  @param r_key RDMA security key or remote tag, or RDMA_R_KEY_AUTO to take one from
+ *               the r_key free list of the PD/MR manager. The r_key is in rdma_pd->r_key.
  *  @param rdma_buf the RDMA buffer to be registered.
  *  @return void.
  */
 void rdma_register_memory_region(struct rdma_dev_t* rdma_dev, struct rdma_pd_t* rdma_pd, 
                                  uint32_t r_key, struct rdma_buff_t* rdma_buf);
 
+/** @brief Create the memory region registration cache of an RDMA device.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param first_pd_num first PD number managed by the cache.
+ *  @param num_pd Number of PD table entries managed by the cache.
+ *  @return Success (0) or Failure (-1).
+ */
+int rdma_mr_cache_create(struct rdma_dev_t* rdma_dev, uint32_t first_pd_num, uint32_t num_pd);
+
+/** @brief Get a registered memory region covering a buffer.
+ *
+ *  If a registered region covers the whole buffer, it is returned with its existing 
+ *  PD and r_key, without touching the PD table. Otherwise the buffer is registered in a
+ *  free PD entry, or in the entry of the least recently used region with no reference.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param rdma_buf the RDMA buffer to be registered.
+ *  @param r_key RDMA security key used if the buffer has to be registered, or
+ *               RDMA_R_KEY_AUTO to take one from the r_key free list.
+ *  @return a pointer to the memory region, or NULL if every PD entry is referenced or
+ *          no r_key is left.
+ */
+struct rdma_mr_t* rdma_mr_cache_get(struct rdma_dev_t* rdma_dev, struct rdma_buff_t* rdma_buf, uint32_t r_key);
+
+/** @brief Release a reference on a memory region returned by rdma_mr_cache_get().
+ *
+ *  The region stays registered and can be returned again until it is evicted or its 
+ *  buffer is released, see rdma_mr_cache_invalidate().
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param mr a pointer to the memory region.
+ *  @return void.
+ */
+void rdma_mr_cache_put(struct rdma_dev_t* rdma_dev, struct rdma_mr_t* mr);
+
+/** @brief Register many buffers with one pass over the PD table registers.
+ *
+ *  Buffers covered by a registered region are served from the cache. The others get a
+ *  PD entry and an r_key from the free lists. Their PD table entries are then written in
+ *  PD number order.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param rdma_bufs an array of RDMA buffers to be registered.
+ *  @param num_buf Number of buffers.
+ *  @param mrs an array receiving the memory region of each buffer.
+ *  @return Number of buffers registered. Registration stops at the first buffer that
+ *          can not get a PD entry or an r_key.
+ */
+int rdma_mr_register_bulk(struct rdma_dev_t* rdma_dev, struct rdma_buff_t* rdma_bufs, uint32_t num_buf, struct rdma_mr_t** mrs);
+
+/** @brief Find the registered memory region covering an address range, e.g. to get the
+ *         r_key and physical address of a payload before posting.
+ *
+ *  The address index is an AVL tree ordered by start address, where each node keeps the
+ *  largest end address of its subtree. The lookup follows one path from the root, in 
+ *  O(log n) for n registered regions. It does not take a reference.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param vaddr virtual start address of the range.
+ *  @param length size of the range.
+ *  @return a pointer to the memory region or NULL if no registered region covers the range.
+ */
+struct rdma_mr_t* rdma_mr_lookup(struct rdma_dev_t* rdma_dev, void* vaddr, uint64_t length);
+
+/** @brief Remove the memory regions overlapping an address range from the address index.
+ *
+ *  Called by free_rdma_buffer(), deregister_rdma_buffer() and realloc_rdma_buffer() when a
+ *  buffer is released or moved, so that a later buffer at the same virtual addresses does
+ *  not get the PD entry, and the bus address, of the old one. Unreferenced cache entries
+ *  give back their PD entry and r_key. A PD from rdma_alloc_pd() keeps its PD entry and
+ *  has to be registered again.
+ *  @param rdma_dev A pointer to the RDMA device, NULL or without a PD/MR manager is a no-op.
+ *  @param vaddr virtual start address of the range.
+ *  @param length size of the range.
+ *  @return Number of memory regions invalidated.
+ */
+int rdma_mr_cache_invalidate(struct rdma_dev_t* rdma_dev, void* vaddr, uint64_t length);
+
+/** @brief Allocate a protection domain with a PD number taken from the PD/MR manager.
+ *
+ *  The PD is not evicted. Register its buffer with rdma_register_memory_region() and 
+ *  return it with rdma_free_pd(), which also returns an r_key taken from the free list.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @return a pointer to the protection domain entry, or NULL if no PD entry is free.
+ */
+struct rdma_pd_t* rdma_alloc_pd(struct rdma_dev_t* rdma_dev);
+
+/** @brief Return a protection domain allocated by rdma_alloc_pd() to the PD/MR manager.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param rdma_pd A pointer to the protection domain entry.
+ *  @return void.
+ */
+void rdma_free_pd(struct rdma_dev_t* rdma_dev, struct rdma_pd_t* rdma_pd);
+
+/** @brief Destroy the memory region registration cache of an RDMA device.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @return void.
+ */
+void rdma_mr_cache_destroy(struct rdma_dev_t* rdma_dev);
+
 /** @brief Allocate a host-side buffer.
  *  @param num_hugepages Number of hugepages requested.
  *  @return a pointer to an RDMA buffer allocated.
@@ -227,16 +667,18 @@ void config_sq_psn(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint32_t sq_psn);
 
 /** @brief Allocate an RDMA queue pair.
  *  @param rdma_dev A pointer to the RDMA device.
- *  @param qpid A QP ID.
+ *  @param qpid A QP ID, from 1 to the number of QPs of the device. QP1 is the ERNIC 
+ *              connection management QP, data QPs start at 2.
  *  @param dst_qpid A destination QP ID.
- *  @param pd_entry Pointer to a protection domain entry.
+ *  @param pd_entry Pointer to a protection domain entry. The QP does not own it, QPs 
+ *                  can share a protection domain and it is freed by the caller after
+ *                  its QPs are destroyed.
  *  @param cq_cidb_addr Base address of the CQ consumer index doorbell.
  *  @param rq_cidb_addr Base address of the RQ consumer index doorbell.
  *  @param qdepth Queue depth used to allocate SQ, CQ and RQ. Each WQE has 64B,
- *                each CQE has 4B and each RQE has 256B. 
- *                Total size of SQ is calculated by num_qp * depth * WQE
- *                Total size of CQ is calculated by num_qp * depth * CQE
- *                Total size of RQ is calculated by num_qp * depth * RQE
+ *                each CQE has CQE_SIZE bytes and each RQE has RQE_SIZE bytes. 
+ *                The SQ, CQ and RQ of the QP are separate buffers, see 
+ *                get_rdma_qp_ring_layout().
  *  @param buf_location Location to allocate a buffer: "host_mem" or "dev_mem".
  *  @param dst_mac Destination MAC address.
  *  @param dst_ip Destination IP address.
@@ -257,6 +699,72 @@ struct rdma_qp_t* allocate_rdma_qp(struct rdma_dev_t* rdma_dev,
                                    uint32_t partion_key,
                                    uint32_t r_key);
 
+/** @brief Allocate an RDMA queue pair with a given RQ entry size.
+ *
+ *  Same as allocate_rdma_qp(), except that each RQE has rqe_size bytes. QPs 
+ *  receiving small messages can use small RQEs, and QPs receiving bulk data 
+ *  large ones.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param qpid A QP ID.
+ *  @param dst_qpid A destination QP ID.
+ *  @param pd_entry Pointer to a protection domain entry.
+ *  @param cq_cidb_addr Base address of the CQ consumer index doorbell.
+ *  @param rq_cidb_addr Base address of the RQ consumer index doorbell.
+ *  @param qdepth Queue depth used to allocate SQ, CQ and RQ.
+ *  @param buf_location Location to allocate a buffer: "host_mem" or "dev_mem".
+ *  @param dst_mac Destination MAC address.
+ *  @param dst_ip Destination IP address.
+ *  @param partion_key Partion key.
+ *  @param r_key RDMA security key or remote tag.
+ *  @param rqe_size Size of an RQ entry in bytes, a multiple of RDMA_RQE_UNIT up to 
+ *                  RDMA_RQE_MAX_SIZE.
+ *  @return a pointer to the allocated RDMA queue pair, or NULL if rqe_size is invalid.
+ */
+struct rdma_qp_t* allocate_rdma_qp_rqe(struct rdma_dev_t* rdma_dev,
+                                       uint32_t qpid,
+                                       uint32_t dst_qpid,
+                                       struct rdma_pd_t* pd_entry,
+                                       uint64_t cq_cidb_addr,
+                                       uint64_t rq_cidb_addr,
+                                       uint32_t qdepth,
+                                       char*    buf_location,
+                                       struct mac_addr_t* dst_mac,
+                                       uint32_t dst_ip,
+                                       uint32_t partion_key,
+                                       uint32_t r_key,
+                                       uint32_t rqe_size);
+
+/** @brief Get the RQ entry size class of a message size.
+ *
+ *  Size classes are powers of two from RDMA_RQE_UNIT to RDMA_RQE_MAX_SIZE. The RQ is
+ *  allocated apart from the SQ and CQ (see get_rdma_qp_ring_layout()), so with a 
+ *  power-of-two depth it fills its allocator block exactly, e.g. 256KB for qdepth 64
+ *  with 4KB RQEs. Freed RQ blocks of a class are reused by later QPs of that class.
+ *  @param max_msg_size Largest message received by the QP in bytes.
+ *  @return The RQ entry size in bytes, or 0 if max_msg_size exceeds RDMA_RQE_MAX_SIZE.
+ */
+uint32_t get_rdma_rqe_size_class(uint32_t max_msg_size);
+
+/** @brief Compute the sizes of the rings of a QP.
+ *
+ *  Each ring is allocated on its own by allocate_rdma_buffer(), in a naturally aligned
+ *  power-of-two block: rings of at least 4KB are page aligned and smaller rings are at
+ *  least cache-line aligned. With a power-of-two depth, every ring fills its block. 
+ *  Packing the rings in one buffer would round their sum up to the next power of two,
+ *  e.g. 37120 bytes to 64KB for qdepth 64 with 512B RQEs.
+ *  @param qdepth Queue depth.
+ *  @param rqe_size Size of an RQ entry in bytes.
+ *  @param layout Returns the sizes of the rings.
+ *  @return void.
+ */
+void get_rdma_qp_ring_layout(uint32_t qdepth, uint32_t rqe_size, struct rdma_qp_ring_layout_t* layout);
+
+/** @brief Print the memory footprint of the rings of every QP of an RDMA device.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @return Total number of bytes of the allocator blocks holding the QP rings.
+ */
+uint64_t dump_rdma_qp_footprint(struct rdma_dev_t* rdma_dev);
+
 /** @brief Create an RDMA work queue element.
  *  @param rdma_dev A pointer to the RDMA device.
  *  @param qpid A QP ID.
@@ -268,9 +776,14 @@ struct rdma_qp_t* allocate_rdma_qp(struct rdma_dev_t* rdma_dev,
  *  @param dst_mac Destination MAC address.
  *  @param dst_ip Destination IP address.
  *  @param partion_key Partion key.
- *  @return a pointer to the allocated RDMA queue pair.
+ *  @return Success (0) or -EAGAIN if doorbell coalescing is enabled and the SQ has
+ *          no free slot for staging.
+ *
+ *  When doorbell coalescing is enabled on the QP, wqe_idx is ignored: the WQE is staged
+ *  at the tail of the SQ ring and published once db_batch_threshold WQEs are staged,
+ *  the time budget expires or rdma_flush_doorbell() is called.
  */
-void create_a_wqe(struct rdma_dev_t* rdma_dev,
+int create_a_wqe(struct rdma_dev_t* rdma_dev,
                   uint32_t qpid,
                   uint16_t wrid,
                   uint32_t wqe_idx,
@@ -285,15 +798,155 @@ void create_a_wqe(struct rdma_dev_t* rdma_dev,
                   uint32_t send_small_payload3,
                   uint32_t immdt_data);
 
+/** @brief Create an RDMA SEND work queue element with its payload inline.
+ *
+ *  The payload is copied into send_small_payload0..3 of the WQE, so the RDMA engine
+ *  does not fetch it over PCIe.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param qpid A QP ID.
+ *  @param wrid A work request ID.
+ *  @param wqe_idx WQE index, ignored if doorbell coalescing is enabled.
+ *  @param payload a pointer to the payload.
+ *  @param length Payload size, at most RDMA_INLINE_MAX_SIZE bytes.
+ *  @param opcode RNIC_OP_SEND, RNIC_OP_SEND_IMMDT or RNIC_OP_SEND_INV.
+ *  @param immdt_data immediate data.
+ *  @return Success (0), -EINVAL if the payload does not fit in the WQE, or -EAGAIN if
+ *          the SQ has no free slot for staging.
+ */
+int create_an_inline_wqe(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint16_t wrid, 
+                         uint32_t wqe_idx, const void* payload, uint32_t length, 
+                         uint32_t opcode, uint32_t immdt_data);
+
+/** @brief Create an RDMA SEND work queue element, inline when the payload allows.
+ *
+ *  SEND payloads of up to RDMA_INLINE_MAX_SIZE bytes in host memory are sent inline.
+ *  Larger payloads, payloads in device memory and other opcodes are fetched by DMA
+ *  from local_buf, at the address translated by get_rdma_buffer_paddr(). The payload 
+ *  must be physically contiguous.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param qpid A QP ID.
+ *  @param wrid A work request ID.
+ *  @param wqe_idx WQE index, ignored if doorbell coalescing is enabled.
+ *  @param local_buf local payload buffer.
+ *  @param local_offset payload offset within local_buf.
+ *  @param length Payload size.
+ *  @param opcode RNIC_OP_SEND, RNIC_OP_SEND_IMMDT or RNIC_OP_SEND_INV.
+ *  @param immdt_data immediate data.
+ *  @return Success (0), -EINVAL, or -EAGAIN if the SQ has no free slot for staging.
+ */
+int create_a_send_wqe(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint16_t wrid, 
+                      uint32_t wqe_idx, struct rdma_buff_t* local_buf, uint64_t local_offset, 
+                      uint32_t length, uint32_t opcode, uint32_t immdt_data);
+
+/** @brief Create the WQEs of an RDMA operation on a local buffer.
+ *
+ *  The local address is translated with get_rdma_buffer_paddr(). A READ or WRITE whose 
+ *  local range crosses physically discontiguous hugepages gets one WQE per contiguous 
+ *  range, at consecutive WQE indices and with the same wrid. SENDs are built by 
+ *  create_a_send_wqe() and are never split.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param qpid A QP ID.
+ *  @param wrid A work request ID.
+ *  @param wqe_idx index of the first WQE, ignored if doorbell coalescing is enabled.
+ *  @param local_buf local buffer.
+ *  @param local_offset offset of the transfer within local_buf.
+ *  @param length transfer size.
+ *  @param opcode 8-bit WQE opcode.
+ *  @param remote_offset remote memory address offset.
+ *  @param r_key RDMA security key.
+ *  @return Number of WQEs created, to be posted with rdma_post_batch_send(), -EINVAL, or
+ *          -EAGAIN if the SQ has not enough free slots for staging.
+ */
+int create_buffer_wqes(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint16_t wrid, 
+                       uint32_t wqe_idx, struct rdma_buff_t* local_buf, uint64_t local_offset, 
+                       uint32_t length, uint32_t opcode, uint64_t remote_offset, uint32_t r_key);
+
 /** @brief Poll CQ consumer index doorbell to check whether RDMA read/write is completed 
  *         and get its value.
  *  @param rdma_dev A pointer to the RDMA device.
  *  @param qpid The target queue pair ID.
  *  @param sq_cidb value of SQ consumer index doorbell.
- *  @return value of RDMA CQ consumer index doorbel register.
+ *
+ *  The wait follows the QP polling policy and gives up once its deadline has passed.
+ *  @return value of RDMA CQ consumer index doorbel register or -1 on timeout.
  */
 int poll_cq_cidb(struct rdma_dev_t* rdma_dev, uint32_t qpid, int sq_cidb);
 
+/** @brief Configure a queue pair to poll completions from the CQ doorbell in host memory.
+ *
+ *  Hardware writes the CQ head to cq_cidb_addr on every completion. Polling that host
+ *  memory location avoids a non-posted PCIe read of CQHEADi per poll. poll_cq_cidb() 
+ *  falls back to CQHEADi when the doorbell has not moved for CQ_SHADOW_POLL_THRESHOLD
+ *  reads.
+ *  @param qp a pointer to a queue pair.
+ *  @param enable 1 - poll the host-memory CQ doorbell; 0 - poll CQHEADi.
+ *  @return Success (0) or Failure (-1) if cq_cidb_addr is not in host memory.
+ */
+int rdma_config_cq_shadow_poll(struct rdma_qp_t* qp, uint8_t enable);
+
+/** @brief Configure a queue pair to poll receives from the RQ doorbell in host memory.
+ *
+ *  Hardware writes the RQ write pointer to rq_cidb_addr on every incoming packet.
+ *  poll_rq_pidb() and rdma_release_rq_consumed() then read host memory instead of
+ *  STATRQPIDBi. STATRQPIDBi is still read once every RQ_SHADOW_POLL_THRESHOLD polls
+ *  in case a doorbell write is delayed.
+ *  @param qp a pointer to a queue pair.
+ *  @param enable 1 - poll the host-memory RQ doorbell; 0 - poll STATRQPIDBi.
+ *  @return Success (0) or Failure (-1) if rq_cidb_addr is not in host memory.
+ */
+int rdma_config_rq_shadow_poll(struct rdma_qp_t* qp, uint8_t enable);
+
+/** @brief Set the polling policy used by a queue pair.
+ *
+ *  The policy is owned by the caller and can be shared by several QPs, e.g. a busy-spin
+ *  policy for latency-critical QPs and a backoff policy for bulk QPs. With POLL_INTERRUPT,
+ *  poll_cq_cidb() and poll_rq_pidb() re-arm the QP interrupt by clearing its CQINTSTS or
+ *  RQINTSTS bit before sleeping on the eventfd of the policy.
+ *  @param qp a pointer to a queue pair.
+ *  @param policy a pointer to the polling policy. NULL uses the policy of the RDMA device.
+ *  @return void.
+ */
+void rdma_set_qp_poll_policy(struct rdma_qp_t* qp, struct poll_policy_t* policy);
+
+/** @brief Clear a QP set.
+ *  @param qp_set a pointer to a QP set.
+ *  @return void.
+ */
+void rdma_qp_set_zero(struct rdma_qp_set_t* qp_set);
+
+/** @brief Add a queue pair to a QP set.
+ *  @param qp_set a pointer to a QP set.
+ *  @param qpid QP ID to be added.
+ *  @return void.
+ */
+void rdma_qp_set_add(struct rdma_qp_set_t* qp_set, uint32_t qpid);
+
+/** @brief Remove a queue pair from a QP set.
+ *  @param qp_set a pointer to a QP set.
+ *  @param qpid QP ID to be removed.
+ *  @return void.
+ */
+void rdma_qp_set_del(struct rdma_qp_set_t* qp_set, uint32_t qpid);
+
+/** @brief Wait until any queue pair in a set has new completions or receives.
+ *
+ *  QPs polled through host-memory doorbells (rdma_config_cq_shadow_poll() and 
+ *  rdma_config_rq_shadow_poll()) are checked in host memory. For the others, the set
+ *  bits of the CQINTSTS/RQINTSTS register covering them are cleared by writing 1 first,
+ *  then CQHEADi and STATRQPIDBi of each QP are read. The write-1-to-clear behaviour of 
+ *  CQINTSTS and RQINTSTS has not been verified on hardware. Events are level-triggered:
+ *  a QP is reported on every scan while its CQ head or RQ producer index differs from
+ *  what was consumed, whether or not its status bit is set. QPs of the set that are
+ *  not allocated are ignored. The wait follows the polling policy of the RDMA device.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param qp_set a pointer to the QP set to wait on.
+ *  @param events an array used to store the events reported.
+ *  @param max_events Maximum number of events to be reported.
+ *  @return Number of events reported, 0 if the deadline of the polling policy has passed
+ *          or Failure (-1).
+ */
+int rdma_wait_any(struct rdma_dev_t* rdma_dev, struct rdma_qp_set_t* qp_set, struct rdma_qp_event_t* events, uint32_t max_events);
+
 /** @brief Update RDMA RQ consumer index doorbell register.
  *  @param rdma_dev A pointer to the RDMA device.
  *  @param qp a pointer to a queue pair.
@@ -305,29 +958,147 @@ void write_rq_cidb(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp, uint32_t d
 /** @brief Poll RQ producer index doorbell register and get its value.
  *  @param rdma_dev A pointer to the RDMA device.
  *  @param qpid The target QP ID.
- *  @return value of RQ producer index doorbell register of the the qpid-th QP.
+ *
+ *  The wait follows the QP polling policy.
+ *  @return value of RQ producer index doorbell register of the the qpid-th QP or -1 if
+ *          the deadline of the polling policy has passed.
  */
 int poll_rq_pidb(struct rdma_dev_t* rdma_dev, uint32_t qpid);
 
-/** @brief Post an RDMA operation.
+/** @brief Post an RDMA operation and wait for its completion.
+ *
+ *  With doorbell coalescing, all staged WQEs are published with rdma_flush_doorbell().
  *  @param rdma_dev A pointer to the RDMA device.
  *  @param qpid The target QP ID.
  *  @return Success (0) or Failure (-1).
  */
 int rdma_post_send(struct rdma_dev_t* rdma_dev, uint32_t qpid);
 
-/** @brief Post a batch of RDMA operations.
+/** @brief Publish RDMA operations without waiting for their completions.
+ *
+ *  Only the SQ producer index doorbell is updated. Completions are harvested
+ *  later by rdma_poll_cq(), so several WQEs can be in flight at the same time.
+ *  The SQ is a ring: WQEs must be created at rdma_sq_wqe_idx() onwards. WQEs staged
+ *  by doorbell coalescing are the first ones published.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param qpid The target QP ID.
+ *  @param num_wqe Number of WQEs created by create_a_wqe() to be published.
+ *  @return Success (0), -EAGAIN if the SQ does not have num_wqe free slots
+ *          (nothing is published, harvest completions and retry) or Failure (-1).
+ */
+int rdma_post_send_async(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint32_t num_wqe);
+
+/** @brief Harvest completed work requests of a queue pair without blocking.
+ *  @param qp a pointer to a queue pair.
+ *  @param completions an array used to store the completions harvested.
+ *  @param max_completions Maximum number of completions to be harvested.
+ *  Every completion harvested returns one credit to the SQ.
+ *  @return Number of completions harvested or Failure (-1).
+ */
+int rdma_poll_cq(struct rdma_qp_t* qp, struct rdma_completion_t* completions, uint32_t max_completions);
+
+/** @brief Build a batch of WQEs and publish them with a single SQPIi doorbell.
+ *
+ *  Local addresses are translated with get_rdma_buffer_paddr() and masked once per 
+ *  physically contiguous segment of a local buffer. Consecutive descriptors falling in 
+ *  the same segment reuse its masked address. A READ or WRITE whose 
+ *  local range crosses physically discontiguous hugepages is split into one WQE per 
+ *  contiguous range, all with the descriptor's wrid, and each of them completes 
+ *  separately. A SEND can not be split. Each 64-byte WQE is built in SIMD registers and
+ *  written to a host SQ with non-temporal stores, so that the SQ cache lines are not 
+ *  pulled into the CPU cache. WQEs are placed at the tail of the SQ ring, after any WQE 
+ *  staged by doorbell coalescing, and the staged WQEs are published together with the batch.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param qpid The target QP ID.
+ *  @param descs an array of WQE descriptors.
+ *  @param num_desc Number of descriptors in descs.
+ *  @return Number of descriptors published, which is less than num_desc if the SQ does 
+ *          not have enough free slots, -EAGAIN if the SQ has no room for the first 
+ *          descriptor, -EINVAL if the first descriptor is a SEND that is not physically
+ *          contiguous, or Failure (-1).
+ */
+int rdma_post_wqe_batch(struct rdma_dev_t* rdma_dev, uint32_t qpid, struct rdma_wqe_desc_t* descs, uint32_t num_desc);
+
+/** @brief RDMA WRITE a large buffer, split into WQEs of chunk_size bytes.
+ *
+ *  The SQ ring is kept full: new chunks are posted as soon as completions free SQ slots.
+ *  Chunks also end where the local buffer crosses physically discontiguous hugepages.
+ *  The call returns once the last chunk has completed, waiting according to the QP 
+ *  polling policy. The QP must not have WQEs in flight. On failure, the chunks already 
+ *  posted are reaped before returning, within the deadline of the polling policy.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param qpid The target QP ID.
+ *  @param local_buf local buffer holding the data.
+ *  @param local_offset offset of the data within local_buf.
+ *  @param remote_offset remote memory address offset.
+ *  @param r_key RDMA security key of the remote buffer.
+ *  @param length Number of bytes to be written.
+ *  @param chunk_size Maximum payload size of each WQE. 0 uses RDMA_LARGE_CHUNK_SIZE.
+ *  @return Success (0), -EBUSY if the QP has WQEs in flight, or Failure (-1).
+ */
+int rdma_write_large(struct rdma_dev_t* rdma_dev, uint32_t qpid, struct rdma_buff_t* local_buf, 
+                     uint64_t local_offset, uint64_t remote_offset, uint32_t r_key, 
+                     uint64_t length, uint32_t chunk_size);
+
+/** @brief RDMA READ a large buffer, split into WQEs of chunk_size bytes.
+ *
+ *  Same as rdma_write_large(), with data read from the remote buffer into local_buf.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param qpid The target QP ID.
+ *  @param local_buf local buffer receiving the data.
+ *  @param local_offset offset of the data within local_buf.
+ *  @param remote_offset remote memory address offset.
+ *  @param r_key RDMA security key of the remote buffer.
+ *  @param length Number of bytes to be read.
+ *  @param chunk_size Maximum payload size of each WQE. 0 uses RDMA_LARGE_CHUNK_SIZE.
+ *  @return Success (0), -EBUSY if the QP has WQEs in flight, or Failure (-1).
+ */
+int rdma_read_large(struct rdma_dev_t* rdma_dev, uint32_t qpid, struct rdma_buff_t* local_buf, 
+                    uint64_t local_offset, uint64_t remote_offset, uint32_t r_key, 
+                    uint64_t length, uint32_t chunk_size);
+
+/** @brief Configure SQ doorbell coalescing of a queue pair.
+ *  @param qp a pointer to a queue pair.
+ *  @param batch_threshold Number of staged WQEs that triggers a doorbell.
+ *                         0 disables doorbell coalescing.
+ *  @param time_budget_ns Maximum time in ns a staged WQE waits for its doorbell. It is
+ *                        checked whenever create_a_wqe() or rdma_poll_cq() is called on
+ *                        the QP, there is no timer. A QP on which neither is called keeps
+ *                        its staged WQEs until rdma_flush_doorbell(), rdma_post_send()
+ *                        or rdma_post_batch_send() is called. 0 means no time budget.
+ *  @return void.
+ */
+void rdma_config_doorbell_coalescing(struct rdma_qp_t* qp, uint32_t batch_threshold, uint64_t time_budget_ns);
+
+/** @brief Publish all staged WQEs of a queue pair with a single SQPIi doorbell.
+ *  @param qp a pointer to a queue pair.
+ *  @return Success (0), -EAGAIN if the SQ is full or Failure (-1).
+ */
+int rdma_flush_doorbell(struct rdma_qp_t* qp);
+
+/** @brief Get the SQ ring index of a WQE to be created.
+ *  @param qp a pointer to a queue pair.
+ *  @param offset offset from the current SQ producer index, i.e., the i-th WQE of
+ *                the next batch.
+ *  @return WQE index in the SQ ring.
+ */
+uint32_t rdma_sq_wqe_idx(struct rdma_qp_t* qp, uint32_t offset);
+
+/** @brief Post a batch of RDMA operations and wait for their completions.
+ *
+ *  With doorbell coalescing, all staged WQEs are published with rdma_flush_doorbell().
  *  @param rdma_dev A pointer to the RDMA device.
  *  @param qpid The target QP ID.
  *  @param batch_size batch size.
- *  @return Success (0) or Failure (-1).
+ *  @return Success (0), -EAGAIN if the SQ does not have batch_size free slots
+ *          or Failure (-1).
  */
 int rdma_post_batch_send(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint32_t batch_size);
 
 /** @brief Post an RDMA receive request.
  *  @param rdma_dev A pointer to the RDMA device.
  *  @param qp a pointer to a queue pair.
- *  @return void.
+ *  @return a pointer to the received RQE or NULL on failure.
  */
 void* rdma_post_receive(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp);
 
@@ -338,6 +1109,40 @@ void* rdma_post_receive(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp);
  */
 uint8_t rdma_release_rq_consumed(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp);
 
+/** @brief Get the RQ entries received since the last call, without blocking.
+ *
+ *  The RQ producer index is read once for the whole batch. RQEs stay owned by the
+ *  application until they are handed back with rdma_release_recv().
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param qp a pointer to a queue pair.
+ *  @param descs an array used to store the receive descriptors.
+ *  @param max_desc Maximum number of descriptors to be returned.
+ *  @return Number of descriptors returned or Failure (-1).
+ */
+int rdma_poll_recv(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp, struct rdma_recv_desc_t* descs, uint32_t max_desc);
+
+/** @brief Wait for RQ entries following the QP polling policy and return them.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param qp a pointer to a queue pair.
+ *  @param descs an array used to store the receive descriptors.
+ *  @param max_desc Maximum number of descriptors to be returned.
+ *  @return Number of descriptors returned, 0 if the deadline of the polling policy has
+ *          passed, or Failure (-1).
+ */
+int rdma_wait_recv(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp, struct rdma_recv_desc_t* descs, uint32_t max_desc);
+
+/** @brief Hand RQ entries back to hardware.
+ *
+ *  Entries can be released in any order. The RQ consumer index only moves over 
+ *  contiguous released entries, with a single RQCIi write per call.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param qp a pointer to a queue pair.
+ *  @param descs descriptors returned by rdma_poll_recv() or rdma_wait_recv().
+ *  @param num_desc Number of descriptors to be released.
+ *  @return Number of RQEs returned to hardware or Failure (-1).
+ */
+int rdma_release_recv(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp, struct rdma_recv_desc_t* descs, uint32_t num_desc);
+
 /** @brief Reset RDMA device when encountering fatal error.
  *  @param rdma_dev A pointer to the RDMA device.
  *  @param qpid the QP ID that has the fatal issues.
@@ -352,6 +1157,9 @@ void rdma_qp_fatal_recovery(struct rdma_dev_t* rdma_dev, uint32_t qpid);
 void destroy_rdma_pd_entry(struct rdma_pd_t* pd);
 
 /** @brief Destroy the RDMA queue pair generated.
+ *
+ *  The QP is removed from the QP table of its RDMA device and freed. Its protection
+ *  domain entry is not freed.
  *  @param qp a pointer to a queue pair.
  *  @return Success (0).
  */
@@ -377,4 +1185,4 @@ int destroy_rn_dev(struct rn_dev_t* rn_dev);
  */
 void dump_registers(struct rdma_dev_t* rdma_dev, uint8_t is_sender, uint32_t qpid);
 
-#endif /* __RDMA_API_H__ */
\ No newline at end of file
+#endif /* __RDMA_API_H__ */
\ No newline at end of file
@@ -10,6 +10,8 @@
  */
 
 #include "reconic.h"
+#include "rdma_api.h"
+#include <pthread.h>
 
 int debug = 0;
 
@@ -17,6 +19,9 @@ char* device = "";
 
 int fpga_fd = -1;
 
+/* /proc/self/pagemap, opened on first use */
+static int pagemap_fd = -1;
+
 uint64_t get_win_size() {
   //return AXI_BAR_SIZE>>3;
   return AXI_BAR_SIZE;
@@ -112,29 +117,32 @@ uint8_t is_device_address(uint64_t address) {
   }
 }
 
+static int open_pagemap(void) {
+  if(pagemap_fd < 0) {
+    pagemap_fd = open("/proc/self/pagemap", O_RDONLY);
+    if(pagemap_fd < 0) {
+      fprintf(stderr, "Error: failed to open /proc/self/pagemap\n");
+    }
+  }
+  return pagemap_fd;
+}
+
 /* Used to get the PFN of a virtual address */
 unsigned long get_page_frame_number_of_address(void *addr) {
-  size_t return_code;
-  // Getting the pagemap file for the current process
-  FILE *pagemap = fopen("/proc/self/pagemap", "rb");
+  uint64_t page_frame_number = 0;
 
-  // Seek to the page that the buffer is on
-  unsigned long offset = (unsigned long)addr / getpagesize() * PAGEMAP_LENGTH;
-  if(fseek(pagemap, (unsigned long)offset, SEEK_SET) != 0) {
-    fprintf(stderr, "Error: Failed to seek pagemap to proper location\n");
-    exit(1);
+  if(open_pagemap() < 0) {
+    return -1;
   }
 
-  // The page frame number is in bits 0 - 54 so read the first 7 bytes and clear the 55th bit
-  unsigned long page_frame_number = 0;
-  return_code = fread(&page_frame_number, 1, PAGEMAP_LENGTH-1, pagemap);
-  if(return_code != (PAGEMAP_LENGTH-1)) {
+  // The page frame number is in bits 0 - 54
+  off_t offset = (off_t) ((unsigned long)addr / getpagesize() * PAGEMAP_LENGTH);
+  if(pread(pagemap_fd, &page_frame_number, PAGEMAP_LENGTH, offset) != PAGEMAP_LENGTH) {
     fprintf(stderr, "Error: failed to get page frame number\n");
     return -1;
   }
   page_frame_number &= 0x7FFFFFFFFFFFFF;
 
-  fclose(pagemap);
   return page_frame_number;
 }
 
@@ -156,8 +164,223 @@ uint64_t get_buffer_paddr(void *buffer) {
   return paddr;
 }
 
+struct pagemap_req_t {
+  uint64_t page;
+  uint32_t idx;
+};
+
+static int cmp_pagemap_req(const void* a, const void* b) {
+  const struct pagemap_req_t* req_a = (const struct pagemap_req_t* ) a;
+  const struct pagemap_req_t* req_b = (const struct pagemap_req_t* ) b;
+
+  return (req_a->page > req_b->page) - (req_a->page < req_b->page);
+}
+
+int get_buffer_paddrs(void** buffers, uint64_t* paddrs, uint32_t num) {
+  struct pagemap_req_t* reqs;
+  uint64_t* entries;
+  uint64_t page_size = (uint64_t) getpagesize();
+  uint64_t first_page;
+  uint64_t num_entries;
+  uint32_t i;
+  uint32_t j;
+  ssize_t rc;
+
+  if(num == 0) {
+    return 0;
+  }
+  if(open_pagemap() < 0) {
+    return -1;
+  }
+
+  reqs = (struct pagemap_req_t* ) malloc(num * sizeof(struct pagemap_req_t));
+  entries = (uint64_t* ) malloc(PAGEMAP_BATCH_ENTRIES * PAGEMAP_LENGTH);
+  if((reqs == NULL) || (entries == NULL)) {
+    fprintf(stderr, "Error: failed to allocate pagemap batch\n");
+    free(reqs);
+    free(entries);
+    return -1;
+  }
+
+  for(i=0; i<num; i++) {
+    reqs[i].page = (uint64_t) buffers[i] / page_size;
+    reqs[i].idx  = i;
+  }
+  qsort(reqs, num, sizeof(struct pagemap_req_t), cmp_pagemap_req);
+
+  // One pread per window of PAGEMAP_BATCH_ENTRIES pages
+  for(i=0; i<num; i=j) {
+    first_page = reqs[i].page;
+    for(j=i; (j<num) && (reqs[j].page - first_page < PAGEMAP_BATCH_ENTRIES); j++);
+    num_entries = reqs[j-1].page - first_page + 1;
+
+    rc = pread(pagemap_fd, entries, num_entries * PAGEMAP_LENGTH, (off_t) (first_page * PAGEMAP_LENGTH));
+    if(rc != (ssize_t) (num_entries * PAGEMAP_LENGTH)) {
+      fprintf(stderr, "Error: failed to read %ld pagemap entries\n", num_entries);
+      free(reqs);
+      free(entries);
+      return -1;
+    }
+
+    for(; i<j; i++) {
+      paddrs[reqs[i].idx] = ((entries[reqs[i].page - first_page] & 0x7FFFFFFFFFFFFF) << PAGE_SHIFT) + 
+                            ((uint64_t) buffers[reqs[i].idx] % page_size);
+    }
+  }
+
+  free(reqs);
+  free(entries);
+  return 0;
+}
+
+uint64_t get_hugepage_buffer_paddr(struct rn_dev_t* rn_dev, void *buffer) {
+  uint64_t offset;
+
+  if((rn_dev != NULL) && (rn_dev->hugepage_paddr != NULL) && ((uint64_t) buffer >= (uint64_t) rn_dev->base_buf->buffer)) {
+    offset = (uint64_t) buffer - (uint64_t) rn_dev->base_buf->buffer;
+    if((offset >> rn_dev->hugepage_shift) < rn_dev->num_hugepages) {
+      return rn_dev->hugepage_paddr[offset >> rn_dev->hugepage_shift] + (offset & ((1UL << rn_dev->hugepage_shift) - 1));
+    }
+  }
+
+  return get_buffer_paddr(buffer);
+}
+
+uint32_t get_hugepage_buffer_segments(struct rn_dev_t* rn_dev, void* buffer, uint64_t size, 
+                                      uint64_t* paddrs, uint64_t* lens, uint32_t max_segments) {
+  uint64_t page_size = 1UL << rn_dev->hugepage_shift;
+  uint64_t offset = (uint64_t) buffer - (uint64_t) rn_dev->base_buf->buffer;
+  uint64_t end = offset + size;
+  uint64_t seg_paddr = 0;
+  uint64_t seg_len = 0;
+  uint64_t paddr;
+  uint64_t len;
+  uint32_t num_segments = 0;
+
+  while(offset < end) {
+    paddr = get_hugepage_buffer_paddr(rn_dev, (void* ) ((uint64_t) rn_dev->base_buf->buffer + offset));
+    len = page_size - (offset & (page_size - 1));
+    if(len > end - offset) {
+      len = end - offset;
+    }
+
+    if((seg_len != 0) && (paddr == seg_paddr + seg_len)) {
+      seg_len += len;
+    } else {
+      if(seg_len != 0) {
+        if(num_segments < max_segments) {
+          if(paddrs != NULL) paddrs[num_segments] = seg_paddr;
+          if(lens != NULL) lens[num_segments] = seg_len;
+        }
+        num_segments++;
+      }
+      seg_paddr = paddr;
+      seg_len = len;
+    }
+    offset += len;
+  }
+
+  if(seg_len != 0) {
+    if(num_segments < max_segments) {
+      if(paddrs != NULL) paddrs[num_segments] = seg_paddr;
+      if(lens != NULL) lens[num_segments] = seg_len;
+    }
+    num_segments++;
+  }
+
+  return num_segments;
+}
+
+/* This function is used to get the virtual address of a physical address in the
+ * pre-allocated hugepage buffer. Hugepages are only physically contiguous within
+ * a page, so every allocated hugepage is looked up in the hugepage table. */
+void* get_buffer_vaddr(struct rn_dev_t* rn_dev, uint64_t paddr) {
+  uint64_t offset;
+  uint64_t page_paddr;
+  uint64_t page_size;
+
+  if((rn_dev == NULL) || (rn_dev->base_buf == NULL)) {
+    return NULL;
+  }
+  page_size = 1UL << rn_dev->hugepage_shift;
+
+  for(offset = 0; offset < rn_dev->buffer_offset; offset += page_size) {
+    page_paddr = get_hugepage_buffer_paddr(rn_dev, (void* ) ((uint64_t) rn_dev->base_buf->buffer + offset));
+    if((paddr >= page_paddr) && (paddr < (page_paddr + page_size))) {
+      return (void* ) ((uint64_t) rn_dev->base_buf->buffer + offset + (paddr - page_paddr));
+    }
+  }
+
+  return NULL;
+}
+
+/* Program BDF window i to translate its bridge addresses to host_addr */
+static void write_axib_bdf_window(struct rn_dev_t* rn_dev, uint32_t i, uint64_t host_addr) {
+  uint32_t bdf_addr_high = (uint32_t) ((host_addr & 0xffffffff00000000) >> 32);
+  uint32_t bdf_addr_low  = (uint32_t) (host_addr & 0x00000000ffffffff);
+  // 128GB mapping per window
+  uint32_t bdf_win_size_in_4Kpage = (uint32_t) ( (((AXI_BAR_SIZE>>3) + 1)>>12) & 0x00000000ffffffff);
+  uint32_t bdf_win_config = 0xC0000000 | bdf_win_size_in_4Kpage;
+
+  write32_data(rn_dev->axil_ctl, AXIB_BDF_ADDR_TRANSLATE_ADDR_LSB+(i*0x20), bdf_addr_low);
+  write32_data(rn_dev->axil_ctl, AXIB_BDF_ADDR_TRANSLATE_ADDR_MSB+(i*0x20), bdf_addr_high);
+  write32_data(rn_dev->axil_ctl, AXIB_BDF_PASID_RESERVED_ADDR+(i*0x20), 0);
+  write32_data(rn_dev->axil_ctl, AXIB_BDF_FUNCTION_NUM_ADDR  +(i*0x20), 0);
+  write32_data(rn_dev->axil_ctl, AXIB_BDF_MAP_CONTROL_ADDR   +(i*0x20), bdf_win_config);
+  write32_data(rn_dev->axil_ctl, AXIB_BDF_RESERVED_ADDR      +(i*0x20), 0);
+  Debug("[BDF] AXIB_BDF_ADDR_TRANSLATE_ADDR_LSB=0x%x, bdf_addr_low=0x%x\n", AXIB_BDF_ADDR_TRANSLATE_ADDR_LSB+(i*0x20), bdf_addr_low);
+  Debug("[BDF] AXIB_BDF_ADDR_TRANSLATE_ADDR_MSB=0x%x, bdf_addr_high=0x%x\n", AXIB_BDF_ADDR_TRANSLATE_ADDR_MSB+(i*0x20), bdf_addr_high);
+  Debug("[BDF] AXIB_BDF_MAP_CONTROL_ADDR=0x%x, bdf_win_config=0x%x\n", AXIB_BDF_MAP_CONTROL_ADDR+(i*0x20), bdf_win_config);
+
+  rn_dev->bdf.win[i].host_addr = host_addr;
+}
+
+/* Restore the translation and pinned flag of every window from a snapshot of bdf.win */
+static void restore_axib_bdf_windows(struct rn_dev_t* rn_dev, struct axib_bdf_win_t* saved) {
+  uint32_t i;
+
+  for(i=0; i<AXIB_BDF_NUM_WINDOWS; i++) {
+    if(rn_dev->bdf.win[i].host_addr != saved[i].host_addr) {
+      write_axib_bdf_window(rn_dev, i, saved[i].host_addr);
+    }
+    rn_dev->bdf.win[i].pinned = saved[i].pinned;
+  }
+}
+
+/* Pin the windows used by hugepages [first, first + num_hugepages) of base_buf. The 
+ * bridge address of a hugepage is its physical address masked by the window size mask,
+ * so it needs window (paddr & AXI_BAR_SIZE) >> AXIB_BDF_WIN_SHIFT. */
+static int pin_axib_bdf_windows(struct rn_dev_t* rn_dev, uint32_t first, uint32_t num_hugepages) {
+  struct axib_bdf_win_t saved[AXIB_BDF_NUM_WINDOWS];
+  struct axib_bdf_win_t* win;
+  uint64_t paddr;
+  uint64_t host_addr;
+  uint32_t i;
+
+  memcpy(saved, rn_dev->bdf.win, sizeof(saved));
+  for(i=first; i<first+num_hugepages; i++) {
+    paddr = rn_dev->hugepage_paddr[i];
+    host_addr = paddr & ~((1UL << AXIB_BDF_WIN_SHIFT) - 1);
+    win = &rn_dev->bdf.win[(paddr & AXI_BAR_SIZE) >> AXIB_BDF_WIN_SHIFT];
+    if(win->host_addr != host_addr) {
+      if(win->pinned || (win->refcnt != 0)) {
+        fprintf(stderr, "Error: hugepage 0x%lx needs BDF window %ld, which translates to 0x%lx\n", 
+                paddr, (paddr & AXI_BAR_SIZE) >> AXIB_BDF_WIN_SHIFT, win->host_addr);
+        // Unpin and restore the windows taken by the previous hugepages
+        restore_axib_bdf_windows(rn_dev, saved);
+        return -1;
+      }
+      write_axib_bdf_window(rn_dev, (uint32_t) ((paddr & AXI_BAR_SIZE) >> AXIB_BDF_WIN_SHIFT), host_addr);
+      rn_dev->bdf.num_reprograms++;
+    }
+    win->pinned = 1;
+  }
+
+  return 0;
+}
+
 void config_rn_dev_axib_bdf(struct rn_dev_t* rn_dev, uint32_t high_addr, uint32_t low_addr) {
-  int i;
+  uint32_t i;
   uint64_t win_size = 0;
   uint32_t bdf_addr_mask_high = 0;
   uint32_t bdf_addr_mask_low  = 0;
@@ -165,9 +388,6 @@ void config_rn_dev_axib_bdf(struct rn_dev_t* rn_dev, uint32_t high_addr, uint32_
   uint32_t bdf_addr_high = 0;
   uint32_t bdf_addr_low  = 0;
 
-  uint32_t bdf_win_config;
-  uint32_t bdf_win_size_in_4Kpage;
-
   if(rn_dev == NULL) {
     fprintf(stderr, "Error: rn_dev is NULL\n");
     exit(EXIT_FAILURE);
@@ -183,78 +403,246 @@ void config_rn_dev_axib_bdf(struct rn_dev_t* rn_dev, uint32_t high_addr, uint32_
   bdf_addr_high = high_addr & bdf_addr_mask_high;
   bdf_addr_low  = low_addr & bdf_addr_mask_low;
 
-  // 128GB mapping per window
-  bdf_win_size_in_4Kpage = (uint32_t) ( (((AXI_BAR_SIZE>>3) + 1)>>12) & 0x00000000ffffffff);
-  bdf_win_config = 0xC0000000 | bdf_win_size_in_4Kpage;
+  fprintf(stderr, "Info: Configuring %d windows in QDMA AXI bridge BDF, each has 128GB mapping\n", AXIB_BDF_NUM_WINDOWS);
+  for(i=0; i<AXIB_BDF_NUM_WINDOWS; i++) {
+    write_axib_bdf_window(rn_dev, i, ((((uint64_t) bdf_addr_high) << 32) | bdf_addr_low) + ((uint64_t) i << AXIB_BDF_WIN_SHIFT));
+    rn_dev->bdf.win[i].refcnt = 0;
+    rn_dev->bdf.win[i].pinned = 0;
+  }
+  rn_dev->bdf.configured = 1;
+
+  // Hugepages outside the 1TB region of the first one get their own windows
+  if(pin_axib_bdf_windows(rn_dev, 0, rn_dev->num_hugepages) != 0) {
+    exit(EXIT_FAILURE);
+  }
+}
+
+uint64_t map_axib_bdf_window(struct rn_dev_t* rn_dev, uint64_t paddr, uint64_t size) {
+  uint64_t win_mask = (1UL << AXIB_BDF_WIN_SHIFT) - 1;
+  uint64_t host_addr = paddr & ~win_mask;
+  uint32_t slot = AXIB_BDF_NUM_WINDOWS;
+  uint32_t i;
+
+  if((rn_dev == NULL) || !rn_dev->bdf.configured) {
+    fprintf(stderr, "Error: BDF windows are not configured\n");
+    return AXIB_BDF_MAP_FAILED;
+  }
+  if((size == 0) || (((paddr + size - 1) & ~win_mask) != host_addr)) {
+    fprintf(stderr, "Error: host range 0x%lx of %ld bytes crosses a 128GB BDF window boundary\n", paddr, size);
+    return AXIB_BDF_MAP_FAILED;
+  }
+
+  // Share a window that already translates the region
+  for(i=0; i<AXIB_BDF_NUM_WINDOWS; i++) {
+    if(rn_dev->bdf.win[i].host_addr == host_addr) {
+      slot = i;
+      break;
+    }
+  }
+
+  // Recycle an unused window, preferably the one of the masked physical address
+  if(slot == AXIB_BDF_NUM_WINDOWS) {
+    i = (uint32_t) ((paddr & AXI_BAR_SIZE) >> AXIB_BDF_WIN_SHIFT);
+    if(!rn_dev->bdf.win[i].pinned && (rn_dev->bdf.win[i].refcnt == 0)) {
+      slot = i;
+    }
+    for(i=0; (i<AXIB_BDF_NUM_WINDOWS) && (slot == AXIB_BDF_NUM_WINDOWS); i++) {
+      if(!rn_dev->bdf.win[i].pinned && (rn_dev->bdf.win[i].refcnt == 0)) {
+        slot = i;
+      }
+    }
+    if(slot == AXIB_BDF_NUM_WINDOWS) {
+      fprintf(stderr, "Error: no free BDF window for host address 0x%lx\n", paddr);
+      return AXIB_BDF_MAP_FAILED;
+    }
+    Debug("Info: reprogramming BDF window %d from 0x%lx to 0x%lx\n", slot, rn_dev->bdf.win[slot].host_addr, host_addr);
+    write_axib_bdf_window(rn_dev, slot, host_addr);
+    rn_dev->bdf.num_reprograms++;
+  }
+
+  rn_dev->bdf.win[slot].refcnt++;
+  rn_dev->bdf.num_maps++;
+  return ((uint64_t) slot << AXIB_BDF_WIN_SHIFT) | (paddr & win_mask);
+}
+
+void unmap_axib_bdf_window(struct rn_dev_t* rn_dev, uint64_t bridge_addr) {
+  uint64_t slot = bridge_addr >> AXIB_BDF_WIN_SHIFT;
+
+  if((slot >= AXIB_BDF_NUM_WINDOWS) || (rn_dev->bdf.win[slot].refcnt == 0)) {
+    fprintf(stderr, "Error: bridge address 0x%lx is not mapped\n", bridge_addr);
+    return;
+  }
+  rn_dev->bdf.win[slot].refcnt--;
+}
+
+void dump_axib_bdf_windows(struct rn_dev_t* rn_dev) {
+  uint32_t i;
+
+  fprintf(stderr, "Info: BDF windows: %ld maps, %ld reprograms\n", rn_dev->bdf.num_maps, rn_dev->bdf.num_reprograms);
+  for(i=0; i<AXIB_BDF_NUM_WINDOWS; i++) {
+    fprintf(stderr, "Info:   window %d: bridge 0x%lx -> host 0x%lx, %d references%s\n", i, 
+            (uint64_t) i << AXIB_BDF_WIN_SHIFT, rn_dev->bdf.win[i].host_addr, rn_dev->bdf.win[i].refcnt,
+            rn_dev->bdf.win[i].pinned ? ", used by the hugepage buffer" : "");
+  }
+}
+
+static struct rdma_buff_t* get_rdma_buff_desc(struct rn_dev_t* rn_dev) {
+  struct rdma_buff_pool_t* pool = rn_dev->buff_pool;
+  struct rdma_buff_t** chunks;
+  struct rdma_buff_t** free_desc;
+  uint32_t i;
 
-  fprintf(stderr, "Info: Configuring 8 windows in QDMA AXI bridge BDF, each has 128GB mapping\n");
-  for(i=0; i<8; i++) {
-    write32_data(rn_dev->axil_ctl, AXIB_BDF_ADDR_TRANSLATE_ADDR_LSB+(i*0x20), bdf_addr_low);
-    write32_data(rn_dev->axil_ctl, AXIB_BDF_ADDR_TRANSLATE_ADDR_MSB+(i*0x20), bdf_addr_high + (i*0x20));
-    write32_data(rn_dev->axil_ctl, AXIB_BDF_PASID_RESERVED_ADDR+(i*0x20), 0);
-    write32_data(rn_dev->axil_ctl, AXIB_BDF_FUNCTION_NUM_ADDR  +(i*0x20), 0);
-    write32_data(rn_dev->axil_ctl, AXIB_BDF_MAP_CONTROL_ADDR   +(i*0x20), bdf_win_config);
-    write32_data(rn_dev->axil_ctl, AXIB_BDF_RESERVED_ADDR      +(i*0x20), 0);
-    Debug("[BDF] AXIB_BDF_ADDR_TRANSLATE_ADDR_LSB=0x%x, bdf_addr_low=0x%x\n", AXIB_BDF_ADDR_TRANSLATE_ADDR_LSB+(i*0x20), bdf_addr_low);
-    Debug("[BDF] AXIB_BDF_ADDR_TRANSLATE_ADDR_MSB=0x%x, bdf_addr_high=0x%x\n", AXIB_BDF_ADDR_TRANSLATE_ADDR_MSB+(i*0x20), bdf_addr_high+(i*0x20));
-    Debug("[BDF] AXIB_BDF_MAP_CONTROL_ADDR=0x%x, bdf_win_config=0x%x\n", AXIB_BDF_MAP_CONTROL_ADDR+(i*0x20), bdf_win_config);
+  if(pool->num_free == 0) {
+    chunks = (struct rdma_buff_t** ) realloc(pool->chunks, (pool->num_chunks + 1) * sizeof(struct rdma_buff_t* ));
+    free_desc = (struct rdma_buff_t** ) realloc(pool->free_desc, (pool->num_chunks + 1) * RDMA_BUFF_POOL_CHUNK * sizeof(struct rdma_buff_t* ));
+    if(chunks != NULL) {
+      pool->chunks = chunks;
+    }
+    if(free_desc != NULL) {
+      pool->free_desc = free_desc;
+    }
+    if((chunks == NULL) || (free_desc == NULL)) {
+      fprintf(stderr, "Error: failed to grow rdma_buff_t pool\n");
+      exit(EXIT_FAILURE);
+    }
+    pool->chunks[pool->num_chunks] = (struct rdma_buff_t* ) malloc(RDMA_BUFF_POOL_CHUNK * sizeof(struct rdma_buff_t));
+    if(pool->chunks[pool->num_chunks] == NULL) {
+      fprintf(stderr, "Error: failed to create rdma_buffer\n");
+      exit(EXIT_FAILURE);
+    }
+    for(i=0; i<RDMA_BUFF_POOL_CHUNK; i++) {
+      pool->free_desc[pool->num_free++] = &pool->chunks[pool->num_chunks][RDMA_BUFF_POOL_CHUNK - 1 - i];
+    }
+    pool->num_chunks++;
   }
+
+  pool->num_in_use++;
+  return pool->free_desc[--pool->num_free];
+}
+
+static void put_rdma_buff_desc(struct rn_dev_t* rn_dev, struct rdma_buff_t* rdma_buffer) {
+  rn_dev->buff_pool->num_in_use--;
+  rn_dev->buff_pool->free_desc[rn_dev->buff_pool->num_free++] = rdma_buffer;
+}
+
+/* Allocate buf_size bytes from the hugepage pool and fill the descriptor */
+static int allocate_host_block(struct rn_dev_t* rn_dev, struct rdma_buff_t* rdma_buffer, uint64_t buf_size) {
+  uint64_t alloc_size;
+  uint64_t offset = mem_alloc_alloc(rn_dev->host_alloc, buf_size, &alloc_size);
+  uint64_t num_hugepages;
+
+  // Grow the hugepage buffer until the request fits or the reservation is exhausted
+  while(offset == MEM_ALLOC_FAILED) {
+    num_hugepages = (buf_size + (1UL << rn_dev->hugepage_shift) - 1) >> rn_dev->hugepage_shift;
+    if(num_hugepages < rn_dev->hugepage_config.grow_hugepages) {
+      num_hugepages = rn_dev->hugepage_config.grow_hugepages;
+    }
+    if(num_hugepages > rn_dev->hugepage_config.max_hugepages - rn_dev->num_hugepages) {
+      num_hugepages = rn_dev->hugepage_config.max_hugepages - rn_dev->num_hugepages;
+    }
+    if((num_hugepages == 0) || (grow_hugepage_pool(rn_dev, (uint32_t) num_hugepages) != 0)) {
+      return -1;
+    }
+    offset = mem_alloc_alloc(rn_dev->host_alloc, buf_size, &alloc_size);
+  }
+
+  rdma_buffer->buffer = (void*)((uint64_t) rn_dev->base_buf->buffer + offset);
+  rdma_buffer->buf_size = buf_size;
+  rdma_buffer->dma_addr = get_hugepage_buffer_paddr(rn_dev, rdma_buffer->buffer);
+  if((alloc_size > (1UL << rn_dev->hugepage_shift)) && 
+     (get_hugepage_buffer_segments(rn_dev, rdma_buffer->buffer, buf_size, NULL, NULL, 0) > 1)) {
+    // dma_addr only covers the first segment, see get_rdma_buffer_paddr()
+    Debug("Info: host buffer %p of %ld bytes is not physically contiguous\n", rdma_buffer->buffer, buf_size);
+  }
+  if(offset + alloc_size > rn_dev->buffer_offset) {
+    rn_dev->buffer_offset = offset + alloc_size;
+  }
+  rn_dev->buff_pool->host_bytes_requested += buf_size;
+
+  return 0;
+}
+
+static struct dev_mem_t* get_dev_mem(struct rn_dev_t* rn_dev) {
+  if(rn_dev->dev_mem == NULL) {
+    if(config_rn_dev_mem(rn_dev, 1, (uint64_t) DEVICE_MEM_SIZE, DEV_MEM_PLACE_FIRST_FIT) != 0) {
+      exit(EXIT_FAILURE);
+    }
+  }
+  return rn_dev->dev_mem;
+}
+
+/* Allocate buf_size bytes from a device memory channel and fill the descriptor */
+static int allocate_dev_block_on_channel(struct rn_dev_t* rn_dev, struct rdma_buff_t* rdma_buffer, uint64_t buf_size, uint32_t channel) {
+  struct dev_mem_t* dev_mem = get_dev_mem(rn_dev);
+  uint64_t alloc_size;
+  uint64_t offset;
+
+  if(channel >= dev_mem->num_channels) {
+    fprintf(stderr, "Error: invalid device memory channel %d\n", channel);
+    return -1;
+  }
+
+  offset = mem_alloc_alloc(dev_mem->channels[channel], buf_size, &alloc_size);
+  if(offset == MEM_ALLOC_FAILED) {
+    return -1;
+  }
+
+  offset += (uint64_t) channel * dev_mem->channel_size;
+  rdma_buffer->buffer = (void*)(offset | DEVICE_MEM_OFFSET);
+  rdma_buffer->dma_addr = (uint64_t) (offset | DEVICE_MEM_OFFSET);
+  rdma_buffer->buf_size = buf_size;
+  if(offset + alloc_size > rn_dev->dev_buffer_offset) {
+    rn_dev->dev_buffer_offset = offset + alloc_size;
+  }
+
+  return 0;
+}
+
+static int allocate_dev_block(struct rn_dev_t* rn_dev, struct rdma_buff_t* rdma_buffer, uint64_t buf_size) {
+  struct dev_mem_t* dev_mem = get_dev_mem(rn_dev);
+  uint32_t first = 0;
+  uint32_t i;
+
+  if(dev_mem->placement == DEV_MEM_PLACE_ROUND_ROBIN) {
+    first = dev_mem->next_channel;
+    dev_mem->next_channel = (dev_mem->next_channel + 1) % dev_mem->num_channels;
+  }
+
+  for(i=0; i<dev_mem->num_channels; i++) {
+    if(allocate_dev_block_on_channel(rn_dev, rdma_buffer, buf_size, (first + i) % dev_mem->num_channels) == 0) {
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/* Offset of a device buffer in its channel */
+static uint64_t get_dev_channel_offset(struct rn_dev_t* rn_dev, struct rdma_buff_t* rdma_buffer) {
+  return (rdma_buffer->dma_addr & ~DEVICE_MEM_MASK) % rn_dev->dev_mem->channel_size;
 }
 
 struct rdma_buff_t* allocate_rdma_buffer(struct rn_dev_t* rn_dev, uint64_t buf_size, char* buf_location) {
   struct rdma_buff_t* rdma_buffer;
-  rdma_buffer = (struct rdma_buff_t*) malloc(sizeof(struct rdma_buff_t));
-  if(rdma_buffer == NULL) {
-    fprintf(stderr, "Error: failed to create rdma_buffer\n");
-    exit(EXIT_FAILURE);
-  }
+  rdma_buffer = get_rdma_buff_desc(rn_dev);
 
   if(!strcmp(buf_location, HOST_MEM)) {
     // Allocate the buffer in the host memory
-    // Check the buffer_offset and buf_size whether it meets 4KB alignment or not
-    if (buf_size <= HARDWARE_PAGE_SIZE) {
-      if (((rn_dev->buffer_offset & HARDWARE_PAGE_SIZE_ADDRESS_MASK) + buf_size) > HARDWARE_PAGE_SIZE) {
-        rn_dev->buffer_offset =  (rn_dev->buffer_offset + HARDWARE_PAGE_SIZE) & HARDWARE_PAGE_SIZE_ALIGNMENT_MASK;
-      }
-    } else {
-      // buf_size > HARDWARE_PAGE_SIZE
-      if((rn_dev->buffer_offset & HARDWARE_PAGE_SIZE_ADDRESS_MASK) != 0) {
-        // buffer_offset is not aligned with HARDWARE_PAGE_SIZE
-        rn_dev->buffer_offset =  (rn_dev->buffer_offset + HARDWARE_PAGE_SIZE) & HARDWARE_PAGE_SIZE_ALIGNMENT_MASK;
-      }
+    if(allocate_host_block(rn_dev, rdma_buffer, buf_size) != 0) {
+      fprintf(stderr, "Error: failed to allocate %ld bytes of host memory\n", buf_size);
+      dump_host_mem_stats(rn_dev);
+      exit(EXIT_FAILURE);
     }
-    rdma_buffer->buffer = (void*)((uint64_t) rn_dev->base_buf->buffer + rn_dev->buffer_offset);
-    rn_dev->buffer_offset += buf_size;
-    rdma_buffer->buf_size = buf_size;
-
-    // Get the physical address of the buffer
-    rdma_buffer->dma_addr = get_buffer_paddr(rdma_buffer->buffer);
     Debug("Info: allocated host buffer vir addr = %p, physical addr = %lx, rn_dev->buffer_offset = 0x%lx\n", rdma_buffer->buffer, rdma_buffer->dma_addr, rn_dev->buffer_offset);
     Debug("Info: allocate_rdma_buffer - successfully allocated rdma host buffer\n");
   } else {
     if (!strcmp(buf_location, DEVICE_MEM)) {
       // Allocate the buffer in the device memory
-      // TODO: We need to implement user-space device memory management function
-      // Check the dev_buffer_offset and buf_size whether it meets 4KB alignment or not
-      if (buf_size <= HARDWARE_PAGE_SIZE) {
-        if (((rn_dev->dev_buffer_offset & HARDWARE_PAGE_SIZE_ADDRESS_MASK) + buf_size) > HARDWARE_PAGE_SIZE) {
-          rn_dev->dev_buffer_offset =  (rn_dev->dev_buffer_offset + HARDWARE_PAGE_SIZE) & HARDWARE_PAGE_SIZE_ALIGNMENT_MASK;
-        }
-      } else {
-        // buf_size > HARDWARE_PAGE_SIZE
-        if((rn_dev->dev_buffer_offset & HARDWARE_PAGE_SIZE_ADDRESS_MASK) != 0) {
-          // dev_buffer_offset is not aligned with HARDWARE_PAGE_SIZE
-          rn_dev->dev_buffer_offset =  (rn_dev->dev_buffer_offset + HARDWARE_PAGE_SIZE) & HARDWARE_PAGE_SIZE_ALIGNMENT_MASK;
-        }
+      if(allocate_dev_block(rn_dev, rdma_buffer, buf_size) != 0) {
+        fprintf(stderr, "Error: failed to allocate %ld bytes of device memory\n", buf_size);
+        dump_dev_mem_stats(rn_dev);
+        exit(EXIT_FAILURE);
       }
-      rdma_buffer->buffer = (void*)(rn_dev->dev_buffer_offset | DEVICE_MEM_OFFSET);
-      rdma_buffer->dma_addr = (uint64_t) (rn_dev->dev_buffer_offset | DEVICE_MEM_OFFSET);
-      rn_dev->dev_buffer_offset += buf_size;
-      rdma_buffer->buf_size = buf_size;
-
-      // TODO: We need to put assert here later to make sure we won't exceed device memory.
       Debug("Info: allocated device buffer physical addr = %lx, rn_dev->dev_buffer_offset = 0x%lx\n", rdma_buffer->dma_addr, rn_dev->dev_buffer_offset);
-      assert(rn_dev->dev_buffer_offset <= (uint64_t) DEVICE_MEM_SIZE);
     Debug("Info: allocate_rdma_buffer - successfully allocated rdma device buffer\n");
     } else {
       fprintf(stderr, "Error: please provide correct buffer location: [host_mem | dev_mem]\n");
@@ -265,8 +653,771 @@ struct rdma_buff_t* allocate_rdma_buffer(struct rn_dev_t* rn_dev, uint64_t buf_s
   return rdma_buffer;
 }
 
+/* A host buffer outside the hugepage buffer reservation was registered by register_rdma_buffer() */
+static uint8_t is_registered_buffer(struct rn_dev_t* rn_dev, struct rdma_buff_t* rdma_buffer) {
+  uint64_t offset = (uint64_t) rdma_buffer->buffer - (uint64_t) rn_dev->base_buf->buffer;
+
+  if(is_device_address((uint64_t) rdma_buffer->buffer)) {
+    return 0;
+  }
+  return offset >= ((uint64_t) rn_dev->hugepage_config.max_hugepages << rn_dev->hugepage_shift);
+}
+
+uint64_t get_rdma_buffer_paddr(struct rn_dev_t* rn_dev, struct rdma_buff_t* rdma_buffer, uint64_t offset, 
+                               uint64_t length, uint64_t* contig_len) {
+  uint64_t page_size;
+  uint64_t pool_offset;
+  uint64_t paddr;
+  uint64_t len;
+
+  // Device memory, registered buffers and buffers outside the hugepage buffer are 
+  // contiguous from dma_addr
+  if((rn_dev == NULL) || (rn_dev->hugepage_paddr == NULL) || is_device_address(rdma_buffer->dma_addr) || 
+     is_registered_buffer(rn_dev, rdma_buffer)) {
+    if(contig_len != NULL) {
+      *contig_len = length;
+    }
+    return rdma_buffer->dma_addr + offset;
+  }
+
+  page_size = 1UL << rn_dev->hugepage_shift;
+  pool_offset = (uint64_t) rdma_buffer->buffer + offset - (uint64_t) rn_dev->base_buf->buffer;
+  paddr = get_hugepage_buffer_paddr(rn_dev, (void* ) ((uint64_t) rdma_buffer->buffer + offset));
+  len = page_size - (pool_offset & (page_size - 1));
+  // Extend the range over the following hugepages while they are physically adjacent
+  while((len < length) && 
+        (get_hugepage_buffer_paddr(rn_dev, (void* ) ((uint64_t) rdma_buffer->buffer + offset + len)) == paddr + len)) {
+    len += page_size;
+  }
+  if(contig_len != NULL) {
+    *contig_len = (len < length) ? len : length;
+  }
+  return paddr;
+}
+
+uint64_t get_rdma_buffer_block_size(struct rn_dev_t* rn_dev, struct rdma_buff_t* rdma_buffer) {
+  uint64_t block_size = 0;
+
+  if(is_device_address((uint64_t) rdma_buffer->buffer)) {
+    block_size = mem_alloc_usable_size(rn_dev->dev_mem->channels[get_dev_buffer_channel(rn_dev, rdma_buffer)], 
+                                       get_dev_channel_offset(rn_dev, rdma_buffer));
+  } else if(!is_registered_buffer(rn_dev, rdma_buffer)) {
+    block_size = mem_alloc_usable_size(rn_dev->host_alloc, (uint64_t) rdma_buffer->buffer - (uint64_t) rn_dev->base_buf->buffer);
+  }
+
+  // Registered buffers are not taken from an allocator
+  return (block_size == 0) ? rdma_buffer->buf_size : block_size;
+}
+
+void free_rdma_buffer(struct rn_dev_t* rn_dev, struct rdma_buff_t* rdma_buffer) {
+  if(rdma_buffer == NULL) {
+    return;
+  }
+
+  if(is_registered_buffer(rn_dev, rdma_buffer)) {
+    deregister_rdma_buffer(rn_dev, rdma_buffer);
+    return;
+  }
+
+  rdma_mr_cache_invalidate((struct rdma_dev_t* ) rn_dev->rdma_dev, rdma_buffer->buffer, rdma_buffer->buf_size);
+
+  if(is_device_address((uint64_t) rdma_buffer->buffer)) {
+    if(mem_alloc_free(rn_dev->dev_mem->channels[get_dev_buffer_channel(rn_dev, rdma_buffer)], 
+                      get_dev_channel_offset(rn_dev, rdma_buffer)) != 0) {
+      fprintf(stderr, "Error: failed to free device buffer 0x%lx\n", rdma_buffer->dma_addr);
+      return;
+    }
+  } else {
+    if(mem_alloc_free(rn_dev->host_alloc, (uint64_t) rdma_buffer->buffer - (uint64_t) rn_dev->base_buf->buffer) != 0) {
+      fprintf(stderr, "Error: failed to free host buffer %p\n", rdma_buffer->buffer);
+      return;
+    }
+    rn_dev->buff_pool->host_bytes_requested -= rdma_buffer->buf_size;
+  }
+
+  rdma_buffer->buffer = NULL;
+  put_rdma_buff_desc(rn_dev, rdma_buffer);
+}
+
+/* Pages [start, end) are mapped and locked, read from the VmFlags of /proc/self/smaps */
+static uint8_t is_locked_range(uint64_t start, uint64_t end) {
+  FILE* fp = fopen("/proc/self/smaps", "r");
+  char line[4096];
+  uint64_t vma_start;
+  uint64_t vma_end;
+  uint64_t covered = start;
+  uint8_t overlap = 0;
+  uint8_t locked = 1;
+
+  if(fp == NULL) {
+    return 0;
+  }
+  while(locked && (fgets(line, sizeof(line), fp) != NULL)) {
+    if(sscanf(line, "%lx-%lx ", &vma_start, &vma_end) == 2) {
+      overlap = (vma_start < end) && (vma_end > start);
+      if(overlap) {
+        // VMAs are listed in ascending order, a hole is an unmapped page
+        locked = vma_start <= covered;
+        covered = vma_end;
+      }
+    } else if(overlap && (strncmp(line, "VmFlags:", 8) == 0)) {
+      locked = strstr(line, " lo") != NULL;
+    }
+  }
+  fclose(fp);
+
+  return locked && (covered >= end);
+}
+
+/* Unlock pages [start, end) of reg except those of other registered buffers, which
+ * take over the lock of their pages */
+static void unlock_unshared_range(struct rn_dev_t* rn_dev, struct rdma_buff_reg_t* reg, uint64_t start, uint64_t end) {
+  struct rdma_buff_reg_t* other;
+
+  if(start >= end) {
+    return;
+  }
+  for(other = rn_dev->buff_regs; other != NULL; other = other->next) {
+    if((other != reg) && (other->start < end) && (other->end > start)) {
+      other->locked = 1;
+      unlock_unshared_range(rn_dev, reg, start, other->start);
+      unlock_unshared_range(rn_dev, reg, other->end, end);
+      return;
+    }
+  }
+  munlock((void* ) start, end - start);
+}
+
+struct rdma_buff_t* register_rdma_buffer(struct rn_dev_t* rn_dev, void* buffer, uint64_t buf_size) {
+  struct rdma_buff_reg_t* reg = NULL;
+  struct rdma_buff_t* rdma_buffer;
+  uint64_t first_page = (uint64_t) buffer & HARDWARE_PAGE_SIZE_ALIGNMENT_MASK;
+  uint64_t num_pages = ((((uint64_t) buffer + buf_size - 1) & HARDWARE_PAGE_SIZE_ALIGNMENT_MASK) - first_page) >> PAGE_SHIFT;
+  uint64_t batch;
+  uint64_t paddr = 0;
+  uint64_t bridge_addr;
+  uint64_t i;
+  uint64_t j;
+  void** vaddrs;
+  uint64_t* paddrs;
+
+  if((rn_dev == NULL) || (buffer == NULL) || (buf_size == 0)) {
+    fprintf(stderr, "Error: invalid buffer to register\n");
+    return NULL;
+  }
+  num_pages++;
+
+  reg = (struct rdma_buff_reg_t* ) malloc(sizeof(struct rdma_buff_reg_t));
+  if(reg == NULL) {
+    fprintf(stderr, "Error: failed to allocate registration of buffer %p\n", buffer);
+    return NULL;
+  }
+  reg->start = first_page;
+  reg->end = first_page + (num_pages << PAGE_SHIFT);
+  // Lock the buffer so that its physical pages do not change, unless it is locked already
+  reg->locked = !is_locked_range(reg->start, reg->end);
+  if(reg->locked && (mlock(buffer, buf_size) == -1)) {
+    fprintf(stderr, "Error: failed to lock buffer %p of %ld bytes in memory\n", buffer, buf_size);
+    free(reg);
+    return NULL;
+  }
+
+  // The hardware gets one address per buffer, so every page must follow the first one
+  vaddrs = (void** ) malloc(PAGEMAP_BATCH_ENTRIES * sizeof(void* ));
+  paddrs = (uint64_t* ) malloc(PAGEMAP_BATCH_ENTRIES * sizeof(uint64_t));
+  if((vaddrs == NULL) || (paddrs == NULL)) {
+    fprintf(stderr, "Error: failed to allocate page table of buffer %p\n", buffer);
+    goto fail;
+  }
+  for(i=0; i<num_pages; i+=batch) {
+    batch = (num_pages - i < PAGEMAP_BATCH_ENTRIES) ? num_pages - i : PAGEMAP_BATCH_ENTRIES;
+    for(j=0; j<batch; j++) {
+      vaddrs[j] = (void* ) (first_page + ((i + j) << PAGE_SHIFT));
+    }
+    if(get_buffer_paddrs(vaddrs, paddrs, (uint32_t) batch) != 0) {
+      fprintf(stderr, "Error: failed to translate addresses of buffer %p\n", buffer);
+      goto fail;
+    }
+    if(i == 0) {
+      paddr = paddrs[0];
+      if(paddr == 0) {
+        fprintf(stderr, "Error: physical address of buffer %p is not readable, root privileges are required\n", buffer);
+        goto fail;
+      }
+    }
+    for(j=0; j<batch; j++) {
+      if(paddrs[j] != paddr + ((i + j) << PAGE_SHIFT)) {
+        fprintf(stderr, "Error: buffer %p of %ld bytes is not physically contiguous at offset 0x%lx\n", 
+                buffer, buf_size, ((i + j) << PAGE_SHIFT) - ((uint64_t) buffer - first_page));
+        goto fail;
+      }
+    }
+  }
+  free(vaddrs);
+  free(paddrs);
+  vaddrs = NULL;
+  paddrs = NULL;
+
+  paddr += (uint64_t) buffer - first_page;
+  bridge_addr = map_axib_bdf_window(rn_dev, paddr, buf_size);
+  if(bridge_addr == AXIB_BDF_MAP_FAILED) {
+    goto fail;
+  }
+
+  rdma_buffer = get_rdma_buff_desc(rn_dev);
+  rdma_buffer->buffer = buffer;
+  rdma_buffer->buf_size = buf_size;
+  rdma_buffer->dma_addr = bridge_addr;
+  reg->rdma_buffer = rdma_buffer;
+  reg->next = rn_dev->buff_regs;
+  rn_dev->buff_regs = reg;
+  Debug("Info: registered buffer %p of %ld bytes, physical addr = 0x%lx, bridge addr = 0x%lx, locked by %s\n", 
+        buffer, buf_size, paddr, bridge_addr, reg->locked ? "library" : "application");
+
+  return rdma_buffer;
+
+fail:
+  free(vaddrs);
+  free(paddrs);
+  if(reg->locked) {
+    unlock_unshared_range(rn_dev, reg, reg->start, reg->end);
+  }
+  free(reg);
+  return NULL;
+}
+
+void deregister_rdma_buffer(struct rn_dev_t* rn_dev, struct rdma_buff_t* rdma_buffer) {
+  struct rdma_buff_reg_t** prev;
+  struct rdma_buff_reg_t* reg;
+
+  if((rdma_buffer == NULL) || (rdma_buffer->buffer == NULL)) {
+    return;
+  }
+
+  for(prev = &rn_dev->buff_regs; (*prev != NULL) && ((*prev)->rdma_buffer != rdma_buffer); prev = &(*prev)->next);
+  reg = *prev;
+  if(reg == NULL) {
+    fprintf(stderr, "Error: buffer %p was not registered by register_rdma_buffer()\n", rdma_buffer->buffer);
+    return;
+  }
+  *prev = reg->next;
+
+  rdma_mr_cache_invalidate((struct rdma_dev_t* ) rn_dev->rdma_dev, rdma_buffer->buffer, rdma_buffer->buf_size);
+  unmap_axib_bdf_window(rn_dev, rdma_buffer->dma_addr);
+  if(reg->locked) {
+    unlock_unshared_range(rn_dev, reg, reg->start, reg->end);
+  }
+  free(reg);
+  rdma_buffer->buffer = NULL;
+  put_rdma_buff_desc(rn_dev, rdma_buffer);
+}
+
+static struct rdma_buff_t* realloc_dev_buffer(struct rn_dev_t* rn_dev, struct rdma_buff_t* rdma_buffer, uint64_t buf_size) {
+  struct rdma_buff_t old_buffer = *rdma_buffer;
+  uint32_t channel = get_dev_buffer_channel(rn_dev, rdma_buffer);
+  uint64_t offset = get_dev_channel_offset(rn_dev, rdma_buffer);
+  char* bounce;
+
+  if(buf_size <= mem_alloc_usable_size(rn_dev->dev_mem->channels[channel], offset)) {
+    rdma_buffer->buf_size = buf_size;
+    return rdma_buffer;
+  }
+
+  bounce = (char* ) malloc(old_buffer.buf_size);
+  if(bounce == NULL) {
+    fprintf(stderr, "Error: failed to allocate bounce buffer\n");
+    return NULL;
+  }
+  if(allocate_dev_block_on_channel(rn_dev, rdma_buffer, buf_size, channel) != 0) {
+    fprintf(stderr, "Error: failed to reallocate %ld bytes of device memory\n", buf_size);
+    *rdma_buffer = old_buffer;
+    free(bounce);
+    return NULL;
+  }
+  if((read_to_buffer(device, fpga_fd, bounce, old_buffer.buf_size, old_buffer.dma_addr) < 0) || 
+     (write_from_buffer(device, fpga_fd, bounce, old_buffer.buf_size, rdma_buffer->dma_addr) < 0)) {
+    fprintf(stderr, "Error: failed to copy device buffer 0x%lx\n", old_buffer.dma_addr);
+    mem_alloc_free(rn_dev->dev_mem->channels[channel], get_dev_channel_offset(rn_dev, rdma_buffer));
+    *rdma_buffer = old_buffer;
+    free(bounce);
+    return NULL;
+  }
+  rdma_mr_cache_invalidate((struct rdma_dev_t* ) rn_dev->rdma_dev, old_buffer.buffer, old_buffer.buf_size);
+  mem_alloc_free(rn_dev->dev_mem->channels[channel], offset);
+  free(bounce);
+  Debug("Info: reallocated device buffer 0x%lx -> 0x%lx, size %ld -> %ld\n", old_buffer.dma_addr, rdma_buffer->dma_addr, old_buffer.buf_size, buf_size);
+
+  return rdma_buffer;
+}
+
+struct rdma_buff_t* realloc_rdma_buffer(struct rn_dev_t* rn_dev, struct rdma_buff_t* rdma_buffer, uint64_t buf_size) {
+  struct rdma_buff_t old_buffer;
+  uint64_t offset;
+
+  if(is_registered_buffer(rn_dev, rdma_buffer)) {
+    fprintf(stderr, "Error: registered buffer %p cannot be resized\n", rdma_buffer->buffer);
+    return NULL;
+  }
+  if(is_device_address((uint64_t) rdma_buffer->buffer)) {
+    return realloc_dev_buffer(rn_dev, rdma_buffer, buf_size);
+  }
+
+  offset = (uint64_t) rdma_buffer->buffer - (uint64_t) rn_dev->base_buf->buffer;
+  if(buf_size <= mem_alloc_usable_size(rn_dev->host_alloc, offset)) {
+    rn_dev->buff_pool->host_bytes_requested += buf_size - rdma_buffer->buf_size;
+    rdma_buffer->buf_size = buf_size;
+    return rdma_buffer;
+  }
+
+  old_buffer = *rdma_buffer;
+  if(allocate_host_block(rn_dev, rdma_buffer, buf_size) != 0) {
+    fprintf(stderr, "Error: failed to reallocate %ld bytes of host memory\n", buf_size);
+    *rdma_buffer = old_buffer;
+    return NULL;
+  }
+  memcpy(rdma_buffer->buffer, old_buffer.buffer, old_buffer.buf_size);
+  rdma_mr_cache_invalidate((struct rdma_dev_t* ) rn_dev->rdma_dev, old_buffer.buffer, old_buffer.buf_size);
+  mem_alloc_free(rn_dev->host_alloc, offset);
+  rn_dev->buff_pool->host_bytes_requested -= old_buffer.buf_size;
+  Debug("Info: reallocated host buffer %p -> %p, size %ld -> %ld\n", old_buffer.buffer, rdma_buffer->buffer, old_buffer.buf_size, buf_size);
+
+  return rdma_buffer;
+}
+
+int config_rn_dev_mem(struct rn_dev_t* rn_dev, uint32_t num_channels, uint64_t channel_size, 
+                      enum dev_mem_placement_t placement) {
+  struct dev_mem_t* dev_mem;
+  uint32_t i;
+
+  if(rn_dev->dev_mem != NULL) {
+    fprintf(stderr, "Error: device memory is already configured\n");
+    return -1;
+  }
+  if((num_channels == 0) || (num_channels > DEVICE_MEM_MAX_CHANNELS) || 
+     (channel_size & ((1UL << DEVICE_MEM_BLOCK_SHIFT) - 1)) || 
+     (num_channels * channel_size - 1 > DEVICE_MEMORY_ADDRESS_MASK)) {
+    fprintf(stderr, "Error: invalid device memory configuration: %d channels of 0x%lx bytes\n", num_channels, channel_size);
+    return -1;
+  }
+
+  dev_mem = (struct dev_mem_t* ) calloc(1, sizeof(struct dev_mem_t));
+  if(dev_mem == NULL) {
+    fprintf(stderr, "Error: failed to allocate dev_mem\n");
+    return -1;
+  }
+  dev_mem->num_channels = num_channels;
+  dev_mem->channel_size = channel_size;
+  dev_mem->placement    = placement;
+  for(i=0; i<num_channels; i++) {
+    dev_mem->channels[i] = mem_alloc_create(channel_size, DEVICE_MEM_BLOCK_SHIFT);
+    if(dev_mem->channels[i] == NULL) {
+      while(i-- > 0) {
+        mem_alloc_destroy(dev_mem->channels[i]);
+      }
+      free(dev_mem);
+      return -1;
+    }
+  }
+
+  rn_dev->dev_mem = dev_mem;
+  Debug("Info: device memory configured with %d channels of 0x%lx bytes\n", num_channels, channel_size);
+  return 0;
+}
+
+struct rdma_buff_t* allocate_dev_buffer_on_channel(struct rn_dev_t* rn_dev, uint64_t buf_size, uint32_t channel) {
+  struct rdma_buff_t* rdma_buffer = get_rdma_buff_desc(rn_dev);
+
+  if(allocate_dev_block_on_channel(rn_dev, rdma_buffer, buf_size, channel) != 0) {
+    put_rdma_buff_desc(rn_dev, rdma_buffer);
+    return NULL;
+  }
+  return rdma_buffer;
+}
+
+uint32_t get_dev_buffer_channel(struct rn_dev_t* rn_dev, struct rdma_buff_t* rdma_buffer) {
+  return (uint32_t) ((rdma_buffer->dma_addr & ~DEVICE_MEM_MASK) / rn_dev->dev_mem->channel_size);
+}
+
+struct dev_stripe_buff_t* allocate_striped_dev_buffer(struct rn_dev_t* rn_dev, uint64_t buf_size, uint64_t stripe_size) {
+  struct dev_mem_t* dev_mem = get_dev_mem(rn_dev);
+  struct dev_stripe_buff_t* stripe;
+  uint64_t num_units;
+  uint64_t segment_size;
+  uint32_t i;
+
+  if((stripe_size == 0) || (stripe_size & HARDWARE_PAGE_SIZE_ADDRESS_MASK)) {
+    fprintf(stderr, "Error: stripe size 0x%lx is not a multiple of %d\n", stripe_size, HARDWARE_PAGE_SIZE);
+    return NULL;
+  }
+
+  stripe = (struct dev_stripe_buff_t* ) calloc(1, sizeof(struct dev_stripe_buff_t));
+  if(stripe == NULL) {
+    fprintf(stderr, "Error: failed to allocate dev_stripe_buff_t\n");
+    return NULL;
+  }
+  stripe->buf_size     = buf_size;
+  stripe->stripe_size  = stripe_size;
+  stripe->num_segments = dev_mem->num_channels;
+
+  num_units = (buf_size + stripe_size - 1) / stripe_size;
+  segment_size = ((num_units + stripe->num_segments - 1) / stripe->num_segments) * stripe_size;
+  for(i=0; i<stripe->num_segments; i++) {
+    stripe->segments[i] = allocate_dev_buffer_on_channel(rn_dev, segment_size, i);
+    if(stripe->segments[i] == NULL) {
+      fprintf(stderr, "Error: failed to allocate 0x%lx bytes on device memory channel %d\n", segment_size, i);
+      free_striped_dev_buffer(rn_dev, stripe);
+      return NULL;
+    }
+  }
+
+  return stripe;
+}
+
+void free_striped_dev_buffer(struct rn_dev_t* rn_dev, struct dev_stripe_buff_t* stripe) {
+  uint32_t i;
+
+  if(stripe != NULL) {
+    for(i=0; i<stripe->num_segments; i++) {
+      free_rdma_buffer(rn_dev, stripe->segments[i]);
+    }
+    free(stripe);
+  }
+}
+
+uint64_t get_striped_dev_addr(struct dev_stripe_buff_t* stripe, uint64_t offset, uint64_t* len) {
+  uint64_t unit = offset / stripe->stripe_size;
+  uint64_t in_unit = offset % stripe->stripe_size;
+  struct rdma_buff_t* segment = stripe->segments[unit % stripe->num_segments];
+
+  if(len != NULL) {
+    *len = stripe->stripe_size - in_unit;
+  }
+  return segment->dma_addr + (unit / stripe->num_segments) * stripe->stripe_size + in_unit;
+}
+
+/* Copy data between host memory and a striped buffer, one stripe unit at a time */
+static ssize_t copy_striped_dev_buffer(struct dev_stripe_buff_t* stripe, char* buffer, uint64_t size, uint64_t offset, uint8_t is_write) {
+  uint64_t count = 0;
+  uint64_t len;
+  uint64_t addr;
+  ssize_t rc;
+
+  if(offset + size > stripe->buf_size) {
+    fprintf(stderr, "Error: access of 0x%lx bytes at 0x%lx exceeds striped buffer of 0x%lx bytes\n", size, offset, stripe->buf_size);
+    return -EIO;
+  }
+
+  while(count < size) {
+    addr = get_striped_dev_addr(stripe, offset + count, &len);
+    if(len > size - count) {
+      len = size - count;
+    }
+    if(is_write) {
+      rc = write_from_buffer(device, fpga_fd, buffer + count, len, addr);
+    } else {
+      rc = read_to_buffer(device, fpga_fd, buffer + count, len, addr);
+    }
+    if(rc < 0) {
+      return rc;
+    }
+    count += len;
+  }
+
+  return count;
+}
+
+ssize_t write_striped_dev_buffer(struct dev_stripe_buff_t* stripe, char* buffer, uint64_t size, uint64_t offset) {
+  return copy_striped_dev_buffer(stripe, buffer, size, offset, 1);
+}
+
+ssize_t read_striped_dev_buffer(struct dev_stripe_buff_t* stripe, char* buffer, uint64_t size, uint64_t offset) {
+  return copy_striped_dev_buffer(stripe, buffer, size, offset, 0);
+}
+
+void dump_dev_mem_stats(struct rn_dev_t* rn_dev) {
+  char name[32];
+  uint32_t i;
+
+  if((rn_dev == NULL) || (rn_dev->dev_mem == NULL)) {
+    return;
+  }
+
+  for(i=0; i<rn_dev->dev_mem->num_channels; i++) {
+    snprintf(name, sizeof(name), "device memory channel %d", i);
+    mem_alloc_dump_stats(rn_dev->dev_mem->channels[i], name);
+  }
+}
+
+void dump_host_mem_stats(struct rn_dev_t* rn_dev) {
+  struct mem_alloc_stats_t stats;
+
+  if((rn_dev == NULL) || (rn_dev->host_alloc == NULL)) {
+    return;
+  }
+
+  mem_alloc_dump_stats(rn_dev->host_alloc, "host memory");
+  mem_alloc_get_stats(rn_dev->host_alloc, &stats);
+  fprintf(stderr, "Info: host memory: requested = 0x%lx, internal fragmentation = 0x%lx, descriptors in use = %ld of %d\n",
+          rn_dev->buff_pool->host_bytes_requested, stats.bytes_in_use - rn_dev->buff_pool->host_bytes_requested,
+          rn_dev->buff_pool->num_in_use, rn_dev->buff_pool->num_chunks * RDMA_BUFF_POOL_CHUNK);
+}
+
+void destroy_rdma_buffer_pool(struct rn_dev_t* rn_dev) {
+  uint32_t i;
+
+  if(rn_dev->buff_pool != NULL) {
+    for(i=0; i<rn_dev->buff_pool->num_chunks; i++) {
+      free(rn_dev->buff_pool->chunks[i]);
+    }
+    free(rn_dev->buff_pool->chunks);
+    free(rn_dev->buff_pool->free_desc);
+    free(rn_dev->buff_pool);
+    rn_dev->buff_pool = NULL;
+  }
+  mem_alloc_destroy(rn_dev->host_alloc);
+  rn_dev->host_alloc = NULL;
+  if(rn_dev->dev_mem != NULL) {
+    for(i=0; i<rn_dev->dev_mem->num_channels; i++) {
+      mem_alloc_destroy(rn_dev->dev_mem->channels[i]);
+    }
+    free(rn_dev->dev_mem);
+    rn_dev->dev_mem = NULL;
+  }
+}
+
+/*! \struct prefault_arg_t
+    \brief Hugepages touched by a prefault thread.
+*/
+struct prefault_arg_t {
+  char* addr;         /*!< addr First hugepage. */
+  uint64_t size;      /*!< size Number of bytes to touch. */
+  uint64_t page_size; /*!< page_size Hugepage size. */
+};
+
+static void* prefault_thread(void* arg) {
+  struct prefault_arg_t* prefault = (struct prefault_arg_t* ) arg;
+  uint64_t offset;
+
+  for(offset = 0; offset < prefault->size; offset += prefault->page_size) {
+    ((volatile char* ) prefault->addr)[offset] = 0;
+  }
+  return NULL;
+}
+
+/* Touch hugepages from several threads, so that they are faulted in in parallel */
+static void prefault_hugepages(char* addr, uint32_t num_hugepages, uint32_t hugepage_shift, uint32_t num_threads) {
+  struct prefault_arg_t* args;
+  pthread_t* threads;
+  uint32_t first = 0;
+  uint32_t num;
+  uint32_t i;
+
+  if(num_threads > num_hugepages) {
+    num_threads = num_hugepages;
+  }
+  args = (struct prefault_arg_t* ) malloc(num_threads * sizeof(struct prefault_arg_t));
+  threads = (pthread_t* ) malloc(num_threads * sizeof(pthread_t));
+  if((num_threads <= 1) || (args == NULL) || (threads == NULL)) {
+    struct prefault_arg_t prefault = {addr, (uint64_t) num_hugepages << hugepage_shift, 1UL << hugepage_shift};
+    prefault_thread(&prefault);
+    free(args);
+    free(threads);
+    return;
+  }
+
+  for(i=0; i<num_threads; i++) {
+    num = num_hugepages / num_threads + ((i < num_hugepages % num_threads) ? 1 : 0);
+    args[i].addr      = addr + ((uint64_t) first << hugepage_shift);
+    args[i].size      = (uint64_t) num << hugepage_shift;
+    args[i].page_size = 1UL << hugepage_shift;
+    if(pthread_create(&threads[i], NULL, prefault_thread, &args[i]) != 0) {
+      prefault_thread(&args[i]);
+      threads[i] = 0;
+    }
+    first += num;
+  }
+  for(i=0; i<num_threads; i++) {
+    if(threads[i] != 0) {
+      pthread_join(threads[i], NULL);
+    }
+  }
+
+  free(args);
+  free(threads);
+}
+
+static uint64_t elapsed_ns(struct timespec* start) {
+  struct timespec end;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  timespec_sub(&end, start);
+  return (uint64_t) end.tv_sec * 1000000000UL + (uint64_t) end.tv_nsec;
+}
+
+/* Reserve virtual address space for the whole hugepage buffer, aligned to the hugepage size */
+static int reserve_hugepage_pool(struct rn_dev_t* rn_dev) {
+  uint64_t page_size = 1UL << rn_dev->hugepage_shift;
+  uint64_t pool_size = (uint64_t) rn_dev->hugepage_config.max_hugepages << rn_dev->hugepage_shift;
+  uint64_t start;
+  uint64_t aligned;
+  void* addr;
+
+  addr = mmap(NULL, pool_size + page_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if(addr == MAP_FAILED) {
+    fprintf(stderr, "Error: failed to reserve 0x%lx bytes for the hugepage buffer\n", pool_size);
+    return -1;
+  }
+
+  start = (uint64_t) addr;
+  aligned = (start + page_size - 1) & ~(page_size - 1);
+  if(aligned != start) {
+    munmap(addr, aligned - start);
+  }
+  munmap((void* ) (aligned + pool_size), start + page_size - aligned);
+
+  rn_dev->base_buf->buffer = (void* ) aligned;
+  rn_dev->hugepage_paddr = (uint64_t* ) calloc(rn_dev->hugepage_config.max_hugepages, sizeof(uint64_t));
+  if(rn_dev->hugepage_paddr == NULL) {
+    fprintf(stderr, "Error: failed to allocate hugepage table\n");
+    return -1;
+  }
+  rn_dev->host_alloc = mem_alloc_create_reserved(pool_size, HARDWARE_PAGE_SHIFT);
+  if(rn_dev->host_alloc == NULL) {
+    fprintf(stderr, "Error: failed to create host buffer allocator\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+int grow_hugepage_pool(struct rn_dev_t* rn_dev, uint32_t num_hugepages) {
+  struct hugepage_pool_config_t* config = &rn_dev->hugepage_config;
+  uint32_t shift = rn_dev->hugepage_shift;
+  uint32_t first = rn_dev->num_hugepages;
+  uint64_t size = (uint64_t) num_hugepages << shift;
+  char* addr = (char* ) rn_dev->base_buf->buffer + ((uint64_t) first << shift);
+  struct axib_bdf_win_t saved[AXIB_BDF_NUM_WINDOWS];
+  uint8_t pinned = 0;
+  void** hugepage_vaddr;
+  struct timespec start;
+  struct timespec grow_start;
+  int flags = MAP_SHARED | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB | (shift << MAP_HUGE_SHIFT);
+  uint32_t i;
+
+  if((num_hugepages == 0) || (num_hugepages > config->max_hugepages - first)) {
+    fprintf(stderr, "Error: cannot grow the hugepage buffer of %d/%d hugepages by %d\n", first, config->max_hugepages, num_hugepages);
+    return -1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &grow_start);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if(config->prefault == HUGEPAGE_PREFAULT_POPULATE) {
+    flags |= MAP_POPULATE;
+  }
+  if(mmap(addr, size, PROT_READ | PROT_WRITE, flags, -1, 0) == MAP_FAILED) {
+    fprintf(stderr, "Error: failed to allocate %d hugepages of %ld bytes\n", num_hugepages, 1UL << shift);
+    goto fail;
+  }
+  if(config->prefault == HUGEPAGE_PREFAULT_THREADS) {
+    prefault_hugepages(addr, num_hugepages, shift, config->prefault_threads);
+  }
+  rn_dev->hugepage_stats.map_ns += elapsed_ns(&start);
+
+  // Lock the buffer in physical memory
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if(mlock(addr, size) == -1) {
+    fprintf(stderr, "Error: failed to lock page in memory\n");
+    goto fail;
+  }
+  rn_dev->hugepage_stats.lock_ns += elapsed_ns(&start);
+
+  // Record the physical address of every new hugepage once
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  hugepage_vaddr = (void** ) malloc(num_hugepages * sizeof(void* ));
+  if(hugepage_vaddr == NULL) {
+    fprintf(stderr, "Error: failed to allocate hugepage table\n");
+    goto fail;
+  }
+  for(i=0; i<num_hugepages; i++) {
+    hugepage_vaddr[i] = (void* ) (addr + ((uint64_t) i << shift));
+  }
+  if(get_buffer_paddrs(hugepage_vaddr, &rn_dev->hugepage_paddr[first], num_hugepages) != 0) {
+    fprintf(stderr, "Error: failed to translate hugepage addresses\n");
+    free(hugepage_vaddr);
+    goto fail;
+  }
+  free(hugepage_vaddr);
+  rn_dev->hugepage_stats.translate_ns += elapsed_ns(&start);
+  if(rn_dev->bdf.configured) {
+    memcpy(saved, rn_dev->bdf.win, sizeof(saved));
+    if(pin_axib_bdf_windows(rn_dev, first, num_hugepages) != 0) {
+      goto fail;
+    }
+    pinned = 1;
+  }
+
+  if(mem_alloc_add_range(rn_dev->host_alloc, (uint64_t) first << shift, size) != 0) {
+    goto fail;
+  }
+  rn_dev->num_hugepages += num_hugepages;
+  if(first != 0) {
+    rn_dev->hugepage_stats.grow_ns += elapsed_ns(&grow_start);
+    rn_dev->hugepage_stats.num_grows++;
+  }
+  Debug("Info: hugepage buffer grew to %d/%d hugepages\n", rn_dev->num_hugepages, config->max_hugepages);
+
+  return 0;
+
+fail:
+  // Unpin the windows of the new hugepages and put the reservation back in their place
+  if(pinned) {
+    restore_axib_bdf_windows(rn_dev, saved);
+  }
+  munlock(addr, size);
+  munmap(addr, size);
+  mmap(addr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+  return -1;
+}
+
+void dump_hugepage_pool_stats(struct rn_dev_t* rn_dev) {
+  struct hugepage_pool_stats_t* stats = &rn_dev->hugepage_stats;
+
+  fprintf(stderr, "Info: hugepage buffer: %d/%d hugepages of %ld bytes mapped, initialized in %.3f ms "
+                  "(map %.3f ms, lock %.3f ms, translate %.3f ms), grew %d times in %.3f ms\n",
+          rn_dev->num_hugepages, rn_dev->hugepage_config.max_hugepages, 1UL << rn_dev->hugepage_shift,
+          stats->init_ns / 1e6, stats->map_ns / 1e6, stats->lock_ns / 1e6, stats->translate_ns / 1e6,
+          stats->num_grows, stats->grow_ns / 1e6);
+}
+
+void hugepage_pool_config_init(struct hugepage_pool_config_t* config, uint32_t max_hugepages, uint32_t hugepage_shift) {
+  config->hugepage_shift    = hugepage_shift;
+  config->max_hugepages     = max_hugepages;
+  config->initial_hugepages = (uint32_t) ((HUGEPAGE_POOL_INITIAL_SIZE + (1UL << hugepage_shift) - 1) >> hugepage_shift);
+  config->grow_hugepages    = (uint32_t) ((HUGEPAGE_POOL_GROW_SIZE + (1UL << hugepage_shift) - 1) >> hugepage_shift);
+  if(config->initial_hugepages > max_hugepages) {
+    config->initial_hugepages = max_hugepages;
+  }
+  config->prefault          = HUGEPAGE_PREFAULT_MLOCK;
+  config->prefault_threads  = 1;
+}
+
 struct rn_dev_t* create_rn_dev(char* pcie_resource, int* pcie_resource_fd, uint32_t num_hugepages_request, uint32_t num_qp) {
+  return create_rn_dev_hugepage(pcie_resource, pcie_resource_fd, num_hugepages_request, num_qp, HUGE_PAGE_SHIFT);
+}
+
+struct rn_dev_t* create_rn_dev_hugepage(char* pcie_resource, int* pcie_resource_fd, uint32_t num_hugepages_request, 
+                                        uint32_t num_qp, uint32_t hugepage_shift) {
+  struct hugepage_pool_config_t config;
+
+  hugepage_pool_config_init(&config, num_hugepages_request, hugepage_shift);
+  return create_rn_dev_pool(pcie_resource, pcie_resource_fd, num_qp, &config);
+}
+
+struct rn_dev_t* create_rn_dev_pool(char* pcie_resource, int* pcie_resource_fd, uint32_t num_qp, 
+                                    struct hugepage_pool_config_t* config) {
   int scr;
+  uint32_t hugepage_shift = config->hugepage_shift;
+  struct timespec start;
   // int rdma = -1;
   void* axil_scr_base;
   uint32_t phy_addr_msb;
@@ -275,6 +1426,21 @@ struct rn_dev_t* create_rn_dev(char* pcie_resource, int* pcie_resource_fd, uint3
   struct rn_dev_t* rn_dev = NULL;
   struct win_size_t* winSize = NULL;
 
+  if((hugepage_shift != HUGE_PAGE_SHIFT) && (hugepage_shift != HUGE_PAGE_1GB_SHIFT)) {
+    fprintf(stderr, "Error: unsupported hugepage size %ld\n", 1UL << hugepage_shift);
+    exit(EXIT_FAILURE);
+  }
+  if((config->max_hugepages == 0) || (config->initial_hugepages == 0) || 
+     (config->initial_hugepages > config->max_hugepages)) {
+    fprintf(stderr, "Error: invalid hugepage buffer of %d initial and %d maximum hugepages\n", 
+            config->initial_hugepages, config->max_hugepages);
+    exit(EXIT_FAILURE);
+  }
+  if((num_qp == 0) || (num_qp > RDMA_MAX_NUM_QP)) {
+    fprintf(stderr, "Error: invalid number of QPs %d, it must be from 1 to %d\n", num_qp, RDMA_MAX_NUM_QP);
+    exit(EXIT_FAILURE);
+  }
+
   rn_dev = (struct rn_dev_t* ) malloc(sizeof(struct rn_dev_t));
   winSize = (struct win_size_t* ) malloc(sizeof(struct win_size_t));
 
@@ -286,6 +1452,16 @@ struct rn_dev_t* create_rn_dev(char* pcie_resource, int* pcie_resource_fd, uint3
   rn_dev->axil_map_size = RN_SCR_MAP_SIZE;
   rn_dev->rdma_dev = NULL;
   rn_dev->base_buf = NULL;
+  rn_dev->hugepage_paddr = NULL;
+  rn_dev->num_hugepages = 0;
+  rn_dev->hugepage_shift = hugepage_shift;
+  rn_dev->hugepage_config = *config;
+  memset(&rn_dev->hugepage_stats, 0, sizeof(struct hugepage_pool_stats_t));
+  memset(&rn_dev->bdf, 0, sizeof(struct axib_bdf_t));
+  rn_dev->buff_regs = NULL;
+  rn_dev->host_alloc = NULL;
+  rn_dev->dev_mem = NULL;
+  rn_dev->buff_pool = (struct rdma_buff_pool_t* ) calloc(1, sizeof(struct rdma_buff_pool_t));
   //rn_dev->rdma_dev->num_qp   = num_qp;
   rn_dev->winSize = winSize;
   rn_dev->winSize->win_size_lsb = 0;
@@ -319,17 +1495,14 @@ struct rn_dev_t* create_rn_dev(char* pcie_resource, int* pcie_resource_fd, uint3
   }
 
   fprintf(stderr, "create_rn_dev - testing2\n");
-  rn_dev->base_buf->buffer = mmap(NULL, num_hugepages_request * (1 << HUGE_PAGE_SHIFT),
-                                  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS |
-                                  MAP_HUGETLB, -1, 0);
-
-  // Lock the buffer in physical memory
-  if(mlock(rn_dev->base_buf->buffer, num_hugepages_request * (1 << HUGE_PAGE_SHIFT)) == -1) {
-    fprintf(stderr, "Error: failed to lock page in memory\n");
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if((reserve_hugepage_pool(rn_dev) != 0) || (grow_hugepage_pool(rn_dev, config->initial_hugepages) != 0)) {
     exit(EXIT_FAILURE);
   }
+  rn_dev->hugepage_stats.init_ns = elapsed_ns(&start);
+  dump_hugepage_pool_stats(rn_dev);
 
-  rn_dev->base_buf->dma_addr = get_buffer_paddr(rn_dev->base_buf->buffer);
+  rn_dev->base_buf->dma_addr = rn_dev->hugepage_paddr[0];
   fprintf(stderr, "Info: pre-allocated hugepage buffer vir addr = %p, physical addr = 0x%lx\n", rn_dev->base_buf->buffer, rn_dev->base_buf->dma_addr);
 
   phy_addr_msb = (uint32_t) ((rn_dev->base_buf->dma_addr & 0xffffffff00000000) >> 32);
@@ -338,6 +1511,11 @@ struct rn_dev_t* create_rn_dev(char* pcie_resource, int* pcie_resource_fd, uint3
   // Configure QDMA slave AXI bridge
   config_rn_dev_axib_bdf(rn_dev, phy_addr_msb, phy_addr_lsb);
 
+  if(rn_dev->buff_pool == NULL) {
+    fprintf(stderr, "Error: failed to create rdma_buff_t pool\n");
+    exit(EXIT_FAILURE);
+  }
+
   rn_dev->buffer_offset = (uint64_t) 0;
   rn_dev->dev_buffer_offset = (uint64_t) 0;
 
@@ -16,6 +16,7 @@
 #include "reconic_reg.h"
 #include "memory_api.h"
 #include "control_api.h"
+#include "mem_alloc.h"
 
 /*! \var device
     \brief A global string used to represent a character device for device memory access
@@ -41,11 +42,23 @@ extern int fpga_fd;
 /*! \def DEVICE_MEM_SIZE
     \brief A macro string to indicate device memory size in bytes.
 
-    The current implement leverages only one 4GB DDR4 memory on U250. Maximum number of 
-    DDR4 allowed on Alveo U250 is 4.
+    Default size of a device memory channel. The current shell leverages only one 4GB DDR4
+    memory on U250, see config_rn_dev_mem() for shells with more channels.
 */
 #define DEVICE_MEM_SIZE 4294967296
 
+/*! \def DEVICE_MEM_MAX_CHANNELS
+    \brief Maximum number of device memory channels. Alveo U250 has 4 DDR4 channels.
+*/
+#define DEVICE_MEM_MAX_CHANNELS 4
+
+/*! \def DEVICE_MEM_BLOCK_SHIFT
+    \brief log2 of the minimum block size of the device memory allocator (64KB).
+
+    Device buffers of up to 32KB are taken from size-class slabs.
+*/
+#define DEVICE_MEM_BLOCK_SHIFT 16
+
 /*! \def HARDWARE_PAGE_SIZE
     \brief HARDWARE_PAGE_SIZE is used to determine payload size per AXI4-MM transaction on hardware.
 
@@ -53,6 +66,11 @@ extern int fpga_fd;
 */
 #define HARDWARE_PAGE_SIZE 4096
 
+/*! \def HARDWARE_PAGE_SHIFT
+    \brief log2 of HARDWARE_PAGE_SIZE.
+*/
+#define HARDWARE_PAGE_SHIFT 12
+
 /*! \def HARDWARE_PAGE_SIZE_ALIGNMENT_MASK
     \brief HARDWARE_PAGE_SIZE_ALIGNMENT_MASK is used to get address aligned with HARDWARE_PAGE_SIZE.
 
@@ -81,12 +99,40 @@ extern int fpga_fd;
 */
 #define PAGEMAP_LENGTH  8
 
+/*! \def PAGEMAP_BATCH_ENTRIES
+    \brief Maximum number of pagemap entries read by one pread in get_buffer_paddrs().
+*/
+#define PAGEMAP_BATCH_ENTRIES (1 << 16)
+
 // 2MB for each huge page
 /*! \def HUGE_PAGE_SHIFT
     \brief It indicates 2MB for each hugepage.
 */
 #define HUGE_PAGE_SHIFT 21
 
+/*! \def HUGE_PAGE_1GB_SHIFT
+    \brief It indicates 1GB for each hugepage, see create_rn_dev_hugepage().
+*/
+#define HUGE_PAGE_1GB_SHIFT 30
+
+/*! \def RDMA_MAX_NUM_QP
+    \brief Largest number of RDMA queue pairs of a RecoNIC device.
+
+    The number of QPs enabled is the 8-bit field XRNICCONF[15:8] of ERNIC. The 
+    number of QPs actually implemented is set by C_NUM_QP when the ERNIC IP is built.
+*/
+#define RDMA_MAX_NUM_QP 255
+
+/*! \def HUGEPAGE_POOL_INITIAL_SIZE
+    \brief Default size in bytes mapped when the hugepage buffer is created.
+*/
+#define HUGEPAGE_POOL_INITIAL_SIZE (32UL << 20)
+
+/*! \def HUGEPAGE_POOL_GROW_SIZE
+    \brief Default size in bytes mapped each time the hugepage buffer grows.
+*/
+#define HUGEPAGE_POOL_GROW_SIZE (32UL << 20)
+
 /*! \def DEVICE_MEM_OFFSET
     \brief Device memory address offset.
 */
@@ -113,13 +159,152 @@ struct win_size_t {
   uint32_t win_size_msb; /*!< Window size mask MSB. */
 };
 
+/*! \def AXIB_BDF_NUM_WINDOWS
+    \brief Number of address translation windows in the BDF table of the QDMA AXI bridge.
+*/
+#define AXIB_BDF_NUM_WINDOWS 8
+
+/*! \def AXIB_BDF_WIN_SHIFT
+    \brief log2 of the size of a BDF window.
+
+    The AXI BAR of AXI_BAR_SIZE + 1 bytes (1TB) is split into AXIB_BDF_NUM_WINDOWS 
+    windows of 128GB. Window i serves bridge addresses [i << 37, (i + 1) << 37).
+*/
+#define AXIB_BDF_WIN_SHIFT 37
+
+/*! \def AXIB_BDF_MAP_FAILED
+    \brief Bridge address returned by map_axib_bdf_window() when no window is available.
+*/
+#define AXIB_BDF_MAP_FAILED 0xffffffffffffffff
+
+/*! \struct axib_bdf_win_t
+    \brief State of a BDF window.
+*/
+struct axib_bdf_win_t {
+  uint64_t host_addr; /*!< host_addr Host physical address the window translates to, a multiple of the window size. */
+  uint32_t refcnt;    /*!< refcnt Number of registered buffers using the window. */
+  uint8_t  pinned;    /*!< pinned 1 if hugepages of base_buf use the window, it is never reprogrammed. */
+};
+
+/*! \struct axib_bdf_t
+    \brief BDF windows of the QDMA AXI bridge.
+
+    Windows are programmed by config_rn_dev_axib_bdf() so that the bridge address of a
+    host physical address is its low 40 bits. A window whose refcnt drops to 0 keeps its 
+    translation until another host region needs a window.
+*/
+struct axib_bdf_t {
+  struct axib_bdf_win_t win[AXIB_BDF_NUM_WINDOWS]; /*!< win State of each window. */
+  uint8_t  configured;      /*!< configured 1 once config_rn_dev_axib_bdf() programmed the windows. */
+  uint64_t num_maps;        /*!< num_maps Number of map_axib_bdf_window() calls served. */
+  uint64_t num_reprograms;  /*!< num_reprograms Number of times a window was reprogrammed. */
+};
+
 /*! \struct rdma_buff_t
     \brief RDMA buffer structure.
 */
 struct rdma_buff_t {
   void* buffer;      /*!< buffer virtual address of an RDMA buffer. */
   uint64_t dma_addr; /*!< physical address of an RDMA buffer. */
-  uint32_t buf_size; /*!< buffer size. */
+  uint64_t buf_size; /*!< buffer size. */
+};
+
+/*! \def RDMA_BUFF_POOL_CHUNK
+    \brief Number of rdma_buff_t descriptors allocated at once by the descriptor pool.
+*/
+#define RDMA_BUFF_POOL_CHUNK 64
+
+/*! \struct rdma_buff_pool_t
+    \brief Pool of rdma_buff_t descriptors and usage of the host hugepage pool.
+*/
+struct rdma_buff_pool_t {
+  struct rdma_buff_t** free_desc;  /*!< free_desc Stack of free descriptors. */
+  uint32_t num_free;               /*!< num_free Number of free descriptors. */
+  struct rdma_buff_t** chunks;     /*!< chunks Descriptor arrays allocated by the pool. */
+  uint32_t num_chunks;             /*!< num_chunks Number of descriptor arrays. */
+  uint64_t num_in_use;             /*!< num_in_use Number of descriptors in use. */
+  uint64_t host_bytes_requested;   /*!< host_bytes_requested Bytes requested by live host buffers. */
+};
+
+/*! \enum dev_mem_placement_t
+    \brief Channel selection of device buffers allocated by allocate_rdma_buffer().
+*/
+enum dev_mem_placement_t {
+  DEV_MEM_PLACE_FIRST_FIT,   /*!< Use the lowest channel with enough free memory. */
+  DEV_MEM_PLACE_ROUND_ROBIN  /*!< Spread consecutive buffers over the channels. */
+};
+
+/*! \struct dev_mem_t
+    \brief Device memory channels and their allocators.
+
+    Channel i is at device address i * channel_size.
+*/
+struct dev_mem_t {
+  uint32_t num_channels;                  /*!< num_channels Number of device memory channels. */
+  uint64_t channel_size;                  /*!< channel_size Size of each channel in bytes. */
+  enum dev_mem_placement_t placement;     /*!< placement Channel selection policy. */
+  uint32_t next_channel;                  /*!< next_channel Next channel of round-robin placement. */
+  struct mem_alloc_t* channels[DEVICE_MEM_MAX_CHANNELS]; /*!< channels Allocator of each channel. */
+};
+
+/*! \struct dev_stripe_buff_t
+    \brief A device buffer striped over the device memory channels.
+
+    Stripe unit k of the buffer is at offset (k / num_segments) * stripe_size of 
+    segment k % num_segments, and segment i is allocated on channel i.
+*/
+struct dev_stripe_buff_t {
+  uint64_t buf_size;      /*!< buf_size buffer size. */
+  uint64_t stripe_size;   /*!< stripe_size Size of a stripe unit in bytes. */
+  uint32_t num_segments;  /*!< num_segments Number of segments, one per channel. */
+  struct rdma_buff_t* segments[DEVICE_MEM_MAX_CHANNELS]; /*!< segments Per-channel segments. */
+};
+
+/*! \enum hugepage_prefault_t
+    \brief How hugepages are faulted in when they are mapped.
+*/
+enum hugepage_prefault_t {
+  HUGEPAGE_PREFAULT_MLOCK,     /*!< Pages are faulted in by mlock() on the calling thread. */
+  HUGEPAGE_PREFAULT_POPULATE,  /*!< Pages are faulted in by mmap() with MAP_POPULATE. */
+  HUGEPAGE_PREFAULT_THREADS    /*!< Pages are touched by prefault_threads threads in parallel. */
+};
+
+/*! \struct hugepage_pool_config_t
+    \brief Configuration of the pre-allocated hugepage buffer.
+*/
+struct hugepage_pool_config_t {
+  uint32_t hugepage_shift;             /*!< hugepage_shift HUGE_PAGE_SHIFT or HUGE_PAGE_1GB_SHIFT. */
+  uint32_t max_hugepages;              /*!< max_hugepages Number of hugepages reserved. */
+  uint32_t initial_hugepages;          /*!< initial_hugepages Number of hugepages mapped at creation. */
+  uint32_t grow_hugepages;             /*!< grow_hugepages Minimum number of hugepages mapped per growth. */
+  enum hugepage_prefault_t prefault;   /*!< prefault How hugepages are faulted in. */
+  uint32_t prefault_threads;           /*!< prefault_threads Number of threads of HUGEPAGE_PREFAULT_THREADS. */
+};
+
+/*! \struct hugepage_pool_stats_t
+    \brief Timing of the hugepage buffer initialization and growth.
+*/
+struct hugepage_pool_stats_t {
+  uint64_t init_ns;       /*!< init_ns Time to reserve and map the initial hugepages. */
+  uint64_t map_ns;        /*!< map_ns Time spent in mmap() and prefaulting. */
+  uint64_t lock_ns;       /*!< lock_ns Time spent in mlock(). */
+  uint64_t translate_ns;  /*!< translate_ns Time spent reading physical addresses. */
+  uint64_t grow_ns;       /*!< grow_ns Time spent growing the buffer after creation. */
+  uint32_t num_grows;     /*!< num_grows Number of times the buffer grew after creation. */
+};
+
+/*! \struct rdma_buff_reg_t
+    \brief Record of a buffer registered by register_rdma_buffer().
+
+    A page range locked by the application before registration is not locked again,
+    so deregistration leaves the application's own lock in place.
+*/
+struct rdma_buff_reg_t {
+  struct rdma_buff_t* rdma_buffer; /*!< rdma_buffer Descriptor returned by register_rdma_buffer(). */
+  uint64_t start;                  /*!< start First page of the buffer. */
+  uint64_t end;                    /*!< end End of the last page of the buffer. */
+  uint8_t  locked;                 /*!< locked 1 if the library locked the pages with mlock(). */
+  struct rdma_buff_reg_t* next;    /*!< next Next registered buffer. */
 };
 
 /*! \struct rn_dev_t
@@ -131,10 +316,20 @@ struct rn_dev_t {
   struct rdma_buff_t* base_buf; /*!< base_buf Pre-allocated host buffer. */
   void* rdma_dev;               /*!< rdma_dev A RDMA device. 
                                      type: struct rdma_dev_t* */
-  uint64_t buffer_offset;       /*!< buffer_offset offset of a free pre-allocated buffer. */
-  uint64_t dev_buffer_offset;   /*!< dev_buffer_offset offset of a free device buffer. */
-  unsigned char num_qp;         /*!< num_qp Number of RDMA queue pairs required. */
+  uint64_t buffer_offset;       /*!< buffer_offset end of the highest buffer allocated from base_buf. */
+  uint64_t dev_buffer_offset;   /*!< dev_buffer_offset end of the highest device buffer allocated. */
+  uint32_t num_qp;              /*!< num_qp Number of RDMA queue pairs required, up to RDMA_MAX_NUM_QP. */
   struct win_size_t* winSize;   /*!< Window size mask for PCIe BDF address conversion. */
+  uint64_t* hugepage_paddr;     /*!< hugepage_paddr physical address of each hugepage of base_buf. */
+  uint32_t num_hugepages;       /*!< num_hugepages Number of hugepages mapped in base_buf. */
+  uint32_t hugepage_shift;      /*!< hugepage_shift log2 of the hugepage size of base_buf. */
+  struct mem_alloc_t* host_alloc;     /*!< host_alloc Allocator of the pre-allocated host buffer. */
+  struct rdma_buff_pool_t* buff_pool; /*!< buff_pool Pool of rdma_buff_t descriptors. */
+  struct dev_mem_t* dev_mem;          /*!< dev_mem Device memory allocator, created on first use. */
+  struct hugepage_pool_config_t hugepage_config; /*!< hugepage_config Configuration of base_buf. */
+  struct hugepage_pool_stats_t hugepage_stats;   /*!< hugepage_stats Timing of base_buf mapping. */
+  struct axib_bdf_t bdf;        /*!< bdf BDF windows of the QDMA AXI bridge. */
+  struct rdma_buff_reg_t* buff_regs; /*!< buff_regs Buffers registered by register_rdma_buffer(). */
 };
 
 /** @brief Convert IP address from string to unsigned int.
@@ -169,6 +364,8 @@ struct mac_addr_t get_mac_addr_from_str_ip(int sockfd, char* ip_str);
 uint8_t is_device_address(uint64_t address);
 
 /** @brief Get page frame number of a virtual address.
+ *
+ *  /proc/self/pagemap is opened once and kept open.
  *  @param addr a virtual address.
  *  @return Page frame number.
  */
@@ -180,6 +377,75 @@ unsigned long get_page_frame_number_of_address(void *addr);
  */
 uint64_t get_buffer_paddr(void *buffer);
 
+/** @brief Get physical addresses of an array of virtual addresses.
+ *
+ *  Addresses are sorted by page, and the pagemap entries of neighbouring pages, up to
+ *  PAGEMAP_BATCH_ENTRIES apart, are read with a single pread.
+ *  @param buffers an array of virtual addresses.
+ *  @param paddrs an array receiving the physical addresses.
+ *  @param num Number of addresses.
+ *  @return Success (0) or Failure (-1).
+ */
+int get_buffer_paddrs(void** buffers, uint64_t* paddrs, uint32_t num);
+
+/** @brief Get physical address of a virtual address, from the hugepage table of the 
+ *         RecoNIC device if the address is in the pre-allocated hugepage buffer.
+ *  @param rn_dev A pointer to the RecoNIC device.
+ *  @param buffer virtual address of a buffer.
+ *  @return Physical address of a buffer.
+ */
+uint64_t get_hugepage_buffer_paddr(struct rn_dev_t* rn_dev, void *buffer);
+
+/** @brief Split a buffer in the pre-allocated hugepage buffer into physically contiguous 
+ *         segments.
+ *
+ *  Neighbouring hugepages that are also physically adjacent are merged into one segment.
+ *  @param rn_dev A pointer to the RecoNIC device.
+ *  @param buffer virtual address of a buffer.
+ *  @param size buffer size.
+ *  @param paddrs an array receiving the physical address of each segment. Can be NULL.
+ *  @param lens an array receiving the length of each segment. Can be NULL.
+ *  @param max_segments Size of paddrs and lens.
+ *  @return Number of segments, which can exceed max_segments.
+ */
+uint32_t get_hugepage_buffer_segments(struct rn_dev_t* rn_dev, void* buffer, uint64_t size, 
+                                      uint64_t* paddrs, uint64_t* lens, uint32_t max_segments);
+
+/** @brief Get physical address of a byte of an RDMA buffer and the number of physically
+ *         contiguous bytes from there.
+ *
+ *  dma_addr of a host buffer spanning several hugepages is only valid within its first 
+ *  hugepage. Buffers in the pre-allocated hugepage buffer are translated through the 
+ *  hugepage table. Device memory and registered buffers are contiguous from dma_addr.
+ *  @param rn_dev A pointer to the RecoNIC device.
+ *  @param rdma_buffer A pointer to the RDMA buffer.
+ *  @param offset byte offset within the buffer.
+ *  @param length number of bytes needed from offset.
+ *  @param contig_len returns the number of physically contiguous bytes from offset, at 
+ *                    most length. Can be NULL.
+ *  @return Physical address of the byte at offset. For registered buffers, the bridge 
+ *          address of the BDF window.
+ */
+uint64_t get_rdma_buffer_paddr(struct rn_dev_t* rn_dev, struct rdma_buff_t* rdma_buffer, uint64_t offset, 
+                               uint64_t length, uint64_t* contig_len);
+
+/** @brief Get the size of the allocator block holding an RDMA buffer.
+ *
+ *  Buffers are served in power-of-two blocks, so a buffer can hold up to twice its
+ *  buf_size. This is the memory the buffer actually takes.
+ *  @param rn_dev A pointer to the RecoNIC device.
+ *  @param rdma_buffer A pointer to an RDMA buffer allocated by allocate_rdma_buffer().
+ *  @return Size in bytes of the block, or buf_size for a registered buffer.
+ */
+uint64_t get_rdma_buffer_block_size(struct rn_dev_t* rn_dev, struct rdma_buff_t* rdma_buffer);
+
+/** @brief Get virtual address of a physical address within the pre-allocated hugepage buffer.
+ *  @param rn_dev A pointer to the RecoNIC device.
+ *  @param paddr physical address of a host buffer allocated by allocate_rdma_buffer().
+ *  @return Virtual address of paddr, or NULL if paddr is not in the hugepage buffer.
+ */
+void* get_buffer_vaddr(struct rn_dev_t* rn_dev, uint64_t paddr);
+
 /** @brief Get AXI BAR mapping window mask for calculating BDF address mask.
  *  @return Window mask.
  */
@@ -193,15 +459,188 @@ uint64_t get_win_size();
  */
 void config_rn_dev_axib_bdf(struct rn_dev_t* rn_dev, uint32_t high_addr, uint32_t low_addr);
 
+/** @brief Get the PCIe bridge address of a physically contiguous host range, taking a
+ *         reference on the BDF window that translates it.
+ *
+ *  A window already translating the 128GB host region of the range is shared. Otherwise
+ *  a window that is not used by base_buf and has no reference is reprogrammed.
+ *  @param rn_dev A pointer to the RecoNIC device.
+ *  @param paddr Host physical address of the range.
+ *  @param size Size of the range. The range must not cross a 128GB boundary.
+ *  @return Bridge address of paddr, or AXIB_BDF_MAP_FAILED. Release it with 
+ *          unmap_axib_bdf_window().
+ */
+uint64_t map_axib_bdf_window(struct rn_dev_t* rn_dev, uint64_t paddr, uint64_t size);
+
+/** @brief Release a reference taken by map_axib_bdf_window().
+ *  @param rn_dev A pointer to the RecoNIC device.
+ *  @param bridge_addr Bridge address returned by map_axib_bdf_window().
+ *  @return void.
+ */
+void unmap_axib_bdf_window(struct rn_dev_t* rn_dev, uint64_t bridge_addr);
+
+/** @brief Print the translation and usage of each BDF window to stderr.
+ *  @param rn_dev A pointer to the RecoNIC device.
+ *  @return void.
+ */
+void dump_axib_bdf_windows(struct rn_dev_t* rn_dev);
+
 /** @brief Allocate a buffer for RDMA communication.
+ *
+ *  Host buffers come from the pre-allocated hugepage buffer. Buffers of up to half a 
+ *  HARDWARE_PAGE_SIZE are taken from size-class slabs and never cross a 4KB boundary; 
+ *  larger buffers are 4KB-aligned power-of-two blocks of a buddy allocator. Device 
+ *  buffers are allocated the same way from the device memory channels, with 64KB blocks.
  *  @param rn_dev A pointer to the RecoNIC device.
  *  @param buf_size buffer size.
  *  @param buf_location buffer location, either host memory ("host_mem") 
  *                      or device memory ("dev_mem").
- *  @return a pointer to the RDMA buffer allocated.
+ *  @return a pointer to the RDMA buffer allocated. Release it with free_rdma_buffer().
  */
 struct rdma_buff_t* allocate_rdma_buffer(struct rn_dev_t* rn_dev, uint64_t buf_size, char* buf_location);
 
+/** @brief Free a buffer allocated by allocate_rdma_buffer().
+ *
+ *  The descriptor is returned to the descriptor pool, so it must not be passed to free().
+ *  Memory regions of the MR cache overlapping the buffer are invalidated, see 
+ *  rdma_mr_cache_invalidate().
+ *  @param rn_dev A pointer to the RecoNIC device.
+ *  @param rdma_buffer A pointer to the RDMA buffer.
+ *  @return void.
+ */
+void free_rdma_buffer(struct rn_dev_t* rn_dev, struct rdma_buff_t* rdma_buffer);
+
+/** @brief Register an application buffer for RDMA communication without copying it
+ *         into the pre-allocated hugepage buffer.
+ *
+ *  The buffer is locked with mlock(), unless the application already locked all of its
+ *  pages, and must be physically contiguous, e.g. within a hugepage. Its dma_addr is a bridge address of a BDF window, see map_axib_bdf_window(),
+ *  so the descriptor can be used like one from allocate_rdma_buffer(). Reading physical
+ *  addresses requires root privileges.
+ *  @param rn_dev A pointer to the RecoNIC device.
+ *  @param buffer virtual address of the buffer.
+ *  @param buf_size buffer size.
+ *  @return a pointer to the RDMA buffer, or NULL on failure. Release it with 
+ *          deregister_rdma_buffer() or free_rdma_buffer().
+ */
+struct rdma_buff_t* register_rdma_buffer(struct rn_dev_t* rn_dev, void* buffer, uint64_t buf_size);
+
+/** @brief Deregister a buffer registered by register_rdma_buffer().
+ *
+ *  Its BDF window reference is released. Pages locked by register_rdma_buffer() are
+ *  unlocked unless another registered buffer still uses them, pages the application
+ *  locked itself stay locked. Memory regions of the MR cache overlapping the buffer are
+ *  invalidated. The application memory itself is not freed.
+ *  @param rn_dev A pointer to the RecoNIC device.
+ *  @param rdma_buffer A pointer to the RDMA buffer.
+ *  @return void.
+ */
+void deregister_rdma_buffer(struct rn_dev_t* rn_dev, struct rdma_buff_t* rdma_buffer);
+
+/** @brief Resize a buffer allocated by allocate_rdma_buffer().
+ *
+ *  The buffer is resized in place if its block is large enough. Otherwise data is 
+ *  copied to a new block and buffer and dma_addr of the descriptor change, so 
+ *  memory regions of the MR cache on the old buffer are invalidated and must be 
+ *  registered again. A device 
+ *  buffer stays on its channel and is copied through a host bounce buffer. Buffers from 
+ *  register_rdma_buffer() cannot be resized.
+ *  @param rn_dev A pointer to the RecoNIC device.
+ *  @param rdma_buffer A pointer to the RDMA buffer.
+ *  @param buf_size new buffer size.
+ *  @return rdma_buffer, or NULL if it cannot be resized. rdma_buffer is unchanged on failure.
+ */
+struct rdma_buff_t* realloc_rdma_buffer(struct rn_dev_t* rn_dev, struct rdma_buff_t* rdma_buffer, uint64_t buf_size);
+
+/** @brief Configure the device memory channels.
+ *
+ *  Must be called before the first device buffer is allocated. Without it, the device 
+ *  memory is one DEVICE_MEM_SIZE channel with first-fit placement.
+ *  @param rn_dev A pointer to the RecoNIC device.
+ *  @param num_channels Number of channels, up to DEVICE_MEM_MAX_CHANNELS.
+ *  @param channel_size Size of each channel in bytes.
+ *  @param placement Channel selection of allocate_rdma_buffer().
+ *  @return Success (0) or Failure (-1).
+ */
+int config_rn_dev_mem(struct rn_dev_t* rn_dev, uint32_t num_channels, uint64_t channel_size, 
+                      enum dev_mem_placement_t placement);
+
+/** @brief Allocate a device buffer on a given device memory channel.
+ *  @param rn_dev A pointer to the RecoNIC device.
+ *  @param buf_size buffer size.
+ *  @param channel Device memory channel.
+ *  @return a pointer to the RDMA buffer allocated, or NULL if the channel is full.
+ */
+struct rdma_buff_t* allocate_dev_buffer_on_channel(struct rn_dev_t* rn_dev, uint64_t buf_size, uint32_t channel);
+
+/** @brief Get the device memory channel of a device buffer.
+ *  @param rn_dev A pointer to the RecoNIC device.
+ *  @param rdma_buffer A pointer to a device buffer.
+ *  @return Channel number.
+ */
+uint32_t get_dev_buffer_channel(struct rn_dev_t* rn_dev, struct rdma_buff_t* rdma_buffer);
+
+/** @brief Allocate a device buffer striped over all device memory channels.
+ *  @param rn_dev A pointer to the RecoNIC device.
+ *  @param buf_size buffer size.
+ *  @param stripe_size Size of a stripe unit, a multiple of HARDWARE_PAGE_SIZE.
+ *  @return a pointer to the striped buffer, or NULL on failure.
+ */
+struct dev_stripe_buff_t* allocate_striped_dev_buffer(struct rn_dev_t* rn_dev, uint64_t buf_size, uint64_t stripe_size);
+
+/** @brief Free a striped device buffer.
+ *  @param rn_dev A pointer to the RecoNIC device.
+ *  @param stripe A pointer to the striped buffer.
+ *  @return void.
+ */
+void free_striped_dev_buffer(struct rn_dev_t* rn_dev, struct dev_stripe_buff_t* stripe);
+
+/** @brief Get the device address of an offset in a striped buffer.
+ *  @param stripe A pointer to the striped buffer.
+ *  @param offset Offset in the striped buffer.
+ *  @param len Returns the number of contiguous bytes at the address, up to the end of 
+ *             the stripe unit. Can be NULL.
+ *  @return Device address.
+ */
+uint64_t get_striped_dev_addr(struct dev_stripe_buff_t* stripe, uint64_t offset, uint64_t* len);
+
+/** @brief Write host data to a striped device buffer.
+ *  @param stripe A pointer to the striped buffer.
+ *  @param buffer Source host buffer.
+ *  @param size size of data.
+ *  @param offset Destination offset in the striped buffer.
+ *  @return Return size of data written successfully, or -EIO.
+ */
+ssize_t write_striped_dev_buffer(struct dev_stripe_buff_t* stripe, char* buffer, uint64_t size, uint64_t offset);
+
+/** @brief Read a striped device buffer to host memory.
+ *  @param stripe A pointer to the striped buffer.
+ *  @param buffer Destination host buffer.
+ *  @param size size of data.
+ *  @param offset Source offset in the striped buffer.
+ *  @return Return size of data read successfully, or -EIO.
+ */
+ssize_t read_striped_dev_buffer(struct dev_stripe_buff_t* stripe, char* buffer, uint64_t size, uint64_t offset);
+
+/** @brief Print usage and fragmentation statistics of the device memory channels.
+ *  @param rn_dev A pointer to the RecoNIC device.
+ *  @return void.
+ */
+void dump_dev_mem_stats(struct rn_dev_t* rn_dev);
+
+/** @brief Print usage and fragmentation statistics of the host hugepage pool.
+ *  @param rn_dev A pointer to the RecoNIC device.
+ *  @return void.
+ */
+void dump_host_mem_stats(struct rn_dev_t* rn_dev);
+
+/** @brief Release the host and device memory allocators and the descriptor pool of a 
+ *         RecoNIC device.
+ *  @param rn_dev A pointer to the RecoNIC device.
+ *  @return void.
+ */
+void destroy_rdma_buffer_pool(struct rn_dev_t* rn_dev);
+
 /** @brief Create a RecoNIC device.
  *  @param pcie_resource Path to resource2 of a PCIe device.
  *  @param rn_scr File descriptor of the PCIe device resource2 for FPGA register access.
@@ -212,4 +651,57 @@ struct rdma_buff_t* allocate_rdma_buffer(struct rn_dev_t* rn_dev, uint64_t buf_s
  */
 struct rn_dev_t* create_rn_dev(char* pcie_resource, int* pcie_resource_fd, uint32_t num_hugepages_request, uint32_t num_qp);
 
+/** @brief Create a RecoNIC device with a given hugepage size.
+ *
+ *  The hugepage buffer is reserved for num_hugepages_request hugepages, but only 
+ *  HUGEPAGE_POOL_INITIAL_SIZE is mapped at creation; it grows on demand. 1GB hugepages 
+ *  must be reserved by the kernel, e.g. with the hugepagesz=1G hugepages=N boot parameters.
+ *  @param pcie_resource Path to resource2 of a PCIe device.
+ *  @param rn_scr File descriptor of the PCIe device resource2 for FPGA register access.
+ *  @param num_hugepages_request Pre-allocate a hugepage buffer with the size of 
+ *                               num_hugepages_request * (1 << hugepage_shift)
+ *  @param num_qp Number of RDMA queue pairs required.
+ *  @param hugepage_shift HUGE_PAGE_SHIFT (2MB) or HUGE_PAGE_1GB_SHIFT (1GB).
+ *  @return A RecoNIC device pointer.
+ */
+struct rn_dev_t* create_rn_dev_hugepage(char* pcie_resource, int* pcie_resource_fd, uint32_t num_hugepages_request, 
+                                        uint32_t num_qp, uint32_t hugepage_shift);
+
+/** @brief Initialize a hugepage buffer configuration with default values.
+ *
+ *  HUGEPAGE_POOL_INITIAL_SIZE is mapped at creation, the buffer grows by 
+ *  HUGEPAGE_POOL_GROW_SIZE, and pages are faulted in by mlock().
+ *  @param config A pointer to the configuration.
+ *  @param max_hugepages Number of hugepages reserved.
+ *  @param hugepage_shift HUGE_PAGE_SHIFT (2MB) or HUGE_PAGE_1GB_SHIFT (1GB).
+ *  @return void.
+ */
+void hugepage_pool_config_init(struct hugepage_pool_config_t* config, uint32_t max_hugepages, uint32_t hugepage_shift);
+
+/** @brief Create a RecoNIC device with a given hugepage buffer configuration.
+ *  @param pcie_resource Path to resource2 of a PCIe device.
+ *  @param rn_scr File descriptor of the PCIe device resource2 for FPGA register access.
+ *  @param num_qp Number of RDMA queue pairs required.
+ *  @param config A pointer to the hugepage buffer configuration.
+ *  @return A RecoNIC device pointer.
+ */
+struct rn_dev_t* create_rn_dev_pool(char* pcie_resource, int* pcie_resource_fd, uint32_t num_qp, 
+                                    struct hugepage_pool_config_t* config);
+
+/** @brief Map more hugepages in the pre-allocated hugepage buffer.
+ *
+ *  allocate_rdma_buffer() grows the buffer when it is full, this function can be used to 
+ *  grow it ahead of time.
+ *  @param rn_dev A pointer to the RecoNIC device.
+ *  @param num_hugepages Number of hugepages to map.
+ *  @return Success (0) or Failure (-1) if the reservation is exhausted or mapping failed.
+ */
+int grow_hugepage_pool(struct rn_dev_t* rn_dev, uint32_t num_hugepages);
+
+/** @brief Print size and timing of the pre-allocated hugepage buffer.
+ *  @param rn_dev A pointer to the RecoNIC device.
+ *  @return void.
+ */
+void dump_hugepage_pool_stats(struct rn_dev_t* rn_dev);
+
 #endif /* __RECONIC_H__ */
@@ -7,12 +7,16 @@
 #include <stdio.h>
 #include <stdint.h>
 #include "hls_stream.h"
+#include "cl_box.h"
 
 // TODO: Do not consider tiled based MM at the moment
+// A command of CTL_CMD_SIZE_64 words carries {low, high} pairs of the A, B and C base
+// addresses; a command of CTL_CMD_SIZE_32 words carries 32-bit base addresses.
 void parse_ctl_cmd(hls::stream<uint32_t> &ctl_cmd_stream, int &a_baseaddr, int &b_baseaddr, \
-                   int &c_baseaddr, int &a_row, int &a_col, int &b_col, int &work_id) {
+                   int &c_baseaddr, int &a_row, int &a_col, int &b_col, int &work_id, \
+                   int &a_baseaddr_hi, int &b_baseaddr_hi, int &c_baseaddr_hi) {
 
-    uint32_t cmd_array[5] = {0};
+    uint32_t cmd_array[CTL_CMD_SIZE_64 - 1] = {0};
     uint32_t ctl_cmd;
     bool has_item;
     uint32_t cmd_size;
@@ -24,13 +28,29 @@ void parse_ctl_cmd(hls::stream<uint32_t> &ctl_cmd_stream, int &a_baseaddr, int &
         cmd_recved = cmd_recved + 1;
     }
 
-    a_baseaddr = (int) cmd_array[0];
-    b_baseaddr = (int) cmd_array[1];
-    c_baseaddr = (int) cmd_array[2];
-    a_row = (int) (cmd_array[3] >> 16);
-    a_col = (int) (cmd_array[3] & 0x0000ffff);
-    b_col = (int) (cmd_array[4] >> 16);
-    work_id = (int) (cmd_array[4] & 0x0000ffff);
+    if(cmd_size == CTL_CMD_SIZE_64) {
+        a_baseaddr    = (int) cmd_array[0];
+        a_baseaddr_hi = (int) cmd_array[1];
+        b_baseaddr    = (int) cmd_array[2];
+        b_baseaddr_hi = (int) cmd_array[3];
+        c_baseaddr    = (int) cmd_array[4];
+        c_baseaddr_hi = (int) cmd_array[5];
+        a_row = (int) (cmd_array[6] >> 16);
+        a_col = (int) (cmd_array[6] & 0x0000ffff);
+        b_col = (int) (cmd_array[7] >> 16);
+        work_id = (int) (cmd_array[7] & 0x0000ffff);
+    } else {
+        a_baseaddr    = (int) cmd_array[0];
+        a_baseaddr_hi = 0;
+        b_baseaddr    = (int) cmd_array[1];
+        b_baseaddr_hi = 0;
+        c_baseaddr    = (int) cmd_array[2];
+        c_baseaddr_hi = 0;
+        a_row = (int) (cmd_array[3] >> 16);
+        a_col = (int) (cmd_array[3] & 0x0000ffff);
+        b_col = (int) (cmd_array[4] >> 16);
+        work_id = (int) (cmd_array[4] & 0x0000ffff);
+    }
 }
 
 // TODO: In the current implementation, we let the host to send control commands for simplicity.
@@ -38,7 +58,8 @@ void parse_ctl_cmd(hls::stream<uint32_t> &ctl_cmd_stream, int &a_baseaddr, int &
 //       commands and let a kernel to get actual control command by itself via AXI interface.
 // TODO: Do not consider tiled based MM at the moment
 void cl_box(hls::stream<uint32_t> &ctl_cmd_stream, int &a_baseaddr, int &b_baseaddr, \
-            int &c_baseaddr, int &a_row, int &a_col, int &b_col, int &work_id) {
+            int &c_baseaddr, int &a_row, int &a_col, int &b_col, int &work_id, \
+            int &a_baseaddr_hi, int &b_baseaddr_hi, int &c_baseaddr_hi) {
 
     //#pragma HLS INTERFACE ap_vld port=a_baseaddr
     //#pragma HLS INTERFACE ap_vld port=b_baseaddr
@@ -51,6 +72,7 @@ void cl_box(hls::stream<uint32_t> &ctl_cmd_stream, int &a_baseaddr, int &b_basea
     uint32_t cmd_size;
     bool has_item;
 
-    parse_ctl_cmd(ctl_cmd_stream, a_baseaddr, b_baseaddr, c_baseaddr, a_row, a_col, b_col, work_id);
+    parse_ctl_cmd(ctl_cmd_stream, a_baseaddr, b_baseaddr, c_baseaddr, a_row, a_col, b_col, work_id, \
+                  a_baseaddr_hi, b_baseaddr_hi, c_baseaddr_hi);
 
 }
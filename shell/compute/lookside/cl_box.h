@@ -9,10 +9,16 @@
 
 #include "hls_stream.h"
 
+// Number of words of a control command with 32-bit and 64-bit base addresses
+#define CTL_CMD_SIZE_32 6
+#define CTL_CMD_SIZE_64 9
+
 void parse_ctl_cmd(hls::stream<uint32_t> &ctl_cmd_stream, int &a_baseaddr, int &b_baseaddr, \
-                   int &c_baseaddr, int &a_row, int &a_col, int &b_col, int &work_id);
+                   int &c_baseaddr, int &a_row, int &a_col, int &b_col, int &work_id, \
+                   int &a_baseaddr_hi, int &b_baseaddr_hi, int &c_baseaddr_hi);
 
 void cl_box(hls::stream<uint32_t> &ctl_cmd_stream, int &a_baseaddr, int &b_baseaddr, \
-            int &c_baseaddr, int &a_row, int &a_col, int &b_col, int &work_id);
+            int &c_baseaddr, int &a_row, int &a_col, int &b_col, int &work_id, \
+            int &a_baseaddr_hi, int &b_baseaddr_hi, int &c_baseaddr_hi);
 
 #endif
\ No newline at end of file
@@ -96,6 +96,12 @@ logic [31:0] b_baseaddr;
 logic        b_baseaddr_ap_vld;
 logic [31:0] c_baseaddr;
 logic        c_baseaddr_ap_vld;
+logic [31:0] a_baseaddr_hi;
+logic        a_baseaddr_hi_ap_vld;
+logic [31:0] b_baseaddr_hi;
+logic        b_baseaddr_hi_ap_vld;
+logic [31:0] c_baseaddr_hi;
+logic        c_baseaddr_hi_ap_vld;
 logic [31:0] a_row;
 logic        a_row_ap_vld;
 logic [31:0] a_col;
@@ -192,7 +198,13 @@ cl_box cl_box_wrapper (
   .b_col                       (b_col),
   .b_col_ap_vld                (b_col_ap_vld),
   .work_id                     (work_id),
-  .work_id_ap_vld              (work_id_ap_vld)
+  .work_id_ap_vld              (work_id_ap_vld),
+  .a_baseaddr_hi               (a_baseaddr_hi),
+  .a_baseaddr_hi_ap_vld        (a_baseaddr_hi_ap_vld),
+  .b_baseaddr_hi               (b_baseaddr_hi),
+  .b_baseaddr_hi_ap_vld        (b_baseaddr_hi_ap_vld),
+  .c_baseaddr_hi               (c_baseaddr_hi),
+  .c_baseaddr_hi_ap_vld        (c_baseaddr_hi_ap_vld)
 );
 
 mmult kernel_mmult (
@@ -283,9 +295,12 @@ always_ff @(posedge axis_aclk) begin
   end
   else begin
     ap_start <= 1'b0;
-    a_baseaddr_reg <= a_baseaddr_ap_vld ? {32'd0, a_baseaddr} : a_baseaddr_reg;
-    b_baseaddr_reg <= b_baseaddr_ap_vld ? {32'd0, b_baseaddr} : b_baseaddr_reg;
-    c_baseaddr_reg <= c_baseaddr_ap_vld ? {32'd0, c_baseaddr} : c_baseaddr_reg;
+    a_baseaddr_reg[31:0]  <= a_baseaddr_ap_vld ? a_baseaddr : a_baseaddr_reg[31:0];
+    b_baseaddr_reg[31:0]  <= b_baseaddr_ap_vld ? b_baseaddr : b_baseaddr_reg[31:0];
+    c_baseaddr_reg[31:0]  <= c_baseaddr_ap_vld ? c_baseaddr : c_baseaddr_reg[31:0];
+    a_baseaddr_reg[63:32] <= a_baseaddr_hi_ap_vld ? a_baseaddr_hi : a_baseaddr_reg[63:32];
+    b_baseaddr_reg[63:32] <= b_baseaddr_hi_ap_vld ? b_baseaddr_hi : b_baseaddr_reg[63:32];
+    c_baseaddr_reg[63:32] <= c_baseaddr_hi_ap_vld ? c_baseaddr_hi : c_baseaddr_reg[63:32];
 
     a_row_reg     <= a_row_ap_vld ? a_row : a_row_reg;
     a_col_reg     <= a_col_ap_vld ? a_col : a_col_reg;
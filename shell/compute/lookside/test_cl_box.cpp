@@ -20,7 +20,6 @@ Description:
 #include "cl_box.h"
 
 #define NUM_ENTRY 1
-#define CTL_CMD_SIZE 6
 
 void init_streams(hls::stream<uint32_t> &ctl_cmds, hls::stream<int> &sw_status_stream) {
   int i=0;
@@ -33,7 +32,7 @@ void init_streams(hls::stream<uint32_t> &ctl_cmds, hls::stream<int> &sw_status_s
   int work_id = 0x00dd;
   int ctl_last = (b_col<<16) | work_id;
   for(i=0; i<NUM_ENTRY; i++) {
-    ctl_cmds.write(CTL_CMD_SIZE);
+    ctl_cmds.write(CTL_CMD_SIZE_32);
     ctl_cmds.write(a_baseaddr + i*0x100);
     ctl_cmds.write(b_baseaddr + i*0x100);
     ctl_cmds.write(c_baseaddr + i*0x100);
@@ -43,6 +42,32 @@ void init_streams(hls::stream<uint32_t> &ctl_cmds, hls::stream<int> &sw_status_s
   }
 }
 
+// A CTL_CMD_SIZE_64 command, with the words in the order issue_ctl_cmd() sends them
+void init_stream_64(hls::stream<uint32_t> &ctl_cmds, uint64_t a_baseaddr, uint64_t b_baseaddr, \
+                    uint64_t c_baseaddr, uint32_t a_row_col, uint32_t ctl_last) {
+  ctl_cmds.write(CTL_CMD_SIZE_64);
+  ctl_cmds.write((uint32_t) a_baseaddr);
+  ctl_cmds.write((uint32_t) (a_baseaddr >> 32));
+  ctl_cmds.write((uint32_t) b_baseaddr);
+  ctl_cmds.write((uint32_t) (b_baseaddr >> 32));
+  ctl_cmds.write((uint32_t) c_baseaddr);
+  ctl_cmds.write((uint32_t) (c_baseaddr >> 32));
+  ctl_cmds.write(a_row_col);
+  ctl_cmds.write(ctl_last);
+}
+
+// Check the words cl_box drives to the kernel for a base address
+int check_baseaddr(const char *name, uint64_t expected, int baseaddr, int baseaddr_hi) {
+    uint64_t addr = ((uint64_t) (uint32_t) baseaddr_hi << 32) | (uint32_t) baseaddr;
+
+    if (addr != expected) {
+        std::cout << "Error: " << name << " = 0x" << std::hex << addr << ", expected 0x" \
+                  << expected << std::dec << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
 int main(int argc, char **argv) {
 
     //Allocate Memory in Host Memory
@@ -53,6 +78,9 @@ int main(int argc, char **argv) {
     int a_baseaddr;
     int b_baseaddr;
     int c_baseaddr;
+    int a_baseaddr_hi;
+    int b_baseaddr_hi;
+    int c_baseaddr_hi;
     int a_row;
     int a_col;
     int b_col;
@@ -66,7 +94,8 @@ int main(int argc, char **argv) {
 
     // Call hw implementation
     //cl_box(ctl_cmd_stream, hw_status_stream, a_baseaddr, b_baseaddr, c_baseaddr, a_row, a_col, b_col);
-    cl_box(ctl_cmd_stream, a_baseaddr, b_baseaddr, c_baseaddr, a_row, a_col, b_col, hw_work_id);
+    cl_box(ctl_cmd_stream, a_baseaddr, b_baseaddr, c_baseaddr, a_row, a_col, b_col, hw_work_id, \
+           a_baseaddr_hi, b_baseaddr_hi, c_baseaddr_hi);
 
     // Compare the results of the Device to the simulation
     for (int i = 0; i < NUM_ENTRY; i++) {
@@ -82,6 +111,29 @@ int main(int argc, char **argv) {
         }
     }
 
+    // Base addresses of a 32-bit command have no upper half
+    match |= check_baseaddr("a_baseaddr", 0x00010000, a_baseaddr, a_baseaddr_hi);
+    match |= check_baseaddr("b_baseaddr", 0x00020000, b_baseaddr, b_baseaddr_hi);
+    match |= check_baseaddr("c_baseaddr", 0x00030000, c_baseaddr, c_baseaddr_hi);
+
+    // 64-bit command with base addresses in the second, third and fourth 4GB DDR channels
+    init_stream_64(ctl_cmd_stream, 0x100010000ULL, 0x2fffff000ULL, 0x380000000ULL, 0x00200008, 0x000400ee);
+    cl_box(ctl_cmd_stream, a_baseaddr, b_baseaddr, c_baseaddr, a_row, a_col, b_col, hw_work_id, \
+           a_baseaddr_hi, b_baseaddr_hi, c_baseaddr_hi);
+
+    match |= check_baseaddr("a_baseaddr", 0x100010000ULL, a_baseaddr, a_baseaddr_hi);
+    match |= check_baseaddr("b_baseaddr", 0x2fffff000ULL, b_baseaddr, b_baseaddr_hi);
+    match |= check_baseaddr("c_baseaddr", 0x380000000ULL, c_baseaddr, c_baseaddr_hi);
+    if ((a_row != 0x20) || (a_col != 0x8) || (b_col != 0x4) || (hw_work_id != 0xee)) {
+        std::cout << "Error: 64-bit command decoded as a_row = " << a_row << ", a_col = " << a_col \
+                  << ", b_col = " << b_col << ", work_id = " << hw_work_id << std::endl;
+        match = 1;
+    }
+    if (!ctl_cmd_stream.empty()) {
+        std::cout << "Error: words of the 64-bit command left in the stream" << std::endl;
+        match = 1;
+    }
+
     std::cout << "TEST " << (match ? "FAILED" : "PASSED") << std::endl;
     return (match ? EXIT_FAILURE : EXIT_SUCCESS);
 }